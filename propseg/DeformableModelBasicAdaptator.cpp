@@ -1,20 +1,12 @@
 #define _SCL_SECURE_NO_WARNINGS
 #include "DeformableModelBasicAdaptator.h"
+#include "LBFGSWarmStartOptimizer.h"
 
 #include <vector>
 #include <itkTriangleCell.h>
 #include <itkPointSet.h>
 #include <itkVector.h>
 #include <itkDefaultDynamicMeshTraits.h>
-#include <itkConjugateGradientOptimizer.h>
-#include <itkLBFGSOptimizer.h>
-
-#include <vtkPolyData.h>
-#include <vtkSmartPointer.h>
-#include <vtkPolyDataNormals.h>
-#include <vtkPointData.h>
-#include <vtkPoints.h>
-#include <vtkCellArray.h>
 
 using namespace std;
 
@@ -26,64 +18,7 @@ typedef itk::TriangleCell<CellInterface> CellType;
 typedef itk::Vector<double,3> VectorType;
 
 
-typedef itk::ConjugateGradientOptimizer  OptimizerType;
-//typedef itk::LBFGSOptimizer OptimizerType;
-typedef OptimizerType::InternalOptimizerType  vnlOptimizerType;
-
-class CommandIterationUpdateConjugateGradient : public itk::Command
-{
-public:
-    typedef  CommandIterationUpdateConjugateGradient   Self;
-    typedef  itk::Command             Superclass;
-    typedef itk::SmartPointer<Self>  Pointer;
-    itkNewMacro( Self );
-protected:
-    CommandIterationUpdateConjugateGradient()
-    {
-        m_IterationNumber=0;
-        m_IterationDerivativeNumber=0;
-    }
-public:
-    typedef itk::ConjugateGradientOptimizer   OptimizerType;
-    typedef   const OptimizerType   *    OptimizerPointer;
-    
-    void Execute(itk::Object *caller, const itk::EventObject & event)
-    {
-        Execute( (const itk::Object *)caller, event);
-    }
-    
-    void Execute(const itk::Object * object, const itk::EventObject & event)
-    {
-        OptimizerPointer optimizer =
-        dynamic_cast< OptimizerPointer >( object );
-        if( m_FunctionEvent.CheckEvent( &event ) )
-        {
-            m_IterationNumber++;
-            if (m_IterationNumber>50000) {
-                throw itk::ExceptionObject("ERROR: Too many iterations");
-                //std::cout << m_IterationNumber << "   ";
-                //std::cout << optimizer->GetCachedValue() << "   ";
-                //std::cout << optimizer->GetCachedCurrentPosition() << std::endl;
-            }
-        }
-        else if( m_GradientEvent.CheckEvent( &event ) )
-        {
-            m_IterationDerivativeNumber++;
-            if (m_IterationDerivativeNumber>10000) {
-                throw itk::ExceptionObject("ERROR: Too many iterations");
-                //std::cout << m_IterationDerivativeNumber << "   ";
-                //std::cout << "Gradient " << optimizer->GetCachedDerivative() << "   ";
-            }
-        }
-        
-    }
-private:
-    unsigned long m_IterationNumber, m_IterationDerivativeNumber;
-    
-    
-    itk::FunctionEvaluationIterationEvent m_FunctionEvent;
-    itk::GradientEvaluationIterationEvent m_GradientEvent;
-};
+typedef LBFGSWarmStartOptimizer OptimizerType;
 
 
 DeformableModelBasicAdaptator::DeformableModelBasicAdaptator(
@@ -100,8 +35,12 @@ DeformableModelBasicAdaptator::DeformableModelBasicAdaptator(
     verbose_ = false;
 
     line_search = 15;
+	deltaNormale = 0.2;
 	alpha = 25.0;
 	beta = 0.0;
+
+	outputMesh_ = 0;
+	initMultiResolution();
 }
 
 DeformableModelBasicAdaptator::DeformableModelBasicAdaptator(
@@ -124,8 +63,12 @@ DeformableModelBasicAdaptator::DeformableModelBasicAdaptator(
     verbose_ = false;
 
     line_search = 15;
+	deltaNormale = 0.2;
 	alpha = 25.0;
 	beta = 0.0;
+
+	outputMesh_ = 0;
+	initMultiResolution();
 }
 
 DeformableModelBasicAdaptator::DeformableModelBasicAdaptator(
@@ -149,18 +92,36 @@ DeformableModelBasicAdaptator::DeformableModelBasicAdaptator(
     verbose_ = false;
 
     line_search = 15;
+	deltaNormale = 0.2;
 	alpha = 25.0;
 	beta = 0.0;
+
+	outputMesh_ = 0;
+	initMultiResolution();
 }
 
 DeformableModelBasicAdaptator::~DeformableModelBasicAdaptator()
 {
 }
 
+void DeformableModelBasicAdaptator::initMultiResolution()
+{
+	multiResolution_ = false;
+	coarseImage_ = 0;
+	radialResolutionMultiResolution_ = 0;
+	coarseDeltaNormale_ = 0.5;
+	coarseLineSearch_ = 8;
+	fineLineSearch_ = 5;
+	fineNumberOptimizerIteration_ = 100;
+	fineNumberOfIteration_ = 1;
+}
+
 double DeformableModelBasicAdaptator::adaptation()
 {
+	if (multiResolution_) return adaptationMultiResolution();
+
 	//if (verbose_) cout << "Creation des variables, de l'optimiseur et de la fonction de cout..." << endl;
-	vector<Vertex*> points = mesh_->getListPoints();
+	const vector<Vertex*>& points = mesh_->getListPoints();
 	int nbPoints = points.size();
 	OptimizerType::ParametersType initialValue(3*nbPoints);
 	CVector3 p;
@@ -175,11 +136,18 @@ double DeformableModelBasicAdaptator::adaptation()
 	currentValue = initialValue;
 
 
-	vector<int> triangles = mesh_->getListTriangles();
+	const vector<int>& triangles = mesh_->getListTriangles();
 
-	FoncteurDeformableBasicLocalAdaptation* costFunction = new FoncteurDeformableBasicLocalAdaptation(image_,mesh_,initialValue,nbPoints);
+	// La fonction de cout est creee au premier appel puis reinitialisee pour le nouveau maillage
+	if (costFunction_.IsNull()) {
+		costFunction_ = new FoncteurDeformableBasicLocalAdaptation(image_,mesh_,initialValue,nbPoints);
+		costFunction_->UnRegister();
+	}
+	else costFunction_->setInput(image_,mesh_,initialValue,nbPoints);
+	FoncteurDeformableBasicLocalAdaptation* costFunction = costFunction_;
     costFunction->setVerbose(verbose_);
     costFunction->addCorrectionPoints(points_mask_correction_);
+    costFunction->setFixedPoints(fixedPoints_);
 	/*if (contrast != -1.0) costFunction->setTradeOff(0.0001*contrast*contrast+0.026*contrast-1.6242);
     else {
         unsigned int index_nearest = 0;
@@ -217,40 +185,28 @@ double DeformableModelBasicAdaptator::adaptation()
 		costFunction->setAlpha(alpha);
 		costFunction->setBeta(beta);
 		costFunction->setLineSearchLength(line_search);
+		costFunction->setDeltaNormale(deltaNormale);
 		costFunction->computeOptimalPoints(initialValue);
 	}
 
-	OptimizerType::Pointer itkOptimizer = OptimizerType::New();
-	itkOptimizer->SetCostFunction( costFunction );
-	itkOptimizer->SetInitialPosition( currentValue );
-
-	const double F_Tolerance      = 1e-4;  // Function value tolerance
-	const double G_Tolerance      = 1e-6;  // Gradient magnitude tolerance 
-	const double X_Tolerance      = 1e-8;  // Search space tolerance
-	const double Epsilon_Function = 1e-10; // Step
-	const int    Max_Iterations   = numberOptimizerIteration; // Maximum number of iterations
-
-	vnlOptimizerType * vnlOptimizer = itkOptimizer->GetOptimizer();
-	vnlOptimizer->set_f_tolerance( F_Tolerance );
-	vnlOptimizer->set_g_tolerance( G_Tolerance );
-	vnlOptimizer->set_x_tolerance( X_Tolerance ); 
-	vnlOptimizer->set_epsilon_function( Epsilon_Function );
-	vnlOptimizer->set_max_function_evals( Max_Iterations );
-
-	vnlOptimizer->set_check_derivatives( 1 );
-    
-    CommandIterationUpdateConjugateGradient::Pointer observer =
-    CommandIterationUpdateConjugateGradient::New();
-    itkOptimizer->AddObserver( itk::IterationEvent(), observer );
-    itkOptimizer->AddObserver( itk::FunctionEvaluationIterationEvent(), observer );
+#ifdef PROPSEG_CHECK_DERIVATIVES
+	// Validation des derivees analytiques par differences finies (debug seulement, tres couteux)
+	double derivativeError = costFunction->checkDerivatives(currentValue);
+	cout << "Maximal relative error on derivatives = " << derivativeError << endl;
+#endif
+
+	// L'optimiseur conserve sa memoire (paires de courbure) d'une iteration externe a l'autre
+	OptimizerType optimizer;
+	optimizer.setCostFunction( costFunction );
+	optimizer.setFunctionTolerance( 1e-4 );
+	optimizer.setGradientTolerance( 1e-6 );
+	optimizer.setMaximumNumberOfEvaluations( numberOptimizerIteration );
+	optimizer.setVerbose( verbose_ );
 	
-	//cout << "Valeur initiale de la fonction de cout = " << costFunction->GetInitialValue() << endl;
-	//cout << "Valeur initiale de la norme des derivees = " << costFunction->getInitialNormDerivatives() << endl;
-	
-	//cout << "Optimisation du maillage..." << endl;
 	bool done = false, error_occured = false;
 	double distance = 0.0;
-	Mesh* lastMesh = new Mesh;
+	// Positions du maillage d'origine et de l'iteration precedente, pour l'alignement rigide et le critere d'arret
+	OptimizerType::ParametersType originalValue = initialValue, lastValue = initialValue;
 	double newDistanceMeshInitial = 0.0;
 	for (int i=0; i<numberOfIteration_ && !done; i++)
 	{
@@ -263,8 +219,7 @@ double DeformableModelBasicAdaptator::adaptation()
         }
 		try
 		{
-		    //if (verbose_) cout << "start optimization" << endl;
-			itkOptimizer->StartOptimization();
+			optimizer.optimize( currentValue );
 		}
 		catch( itk::ExceptionObject & e )
 		{
@@ -274,34 +229,21 @@ double DeformableModelBasicAdaptator::adaptation()
 			cout << "Description = " << e.GetDescription() << endl;
             error_occured = true;
 		}
-        if (verbose_) {
-            cout << "Report from vnl optimizer for deformation : " << endl;
-            vnlOptimizer->diagnose_outcome( cout );
-            cout << endl;
-        }
 
-		currentValue = itkOptimizer->GetCurrentPosition();
-        if (currentValue.size() == 0)
-            currentValue = itkOptimizer->GetCachedCurrentPosition();
-        
-
-		Mesh* newMesh = new Mesh(*mesh_);
-		vector<Vertex*> pointsNewMesh = newMesh->getListPoints();
-		for (unsigned int i=0; i<nbPoints; i++)
-			pointsNewMesh[i]->setPosition(CVector3(currentValue[3*i],currentValue[3*i+1],currentValue[3*i+2]));
-		CMatrix4x4 transform = mesh_->ICP(newMesh);
-		newDistanceMeshInitial = mesh_->distanceMean(newMesh);
+		// Les correspondances sont connues (point i -> point i) : alignement rigide direct, sans ICP
+		CMatrix4x4 transform = Mesh::rigidAlignment(originalValue.data_block(),currentValue.data_block(),nbPoints);
+		newDistanceMeshInitial = Mesh::distanceMean(originalValue.data_block(),currentValue.data_block(),nbPoints);
 		if (verbose_) cout << "Distance from initial mesh [mm] = " << newDistanceMeshInitial << endl;
 		double relativeDistance = newDistanceMeshInitial;
 		if (i != 0) {
-			relativeDistance = lastMesh->distanceMean(newMesh);
+			relativeDistance = Mesh::distanceMean(lastValue.data_block(),currentValue.data_block(),nbPoints);
 			if (verbose_) cout << "Distance from last mesh [mm] = " << relativeDistance << endl;
 		}
 		
 		
 		if (relativeDistance <= stopCondition) done = true;
 		else {
-			lastMesh = newMesh;
+			lastValue = currentValue;
 			costFunction->setTransformation(transform);
 
 			for (unsigned int i=0; i<nbPoints; i++) {
@@ -310,7 +252,6 @@ double DeformableModelBasicAdaptator::adaptation()
 				initialValue[3*i+2] = currentValue[3*i+2];
 			}
 			costFunction->setInitialParameters( initialValue );
-			itkOptimizer->SetInitialPosition( currentValue );
 
 			//if (costFunction->getAbsoluteMeanDistance() < 0.1)
 			//	done = true;
@@ -323,15 +264,19 @@ double DeformableModelBasicAdaptator::adaptation()
 	myfile.close();*/
 	// mean 0.3600 std 0.3555 max 2.1927 min 0.0318
 
-	OptimizerType::ParametersType finalPosition;
-	finalPosition = itkOptimizer->GetCurrentPosition();
-    
-    if (finalPosition.size() == 0)
-        finalPosition = itkOptimizer->GetCachedCurrentPosition();
+	const OptimizerType::ParametersType& finalPosition = currentValue;
 
-	if (!meshBool_)
+	meshOutput_ = outputMesh_;
+	if (meshOutput_ == 0) meshOutput_ = new Mesh;
+	if (meshOutput_->getNbrOfPoints() == nbPoints && meshOutput_->getListTriangles().size() == triangles.size())
 	{
-		meshOutput_ = new Mesh;
+		// maillage de sortie reutilise : meme structure, seules les positions changent
+		meshOutput_->setPositions(finalPosition.data_block(),nbPoints);
+		if (meshBool_) meshOutput_->computeNormals();
+	}
+	else if (!meshBool_)
+	{
+		meshOutput_->clear();
 		for (unsigned int i=0; i<nbPoints; i++)
 			meshOutput_->addPoint(new Vertex(finalPosition[3*i],finalPosition[3*i+1],finalPosition[3*i+2]));
 		for (unsigned int i=0; i<triangles.size(); i+=3)
@@ -339,53 +284,73 @@ double DeformableModelBasicAdaptator::adaptation()
 	}
 	else
 	{
-		vtkSmartPointer<vtkPoints> pointsOut = vtkSmartPointer<vtkPoints>::New();
-		CVector3 pointT;
+		meshOutput_->clear();
+		int label = 1;
 		for (unsigned int i=0; i<nbPoints; i++)
-			pointsOut->InsertNextPoint(finalPosition[3*i],finalPosition[3*i+1],finalPosition[3*i+2]);
-		vtkSmartPointer<vtkPolyData> m_PolyData = vtkSmartPointer<vtkPolyData>::New();
-		m_PolyData->SetPoints(pointsOut);
-		m_PolyData->Allocate(triangles.size());
-		for (unsigned int i=0; i<triangles.size(); i+=3) {
-			vtkIdType pts[3] = {triangles[i],triangles[i+1],triangles[i+2]};
-			m_PolyData->InsertNextCell(VTK_TRIANGLE,3,pts);
-		}
+			meshOutput_->addPoint(new Vertex(CVector3(finalPosition[3*i],finalPosition[3*i+1],finalPosition[3*i+2]),CVector3(),label));
+		for (unsigned int i=0; i<triangles.size(); i+=3)
+			meshOutput_->addTriangle(triangles[i],triangles[i+1],triangles[i+2]);
 		// Calcul des normales
-		vtkSmartPointer<vtkPolyDataNormals> skinNormals = vtkSmartPointer<vtkPolyDataNormals>::New();
-		skinNormals->SetInputData(m_PolyData);
-		skinNormals->SetFeatureAngle(60.0);
-		skinNormals->ComputePointNormalsOn();
-		skinNormals->ComputeCellNormalsOff();
-		skinNormals->ConsistencyOff();
-		skinNormals->SplittingOff();
-		skinNormals->Update();
-		vtkSmartPointer<vtkPolyData> normales = vtkSmartPointer<vtkPolyData>::New();
-		normales->ShallowCopy(skinNormals->GetOutput());
-
-		meshOutput_ = new Mesh;
-		int label = 1;
-		vtkSmartPointer<vtkPoints> pointsMesh = normales->GetPoints();
-		double *pt, *norm;
-		CVector3 pointt, normale;
-		for (vtkIdType i = 0; i<pointsMesh->GetNumberOfPoints(); i++)
-		{
-			pt = pointsMesh->GetPoint(i);
-			norm = normales->GetPointData()->GetNormals()->GetTuple(i);
-			pointt = CVector3(pt[0],pt[1],pt[2]);
-			normale = CVector3(norm[0],norm[1],norm[2]);
-			meshOutput_->addPoint(new Vertex(pointt,normale,label));
-		}
-		vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
-		polys = normales->GetPolys();
-		vtkIdType nbTriangle;
-		const vtkIdType* po;
-		for (vtkIdType i = 0; i<polys->GetNumberOfCells(); i++)
-		{
-			polys->GetCell(4 * i, nbTriangle, po);
-			meshOutput_->addTriangle(po[0],po[1],po[2]);
-		}
-		meshOutput_->setLabel(2);
+		meshOutput_->computeNormals();
 	}
+	if (meshBool_) meshOutput_->setLabel(2);
 
 	return newDistanceMeshInitial;
 }
+
+
+/*!
+ * Coarse-to-fine deformation. The input mesh (before subdivision) is first deformed on the smoothed and downsampled gradient image with a longer and coarser search along the normals.
+ * The result is then prolongated to the fine level by subdivision, and a short refinement is performed on the full resolution gradient image.
+ */
+double DeformableModelBasicAdaptator::adaptationMultiResolution()
+{
+	// Niveau grossier
+	DeformableModelBasicAdaptator coarseAdaptator(*this);
+	coarseAdaptator.multiResolution_ = false;
+	coarseAdaptator.outputMesh_ = 0; // sortie intermediaire, detruite ci-dessous
+	coarseAdaptator.image_ = coarseImage_;
+	coarseAdaptator.changedParameters_ = true;
+	coarseAdaptator.deltaNormale = coarseDeltaNormale_;
+	coarseAdaptator.line_search = coarseLineSearch_;
+	coarseAdaptator.meshBool_ = true;
+	coarseAdaptator.adaptation();
+
+	// Prolongation au niveau fin par subdivision du maillage deforme
+	SpinalCord* fineMesh = coarseAdaptator.getSpinalCordOutput();
+	delete coarseAdaptator.getOutput();
+	fineMesh->setRadialResolution(radialResolutionMultiResolution_);
+	fineMesh->subdivision();
+	fineMesh->computeConnectivity();
+	if (verbose_) cout << "Coarse level done, refinement on " << fineMesh->getNbrOfPoints() << " points" << endl;
+
+	// Niveau fin : recherche courte autour de la solution prolongee
+	DeformableModelBasicAdaptator fineAdaptator(*this);
+	fineAdaptator.multiResolution_ = false;
+	fineAdaptator.mesh_ = fineMesh;
+	fineAdaptator.fixedPoints_.clear();
+	if (!fixedPoints_.empty())
+	{
+		// Prolongation des points fixes : un point du maillage subdivise est fixe si les points (disques et rayons voisins) dont il est issu le sont
+		int coarseRadialResolution = radialResolutionMultiResolution_, fineRadialResolution = fineMesh->getRadialResolution();
+		int numberOfFineDisks = fineMesh->getNbrOfPoints()/fineRadialResolution;
+		auto isFixed = [&](int disk, int k) { unsigned int i = disk*coarseRadialResolution+k; return i < fixedPoints_.size() && fixedPoints_[i] != 0; };
+		fineAdaptator.fixedPoints_.assign(fineMesh->getNbrOfPoints(),0);
+		for (int e=0; e<numberOfFineDisks; e++) {
+			int d1 = e/2, d2 = (e+1)/2;
+			for (int j=0; j<fineRadialResolution; j++) {
+				int k1 = j/2, k2 = ((j+1)/2)%coarseRadialResolution;
+				fineAdaptator.fixedPoints_[e*fineRadialResolution+j] = isFixed(d1,k1) && isFixed(d1,k2) && isFixed(d2,k1) && isFixed(d2,k2);
+			}
+		}
+	}
+	fineAdaptator.changedParameters_ = true;
+	fineAdaptator.line_search = fineLineSearch_;
+	fineAdaptator.numberOptimizerIteration = fineNumberOptimizerIteration_;
+	fineAdaptator.numberOfIteration_ = fineNumberOfIteration_;
+	double distance = fineAdaptator.adaptation();
+	meshOutput_ = fineAdaptator.getOutput();
+
+	delete fineMesh;
+	return distance;
+}
@@ -49,11 +49,22 @@ public:
 	typedef Superclass::ParametersType		ParametersType;
 	typedef Superclass::DerivativeType		DerivativeType;
 
-	FoncteurDeformableBasicLocalAdaptation(Image3D* image, Mesh* m, ParametersType &pointsInitiaux, int nbPoints) :
-		image_(image), mesh_(m), pointsInitiaux_(pointsInitiaux), nbParametres_(3*nbPoints)
+	FoncteurDeformableBasicLocalAdaptation(Image3D* image, Mesh* m, ParametersType &pointsInitiaux, int nbPoints)
 	{
         verbose_ = false;
-        
+
+		setInput(image, m, pointsInitiaux, nbPoints);
+	}
+
+	//! Reset the cost function for a new mesh, as if it was constructed again. The buffers keep their memory, so that the same object can be used at each propagation step.
+	void setInput(Image3D* image, Mesh* m, const ParametersType &pointsInitiaux, int nbPoints)
+	{
+		image_ = image;
+		mesh_ = m;
+		pointsInitiaux_ = pointsInitiaux;
+		nbParametres_ = 3*nbPoints;
+		transformation_ = CMatrix4x4();
+
 		listeTriangles_ = m->getListTriangles();
 
 		type_image_factor = image->getTypeImageFactor();
@@ -64,15 +75,17 @@ public:
 
 		computeOptimalPoints(pointsInitiaux);
 
-		listeTrianglesContenantPoint = mesh_->getConnectiviteTriangles();
-		pointsVoisins = mesh_->getNeighbors();
+		topology_ = mesh_->getTopology();
+		if (!topology_ || topology_->getNbrOfPoints() != (unsigned int)nbPoints || topology_->getNbrOfTriangles() != listeTriangles_.size()/3)
+			topology_ = std::make_shared<const MeshTopology>(listeTriangles_,nbPoints);
 	}
 
 	virtual void GetDerivative (const ParametersType &parameters, DerivativeType &derivative) const
 	{
 		//std::vector<CVector3> der;
 		unsigned int nbTrianglesInt = listeTriangles_.size(), nbTriangles = nbTrianglesInt/3, nbPoints = nbParametres_/3;
-		std::vector<CVector3> trianglesBarycentre(nbTriangles);
+		std::vector<CVector3>& trianglesBarycentre = trianglesBarycentreCourant_;
+		trianglesBarycentre.resize(nbTriangles);
 		for (unsigned int i=0; i<nbTrianglesInt; i+=3)
 		{
 			trianglesBarycentre[(i+1)/3] = CVector3((parameters[3*listeTriangles_[i]]+parameters[3*listeTriangles_[i+1]]+parameters[3*listeTriangles_[i+2]])/3,
@@ -80,7 +93,7 @@ public:
 													(parameters[3*listeTriangles_[i]+2]+parameters[3*listeTriangles_[i+1]+2]+parameters[3*listeTriangles_[i+2]+2])/3);
 		}
 
-		derivative = DerivativeType(nbParametres_);
+		derivative.SetSize(nbParametres_); // toutes les composantes sont calculees ci-dessous
 
 		CVector3 index, gradient, laplacien, distancePoint, expect, ci1, c1, ci2, c2, point, voisin;
 		for (int i=0; i<nbPoints; i++)
@@ -88,30 +101,40 @@ public:
 			point(parameters[3*i],parameters[3*i+1],parameters[3*i+2]);
 			ci1 = point - transformation_*CVector3(pointsInitiaux_[3*i],pointsInitiaux_[3*i+1],pointsInitiaux_[3*i+2]);
 			c1 = CVector3::ZERO; c2 = CVector3::ZERO;
-			for (unsigned int j=0; j<pointsVoisins[i].size(); j++) {
-				voisin(parameters[3*pointsVoisins[i][j]],parameters[3*pointsVoisins[i][j]+1],parameters[3*pointsVoisins[i][j]+2]);
+			const int *pointsVoisins = topology_->getNeighbors(i), *trianglesContenantPoint = topology_->getTriangles(i);
+			int nbVoisins = topology_->getNumberOfNeighbors(i), nbTrianglesContenantPoint = topology_->getNumberOfTriangles(i);
+			for (int j=0; j<nbVoisins; j++) {
+				voisin(parameters[3*pointsVoisins[j]],parameters[3*pointsVoisins[j]+1],parameters[3*pointsVoisins[j]+2]);
 				c2 += point - voisin;
-				c1 += ci1 - voisin + transformation_*CVector3(pointsInitiaux_[3*pointsVoisins[i][j]],pointsInitiaux_[3*pointsVoisins[i][j]+1],pointsInitiaux_[3*pointsVoisins[i][j]+2]);
+				c1 += ci1 - voisin + transformation_*CVector3(pointsInitiaux_[3*pointsVoisins[j]],pointsInitiaux_[3*pointsVoisins[j]+1],pointsInitiaux_[3*pointsVoisins[j]+2]);
 			}
 			derivative[3*i] = 2*alpha*c1[0] + 2*beta*c2[0]; // Internal energy
 			derivative[3*i+1] = 2*alpha*c1[1] + 2*beta*c2[1];
 			derivative[3*i+2] = 2*alpha*c1[2] + 2*beta*c2[2];
 			for (int k=0; k<3; k++)
 			{
-				for (unsigned int j=0; j<listeTrianglesContenantPoint[i].size(); j++)
+				for (int j=0; j<nbTrianglesContenantPoint; j++)
 				{
-					expect = listeXiOpt[listeTrianglesContenantPoint[i][j]];
+					expect = listeXiOpt[trianglesContenantPoint[j]];
 					if (image_->TransformPhysicalPointToContinuousIndex(expect,index))
 					{
 						gradient = type_image_factor*image_->GetContinuousPixelVector(index).Normalize();
-						distancePoint = listeXiOpt[listeTrianglesContenantPoint[i][j]]-trianglesBarycentre[listeTrianglesContenantPoint[i][j]];
-						derivative[3*i+k] += -(2.0/3.0)*listeWi[listeTrianglesContenantPoint[i][j]]*gradient[k]*(gradient*distancePoint);
+						distancePoint = listeXiOpt[trianglesContenantPoint[j]]-trianglesBarycentre[trianglesContenantPoint[j]];
+						derivative[3*i+k] += -(2.0/3.0)*listeWi[trianglesContenantPoint[j]]*gradient[k]*(gradient*distancePoint);
 					}
 				}
 			}
 			//der.push_back(CVector3(derivative[3*indexParam[i]],derivative[3*indexParam[i]+1],derivative[3*indexParam[i]+2]));
 			//cout << derivative[i] << " " << derivative[i+1] << " " << derivative[i+2] << " " << endl;
 		}
+		// les points fixes ont une derivee nulle : l'optimiseur ne les deplace pas
+		for (unsigned int i=0; i<fixedPoints_.size() && i<(unsigned int)nbPoints; i++) {
+			if (fixedPoints_[i]) {
+				derivative[3*i] = 0.0;
+				derivative[3*i+1] = 0.0;
+				derivative[3*i+2] = 0.0;
+			}
+		}
 	}
  
 	virtual MeasureType GetValue (const ParametersType &parameters) const
@@ -119,7 +142,8 @@ public:
 		double result = 0.0, interne1 = 0.0, interne2 = 0.0, externe = 0.0;
 		
 		unsigned int nbTrianglesInt = listeTriangles_.size(), nbTriangles = nbTrianglesInt/3, nbPoints = nbParametres_/3;
-		std::vector<CVector3> trianglesBarycentre(nbTriangles);
+		std::vector<CVector3>& trianglesBarycentre = trianglesBarycentreCourant_;
+		trianglesBarycentre.resize(nbTriangles);
 		for (unsigned int i=0; i<nbTrianglesInt; i+=3)
 		{
 			trianglesBarycentre[(i+1)/3] = CVector3((parameters[3*listeTriangles_[i]]+parameters[3*listeTriangles_[i+1]]+parameters[3*listeTriangles_[i+2]])/3,
@@ -142,10 +166,12 @@ public:
 
 		for (int i=0; i<nbPoints; i++)
 		{
-			for (unsigned int j=0; j<pointsVoisins[i].size(); j++)
+			const int *pointsVoisins = topology_->getNeighbors(i);
+			int nbVoisins = topology_->getNumberOfNeighbors(i);
+			for (int j=0; j<nbVoisins; j++)
 			{
-				c2 = CVector3(parameters[3*i]-parameters[3*pointsVoisins[i][j]],parameters[3*i+1]-parameters[3*pointsVoisins[i][j]+1],parameters[3*i+2]-parameters[3*pointsVoisins[i][j]+2]);//point - voisin;
-				c1 = c2 - transformation_*CVector3(pointsInitiaux_[3*i]-pointsInitiaux_[3*pointsVoisins[i][j]],pointsInitiaux_[3*i+1]-pointsInitiaux_[3*pointsVoisins[i][j]+1],pointsInitiaux_[3*i+2]-pointsInitiaux_[3*pointsVoisins[i][j]+2]);
+				c2 = CVector3(parameters[3*i]-parameters[3*pointsVoisins[j]],parameters[3*i+1]-parameters[3*pointsVoisins[j]+1],parameters[3*i+2]-parameters[3*pointsVoisins[j]+2]);//point - voisin;
+				c1 = c2 - transformation_*CVector3(pointsInitiaux_[3*i]-pointsInitiaux_[3*pointsVoisins[j]],pointsInitiaux_[3*i+1]-pointsInitiaux_[3*pointsVoisins[j]+1],pointsInitiaux_[3*i+2]-pointsInitiaux_[3*pointsVoisins[j]+2]);
 				interne1 += pow(c1[0],2)+pow(c1[1],2)+pow(c1[2],2);
 				interne2 += pow(c2[0],2)+pow(c2[1],2)+pow(c2[2],2);
 			}
@@ -172,6 +198,32 @@ public:
 			normeGradient += pow(derivative[i],2);
 		return sqrt(normeGradient);
 	}
+
+	//! Validation of analytic derivatives by centered finite differences. Very slow (2 evaluations of the energy per parameter), for debugging only.
+    /*!
+      \param parameters Position where derivatives are checked
+      \param h Finite differences step in millimeters
+      \return Maximal relative error between analytic and numerical derivatives
+    */
+	double checkDerivatives(const ParametersType &parameters, double h=1e-4) const
+	{
+		DerivativeType derivative;
+		GetDerivative(parameters, derivative);
+		ParametersType p = parameters;
+		double errorMax = 0.0;
+		for (int i=0; i<nbParametres_; i++)
+		{
+			p[i] = parameters[i] + h;
+			double fPlus = GetValue(p);
+			p[i] = parameters[i] - h;
+			double fMinus = GetValue(p);
+			p[i] = parameters[i];
+			double numerical = (fPlus-fMinus)/(2.0*h);
+			double error = fabs(numerical-derivative[i])/std::max(1.0,fabs(numerical));
+			if (error > errorMax) errorMax = error;
+		}
+		return errorMax;
+	}
 	
 	void setInitialParameters(const ParametersType &pointsInitiaux)
 	{
@@ -202,11 +254,11 @@ public:
 		CVector3 xi, ni, ck, ci, index, gradient;
 		int k;
         
-        Matrice imageDistance = Matrice(sizeBary,2*line_search+1);
+        //Matrice imageDistance = Matrice(sizeBary,2*line_search+1);
 
 		listeXiOpt.resize(sizeBary);
 		listeWi.resize(sizeBary);
-		std::vector<double> listeDistancePointsOpt(sizeBary);
+		listeDistancePointsOpt.resize(sizeBary);
 
 		double threshold_distance_mask = 2.0;
 		CVector3 point_position;
@@ -567,6 +619,9 @@ public:
 
     void addCorrectionPoints(std::vector<CVector3> points_mask_correction) { points_mask_correction_ = points_mask_correction; };
 
+	//! Points i with fixedPoints[i] != 0 keep their position during the optimization
+	void setFixedPoints(const std::vector<char>& fixedPoints) { fixedPoints_ = fixedPoints; };
+
 private:
 	void InitParameters()
 	{
@@ -585,9 +640,9 @@ private:
 
 	int nbParametres_;
 	std::vector<CVector3> listeXiOpt;
-	std::vector<double> listeWi;
-	std::vector< std::vector<int> > listeTrianglesContenantPoint;
-	std::vector< std::vector<int> > pointsVoisins;
+	std::vector<double> listeWi, listeDistancePointsOpt;
+	mutable std::vector<CVector3> trianglesBarycentreCourant_; // barycentres a la position evaluee (GetValue, GetDerivative), une fonction de cout par thread
+	std::shared_ptr<const MeshTopology> topology_;
 	std::vector<Vertex> trianglesBarycentre_;
 
 	double line_search, deltaNormale, tradeOff, alpha, beta;
@@ -600,13 +655,14 @@ private:
     bool verbose_;
 
     std::vector<CVector3> points_mask_correction_;
+    std::vector<char> fixedPoints_;
 };
 
 /*!
  * \class DeformableModelBasicAdaptator
  * \brief Deformation of a mesh to the gradient in an image.
  *
- * This class deform  a ttriangular mesh using deformable model based energy equation towards gradient std::vector in the input image. The deformation equation is quadratic and minimized using conjugate gradient.
+ * This class deform  a ttriangular mesh using deformable model based energy equation towards gradient std::vector in the input image. The deformation equation is quadratic and minimized using a limited memory BFGS optimizer whose memory is kept between outer iterations.
  */
 class DeformableModelBasicAdaptator
 {
@@ -619,10 +675,13 @@ public:
 	void setInput(Mesh* m) { mesh_ = m; };
 	void setNumberOfIteration(int nbIteration) { numberOfIteration_ = nbIteration; };
 	double adaptation();
+	double adaptationMultiResolution();
 	Mesh* getOutput() { return meshOutput_; };
 	SpinalCord* getSpinalCordOutput() {
 		return new SpinalCord(*meshOutput_);
 	};
+	//! The result of adaptation() is written in output instead of a new mesh. Its points are updated in place when it already has the structure of the input mesh.
+	void setOutputMesh(Mesh* output) { outputMesh_ = output; };
 
 	void setFinalMeshBool(bool f) { meshBool_ = f; };
 	void changedParameters() { this->changedParameters_ = true; };
@@ -636,17 +695,31 @@ public:
 	void setStopCondition(double s) { stopCondition = s; };
 	void setNumberOptimizerIteration(int nbIt) { numberOptimizerIteration = nbIt; };
     void setProgressiveLineSearchLength(bool value) { progressiveLineSearchLength = value; };
+
+	//! Enable coarse-to-fine deformation. The input mesh is deformed first on the coarse image, then subdivided (SpinalCord::subdivision) and refined on the full resolution image.
+    /*!
+      \param coarseImage Smoothed and downsampled gradient image (see Image3D::createCoarseLevel)
+      \param radialResolution Radial resolution of the input (coarse) mesh, needed by the subdivision
+    */
+	void setMultiResolution(Image3D* coarseImage, int radialResolution) { coarseImage_ = coarseImage; radialResolutionMultiResolution_ = radialResolution; multiResolution_ = (coarseImage != 0); };
+	void setCoarseLevelParameters(double deltaNormale, int line_search) { coarseDeltaNormale_ = deltaNormale; coarseLineSearch_ = line_search; };
+	void setFineLevelParameters(int line_search, int nbOptimizerIteration, int nbIteration) { fineLineSearch_ = line_search; fineNumberOptimizerIteration_ = nbOptimizerIteration; fineNumberOfIteration_ = nbIteration; };
     
     void setVerbose(bool verbose) { verbose_ = verbose; };
     bool getVerbose() { return verbose_; };
 
     void addCorrectionPoints(std::vector<CVector3> points_mask_correction) { points_mask_correction_ = points_mask_correction; };
+    //! Points of the input mesh that must not move (e.g. boundary rings of a part of mesh). In the multi-resolution deformation, a point of the subdivided mesh is fixed if the points it comes from are fixed.
+    void setFixedPoints(std::vector<char> fixedPoints) { fixedPoints_ = fixedPoints; };
 
 private:
+	void initMultiResolution();
+
 	Image3D* image_;
 	int numberOfIteration_;
-	Mesh *mesh_, *meshOutput_;
+	Mesh *mesh_, *meshOutput_, *outputMesh_;
 	bool meshBool_;
+	itk::SmartPointer<FoncteurDeformableBasicLocalAdaptation> costFunction_; // reutilisee d'un appel a adaptation() a l'autre
 
 	bool changedParameters_;
 	int line_search;
@@ -655,10 +728,17 @@ private:
 	double stopCondition;
 	int numberOptimizerIteration;
     bool progressiveLineSearchLength, tradeoff_bool;
+
+	bool multiResolution_;
+	Image3D* coarseImage_;
+	int radialResolutionMultiResolution_;
+	double coarseDeltaNormale_;
+	int coarseLineSearch_, fineLineSearch_, fineNumberOptimizerIteration_, fineNumberOfIteration_;
     
     bool verbose_;
 
     std::vector<CVector3> points_mask_correction_;
+    std::vector<char> fixedPoints_;
 };
 
 #endif
@@ -0,0 +1,73 @@
+#include "GaussianTemplate.h"
+
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+using namespace std;
+
+
+GaussianTemplate::GaussianTemplate(const int* size, const double* spacing, double sigma): sigma_(sigma)
+{
+	for (int i=0; i<3; i++) {
+		size_[i] = size[i]+(1-size[i]%2);
+		spacing_[i] = spacing[i];
+	}
+
+	// La gaussienne ne depend que de x et y : on calcule un plan puis on le recopie pour chaque z
+	const double pi = atan(1.0) * 4;
+	const double sigma2 = sigma * sigma;
+	const double centerX = (size_[0]-1)/2, centerY = (size_[1]-1)/2;
+	unsigned int sizePlane = size_[0]*size_[1];
+	values_.resize(sizePlane*size_[2]);
+	for (int y=0; y<size_[1]; y++) {
+		double yDiff = (y-centerY)*spacing_[1];
+		for (int x=0; x<size_[0]; x++) {
+			double xDiff = (x-centerX)*spacing_[0];
+			values_[y*size_[0]+x] = 0.5 * exp(-0.5*(xDiff*xDiff+yDiff*yDiff)/sigma2) / (pi * sigma2);
+		}
+	}
+	for (int z=1; z<size_[2]; z++)
+		copy(values_.begin(), values_.begin()+sizePlane, values_.begin()+z*sizePlane);
+}
+
+
+shared_ptr<const GaussianTemplate> GaussianTemplate::get(const int* size, const double* spacing, double sigma)
+{
+	typedef tuple<int,int,int,double,double,double,double> KeyType;
+	static map< KeyType, shared_ptr<const GaussianTemplate> > cache;
+	static mutex cacheMutex;
+
+	KeyType key(size[0]+(1-size[0]%2), size[1]+(1-size[1]%2), size[2]+(1-size[2]%2), spacing[0], spacing[1], spacing[2], sigma);
+	lock_guard<mutex> lock(cacheMutex);
+	shared_ptr<const GaussianTemplate>& gaussian = cache[key];
+	if (!gaussian) gaussian.reset(new GaussianTemplate(size, spacing, sigma));
+	return gaussian;
+}
+
+
+double GaussianTemplate::getContinuousValue(const CVector3& index) const
+{
+	int base[3];
+	double distance[3];
+	for (int i=0; i<3; i++) {
+		double ind = index[i];
+		if (ind < 0.0) ind = 0.0;
+		else if (ind > size_[i]-1) ind = size_[i]-1;
+		base[i] = (int)floor(ind);
+		if (base[i] == size_[i]-1 && base[i] > 0) base[i]--;
+		distance[i] = ind-base[i];
+	}
+	int strideY = size_[0], strideZ = size_[0]*size_[1];
+	int nextX = size_[0] > 1 ? 1 : 0, nextY = size_[1] > 1 ? strideY : 0, nextZ = size_[2] > 1 ? strideZ : 0;
+	const double* p = &values_[base[2]*strideZ+base[1]*strideY+base[0]];
+
+	double v00 = p[0]*(1.0-distance[0]) + p[nextX]*distance[0];
+	double v10 = p[nextY]*(1.0-distance[0]) + p[nextY+nextX]*distance[0];
+	double v01 = p[nextZ]*(1.0-distance[0]) + p[nextZ+nextX]*distance[0];
+	double v11 = p[nextZ+nextY]*(1.0-distance[0]) + p[nextZ+nextY+nextX]*distance[0];
+	double v0 = v00*(1.0-distance[1]) + v10*distance[1];
+	double v1 = v01*(1.0-distance[1]) + v11*distance[1];
+	return v0*(1.0-distance[2]) + v1*distance[2];
+}
@@ -0,0 +1,45 @@
+#ifndef __GAUSSIAN_TEMPLATE__
+#define __GAUSSIAN_TEMPLATE__
+
+/*!
+ * \file GaussianTemplate.h
+ * \brief Gaussian weighting volumes shared between the orientation computations
+ * \author Benjamin De Leener - NeuroPoly (http://www.neuropoly.info)
+ */
+
+#include <vector>
+#include <memory>
+
+#include "../util/Vector3.h"
+
+/*!
+ * \class GaussianTemplate
+ * \brief 2D gaussian (in the xy plane, repeated along z) sampled on a volume stored in one contiguous buffer.
+ *
+ * Templates are only created by get(), which keeps a cache keyed by size, spacing and sigma: each gaussian is computed once per process
+ * and is then shared, read-only, by every GlobalAdaptation object and every thread. Values are stored with x varying fastest, as in an ITK image.
+ */
+class GaussianTemplate
+{
+public:
+	//! Gaussian of the given size (rounded up to odd values), spacing [mm] and sigma [mm]. Thread-safe.
+	static std::shared_ptr<const GaussianTemplate> get(const int* size, const double* spacing, double sigma);
+
+	const int* getSize() const { return size_; };
+	const double* getSpacing() const { return spacing_; };
+	double getSigma() const { return sigma_; };
+	const double* getBuffer() const { return &values_[0]; };
+
+	double getValue(int x, int y, int z) const { return values_[(z*size_[1]+y)*size_[0]+x]; };
+	//! Trilinear interpolation at a continuous index. The index is clamped to the volume, so the border values are extended outside.
+	double getContinuousValue(const CVector3& index) const;
+
+private:
+	GaussianTemplate(const int* size, const double* spacing, double sigma);
+
+	int size_[3];
+	double spacing_[3], sigma_;
+	std::vector<double> values_;
+};
+
+#endif
@@ -1,25 +1,189 @@
 #include "GlobalAdaptation.h"
-#include "SCRegion.h"
 #include <itkAmoebaOptimizer.h>
 #include <itkLBFGSBOptimizer.h>
+#include <itkMultiThreaderBase.h>
+#include <thread>
+#include <exception>
+#include <numeric>
+#include <algorithm>
 using namespace std;
 
 typedef itk::AmoebaOptimizer::ParametersType ParametersType;
 typedef itk::LBFGSBOptimizer         OptimizerType;
 
-GlobalAdaptation::GlobalAdaptation(Image3D* image, Mesh* v, CVector3 pointRotation, string mode) : image_(image), mesh_(v), pointRotation_(pointRotation), mode_(mode), badOrientation_(false), verbose_(false) {}
-GlobalAdaptation::GlobalAdaptation(Image3D* image, Mesh* v, string mode) : image_(image), mesh_(v), mode_(mode), badOrientation_(false), verbose_(false) {}
+// Distribution des rotations entre deux pas de propagation (moyenne et ecart-type de chaque angle) et nombre d'ecarts-types admis
+static const double rotationMean[3] = {0.0044, -0.0107, 0.0110}, rotationStd[3] = {0.0868, 0.1170, 0.1495};
+static const double rotationFactor = 2.7;
+// Nombre maximal d'evaluations de la recherche locale autour de chaque candidat de la grille
+static const int refinementEvaluations = 60;
 
+GlobalAdaptation::GlobalAdaptation(Image3D* image, Mesh* v, CVector3 pointRotation, string mode) : image_(image), mesh_(v), pointRotation_(pointRotation), mode_(mode), badOrientation_(false), verbose_(false),
+	costFunction_(0), gridResolution_(0), numberOfCandidates_(3), numberOfThreads_(0) {}
+GlobalAdaptation::GlobalAdaptation(Image3D* image, Mesh* v, string mode) : image_(image), mesh_(v), mode_(mode), badOrientation_(false), verbose_(false),
+	costFunction_(0), gridResolution_(0), numberOfCandidates_(3), numberOfThreads_(0) {}
 
-CMatrix4x4 GlobalAdaptation::adaptation(bool itkAmoeba)
+GlobalAdaptation::~GlobalAdaptation()
 {
-	unsigned int numberOfParameters;
-	if (mode_ == "rotation")
-		numberOfParameters = 3;
-	else if (mode_ == "rotation+scaling")
-		numberOfParameters = 4;
+	if (costFunction_ != 0) costFunction_->UnRegister();
+	for (unsigned int i=0; i<threadCostFunctions_.size(); i++) threadCostFunctions_[i]->UnRegister();
+}
+
+
+unsigned int GlobalAdaptation::getNumberOfParameters()
+{
+	if (mode_ == "rotation+scaling")
+		return 4;
 	else if (mode_ == "rotation+translation")
-		numberOfParameters = 6;
+		return 6;
+	return 3;
+}
+
+
+// Region gaussienne de ponderation. Elle ne depend que de sigma et vient du cache partage de GaussianTemplate.
+const GaussianTemplate* GlobalAdaptation::getGaussianRegion(shared_ptr<const GaussianTemplate>& region, double sigma)
+{
+	if (!region) {
+		int sizeDesired[3] = {61, 61, 81};
+		double spacingDesired[3] = {1, 1, 1};
+		region = GaussianTemplate::get(sizeDesired,spacingDesired,sigma);
+	}
+	return region.get();
+}
+
+
+// Fonction de cout pour les barycentres actuels du maillage, creee au premier appel
+FoncteurGlobalAdaptation* GlobalAdaptation::getCostFunction()
+{
+	if (costFunction_ == 0) costFunction_ = new FoncteurGlobalAdaptation(image_,mesh_->getListTrianglesBarycentre(),getNumberOfParameters());
+	else costFunction_->setTriangles(mesh_->getListTrianglesBarycentre());
+	costFunction_->setPointRotation(pointRotation_);
+	return costFunction_;
+}
+
+
+// Fonction de cout du thread : le thread 0 utilise celle de l'objet, les autres ont leur propre copie de l'image, creee au premier appel
+FoncteurGlobalAdaptation* GlobalAdaptation::getCostFunction(unsigned int thread)
+{
+	if (thread == 0) return getCostFunction();
+	while (threadCostFunctions_.size() < thread) {
+		threadImages_.push_back(unique_ptr<Image3D>(new Image3D(*image_)));
+		FoncteurGlobalAdaptation* f = new FoncteurGlobalAdaptation(threadImages_.back().get(),mesh_->getListTrianglesBarycentre(),getNumberOfParameters());
+		threadCostFunctions_.push_back(f);
+	}
+	FoncteurGlobalAdaptation* f = threadCostFunctions_[thread-1];
+	f->setTriangles(mesh_->getListTrianglesBarycentre());
+	f->setPointRotation(pointRotation_);
+	return f;
+}
+
+
+unsigned int GlobalAdaptation::getNumberOfThreads(unsigned int numberOfTasks)
+{
+	unsigned int numberOfThreads = numberOfThreads_ > 0 ? numberOfThreads_ : itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+	return max(1u,min(numberOfThreads,numberOfTasks));
+}
+
+
+/*
+ * Execute task(f,i) for i = 0..numberOfTasks-1. The tasks are split in contiguous batches, one per thread, and the calling thread executes the first batch.
+ * Each thread has its own cost function f. Results have to be written by the tasks at their own index, so that they do not depend on the number of threads.
+ */
+void GlobalAdaptation::evaluateInParallel(unsigned int numberOfTasks, const function<void(FoncteurGlobalAdaptation*,unsigned int)>& task)
+{
+	unsigned int numberOfThreads = getNumberOfThreads(numberOfTasks);
+	vector<FoncteurGlobalAdaptation*> costFunctions(numberOfThreads);
+	for (unsigned int t=0; t<numberOfThreads; t++) costFunctions[t] = getCostFunction(t);
+
+	vector<exception_ptr> errors(numberOfThreads);
+	auto batch = [&](unsigned int t) {
+		try {
+			for (unsigned int i=t*numberOfTasks/numberOfThreads; i<(t+1)*numberOfTasks/numberOfThreads; i++)
+				task(costFunctions[t],i);
+		}
+		catch (...) { errors[t] = current_exception(); }
+	};
+	vector<thread> workers;
+	for (unsigned int t=1; t<numberOfThreads; t++) workers.push_back(thread(batch,t));
+	batch(0);
+	for (unsigned int t=0; t<workers.size(); t++) workers[t].join();
+	for (unsigned int t=0; t<numberOfThreads; t++)
+		if (errors[t]) rethrow_exception(errors[t]);
+}
+
+
+/*
+ * Search of the rotation (3 parameters) minimizing the cost function:
+ * 1. the admissible box of rotations is sampled at the center of the cells of a regular grid, all the rotations being evaluated in parallel
+ * 2. the best candidates of the grid (lowest cost, then lowest index) are refined in parallel by a pattern search: the 6 neighbours at distance step
+ *    along each angle are evaluated, the best one is kept if it improves the cost, otherwise step is halved. The refinement can leave the box,
+ *    so that an optimum on the border is still detected as a bad orientation.
+ * The result only depends on the grid and on the cost function, not on the number of threads.
+ */
+vector<double> GlobalAdaptation::gridSearch()
+{
+	unsigned int n = gridResolution_, numberOfRotations = n*n*n;
+	double lower[3], cell[3];
+	for (int i=0; i<3; i++) {
+		lower[i] = rotationMean[i]-rotationFactor*rotationStd[i];
+		cell[i] = 2.0*rotationFactor*rotationStd[i]/n;
+	}
+	vector< vector<double> > rotations(numberOfRotations, vector<double>(3));
+	for (unsigned int k=0; k<numberOfRotations; k++) {
+		rotations[k][0] = lower[0]+(k%n+0.5)*cell[0];
+		rotations[k][1] = lower[1]+((k/n)%n+0.5)*cell[1];
+		rotations[k][2] = lower[2]+(k/(n*n)+0.5)*cell[2];
+	}
+
+	vector<double> values(numberOfRotations);
+	evaluateInParallel(numberOfRotations, [&](FoncteurGlobalAdaptation* f, unsigned int k) {
+		ParametersType p(3);
+		p[0] = rotations[k][0]; p[1] = rotations[k][1]; p[2] = rotations[k][2];
+		values[k] = f->GetValue(p);
+	});
+
+	unsigned int numberOfCandidates = min((unsigned int)max(1,numberOfCandidates_),numberOfRotations);
+	vector<unsigned int> order(numberOfRotations);
+	iota(order.begin(),order.end(),0);
+	partial_sort(order.begin(),order.begin()+numberOfCandidates,order.end(),[&](unsigned int a, unsigned int b) { return values[a] < values[b] || (values[a] == values[b] && a < b); });
+
+	vector< vector<double> > candidates(numberOfCandidates);
+	vector<double> candidateValues(numberOfCandidates);
+	evaluateInParallel(numberOfCandidates, [&](FoncteurGlobalAdaptation* f, unsigned int c) {
+		ParametersType p(3), q(3);
+		for (int i=0; i<3; i++) p[i] = rotations[order[c]][i];
+		double value = values[order[c]], step[3] = {0.5*cell[0], 0.5*cell[1], 0.5*cell[2]};
+		int evaluations = 0;
+		while (evaluations+6 <= refinementEvaluations)
+		{
+			ParametersType best = p;
+			double bestValue = value;
+			for (int i=0; i<3; i++) {
+				for (int sign=-1; sign<=1; sign+=2) {
+					q = p;
+					q[i] += sign*step[i];
+					double v = f->GetValue(q);
+					evaluations++;
+					if (v < bestValue) { bestValue = v; best = q; }
+				}
+			}
+			if (bestValue < value) { p = best; value = bestValue; }
+			else for (int i=0; i<3; i++) step[i] *= 0.5;
+		}
+		candidates[c] = vector<double>(p.begin(),p.end());
+		candidateValues[c] = value;
+	});
+
+	unsigned int best = 0;
+	for (unsigned int c=1; c<numberOfCandidates; c++)
+		if (candidateValues[c] < candidateValues[best]) best = c;
+	if (verbose_) cout << "Rotation grid search : " << numberOfRotations << " rotations, best candidate " << best << ", cost " << candidateValues[best] << endl;
+	return candidates[best];
+}
+
+
+CMatrix4x4 GlobalAdaptation::adaptation(bool itkAmoeba)
+{
+	unsigned int numberOfParameters = getNumberOfParameters();
 	vector<double> p;
 	if (!itkAmoeba) { // can only be used with rotation
 		double	mean1 = -0.00924, std1 = 0.057,
@@ -32,8 +196,8 @@ CMatrix4x4 GlobalAdaptation::adaptation(bool itkAmoeba)
 		OptimizerType::BoundValueType lowerBound(3);
 		lowerBound[0] = mean1-2*std1; lowerBound[1] = mean2-2*std2; lowerBound[2] = mean3-2*std3;
 
-		FoncteurGlobalAdaptation* f = new FoncteurGlobalAdaptation(image_,mesh_->getListTrianglesBarycentre(),numberOfParameters);
-		f->setPointRotation(pointRotation_);
+		FoncteurGlobalAdaptation* f = getCostFunction();
+		f->setGaussianRegion(getGaussianRegion(adaptationRegion_,1.5)); // utilisee par GetDerivative
 
 		OptimizerType::ParametersType pInit(3);
 		pInit.Fill(0.0);
@@ -67,37 +231,26 @@ CMatrix4x4 GlobalAdaptation::adaptation(bool itkAmoeba)
 		for (int i=0; i<pFinal.size(); i++)
 			p.push_back(pFinal[i]);
 	}
+	else if (gridResolution_ > 0 && numberOfParameters == 3) {
+		p = gridSearch();
+	}
 	else {
 		// Utilisation de la m�thode du Simplex impl�ment�e dans la librairie ITK
 		itk::AmoebaOptimizer::Pointer optimizer = itk::AmoebaOptimizer::New();
 	
-		SCRegion* region = new SCRegion();
-		int *sizeDesired = new int[3];
-		double *spacingDesired = new double[3];
-		sizeDesired[0] = 61; sizeDesired[1] = 61; sizeDesired[2] = 81;
-		spacingDesired[0] = 1; spacingDesired[1] = 1; spacingDesired[2] = 1;
-		region->setSize(sizeDesired);
-		region->setSpacing(spacingDesired);
-		region->setOrigin(pointRotation_[0],pointRotation_[1],pointRotation_[2]);
-		region->setNormal(normal_mesh_[0],normal_mesh_[1],normal_mesh_[2]);
-		region->setFactor(image_->getTypeImageFactor());
-		region->build2DGaussian(1.5);
-
-		FoncteurGlobalAdaptation* f = new FoncteurGlobalAdaptation(image_,mesh_->getListTrianglesBarycentre(),numberOfParameters);
-		f->setPointRotation(pointRotation_);
+		const GaussianTemplate* region = getGaussianRegion(adaptationRegion_,1.5);
+
+		FoncteurGlobalAdaptation* f = getCostFunction();
 		f->setGaussianRegion(region);
 		optimizer->SetCostFunction(f);
 		optimizer->SetOptimizeWithRestarts(false);
 		optimizer->SetMaximumNumberOfIterations(250);
 		optimizer->AutomaticInitialSimplexOn();
 		
-		ParametersType pInit, pFinal;
-		//pInit.SetSize(6);
-		double* init = new double[numberOfParameters];
-		for (int i=0; i<numberOfParameters; i++) init[i] = 0.0;
+		ParametersType pInit(numberOfParameters), pFinal;
+		pInit.Fill(0.0);
 		if (mode_ == "rotation+scaling")
-			init[3] = 1.0;
-		pInit.SetData(init,numberOfParameters,false);
+			pInit[3] = 1.0;
 		optimizer->SetFunctionConvergenceTolerance(1.0e-4);
 		optimizer->SetParametersConvergenceTolerance(1.0e-8);
 		optimizer->SetInitialPosition(pInit);
@@ -121,10 +274,10 @@ CMatrix4x4 GlobalAdaptation::adaptation(bool itkAmoeba)
 		cout << i << " " << p[i] << endl << endl;*/
 
 	CMatrix4x4 transformation;
-	double	mean1 = 0.0044, std1 = 0.0868,
-			mean2 = -0.0107, std2 = 0.1170,
-			mean3 = 0.0110, std3 = 0.1495;
-	double factor = 2.7;
+	double	mean1 = rotationMean[0], std1 = rotationStd[0],
+			mean2 = rotationMean[1], std2 = rotationStd[1],
+			mean3 = rotationMean[2], std3 = rotationStd[2];
+	double factor = rotationFactor;
 	if (p[0]<=mean1+factor*std1 && p[0]>=mean1-factor*std1 && p[1]<=mean2+factor*std2 && p[1]>=mean2-factor*std2 && p[2]<=mean3+factor*std3 && p[2]>=mean3-factor*std3)
 	{
 		transformation[0] = cos(p[0])*cos(p[1]),	transformation[4] = -cos(p[2])*sin(p[1]) + sin(p[2])*sin(p[0])*cos(p[1]),	transformation[8] = sin(p[2])*sin(p[1]) + cos(p[2])*sin(p[0])*cos(p[1]),
@@ -164,35 +317,16 @@ CMatrix4x4 GlobalAdaptation::adaptation(bool itkAmoeba)
 
 double GlobalAdaptation::getInitialValue()
 {
-	unsigned int numberOfParameters;
-	if (mode_ == "rotation")
-		numberOfParameters = 3;
-	else if (mode_ == "rotation+scaling")
-		numberOfParameters = 4;
-	else if (mode_ == "rotation+translation")
-		numberOfParameters = 6;
-    else numberOfParameters = 3;
+	unsigned int numberOfParameters = getNumberOfParameters();
 
-	ParametersType pInit;
-	double* init = new double[numberOfParameters];
-	for (int i=0; i<numberOfParameters; i++) init[i] = 0.0;
+	ParametersType pInit(numberOfParameters);
+	pInit.Fill(0.0);
 	if (mode_ == "rotation+scaling")
-		init[3] = 1.0;
-	pInit.SetData(init,numberOfParameters,false);
-
-	SCRegion* region = new SCRegion();
-	int *sizeDesired = new int[3];
-	double *spacingDesired = new double[3];
-	sizeDesired[0] = 61; sizeDesired[1] = 61; sizeDesired[2] = 81;
-	spacingDesired[0] = 1; spacingDesired[1] = 1; spacingDesired[2] = 1;
-	region->setSize(sizeDesired);
-	region->setSpacing(spacingDesired);
-	region->setOrigin(pointRotation_[0],pointRotation_[1],pointRotation_[2]);
-	region->setNormal(normal_mesh_[0],normal_mesh_[1],normal_mesh_[2]);
-	region->setFactor(image_->getTypeImageFactor());
-	region->build2DGaussian(5);
-
-	FoncteurGlobalAdaptation* f = new FoncteurGlobalAdaptation(image_,mesh_->getListTrianglesBarycentre(),numberOfParameters);
+		pInit[3] = 1.0;
+
+	const GaussianTemplate* region = getGaussianRegion(initialValueRegion_,5);
+
+	FoncteurGlobalAdaptation* f = getCostFunction();
 	f->setGaussianRegion(region);
 	return f->GetValue(pInit);
 }
@@ -9,6 +9,9 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <functional>
+#include <algorithm>
 
 #include <itkPoint.h>
 #include <itkImageAlgorithm.h>
@@ -19,7 +22,7 @@
 #include "SpinalCord.h"
 #include "Vertex.h"
 #include "../util/Matrix3x3.h"
-#include "SCRegion.h"
+#include "GaussianTemplate.h"
 
 
 typedef itk::CovariantVector<double,3> PixelType;
@@ -34,16 +37,33 @@ typedef itk::Point< double, 3 > PointType;
 class FoncteurGlobalAdaptation: public itk::SingleValuedCostFunction
 {
 public:
-	FoncteurGlobalAdaptation(Image3D* image, std::vector<Vertex*>* tri, unsigned int numberOfParameters=6) : image_(image), listeTriangles_(tri), iterateur(0), numberOfParameters_(numberOfParameters)
+	FoncteurGlobalAdaptation(Image3D* image, std::vector<Vertex*>* tri, unsigned int numberOfParameters=6) : image_(image), numberOfParameters_(numberOfParameters), iterateur(0), region_(0)
 	{
+		setTriangles(tri);
+		type_image_factor = image_->getTypeImageFactor();
+
+		// transformation des points physiques vers les index continus de l'image
+		ImageVectorType::Pointer im = image_->getImage();
+		ImageVectorType::DirectionType physicalToIndex = im->GetPhysicalPointToIndex();
+		for (int i=0; i<3; i++) {
+			originImage_[i] = im->GetOrigin()[i];
+			for (int j=0; j<3; j++) physicalToIndex_[i][j] = physicalToIndex[i][j];
+		}
+	}
+
+	//! Copy of the triangles barycentres of a new mesh. The buffers keep their memory when the functor is used again at the next propagation step.
+	void setTriangles(std::vector<Vertex*>* tri)
+	{
+		listeTriangles_ = tri;
 		sizePoints = listeTriangles_->size();
-		points = new CVector3[sizePoints];
-		normales = new CVector3[sizePoints];
+		points.resize(sizePoints);
+		normales.resize(sizePoints);
+		pointsX_.resize(sizePoints); pointsY_.resize(sizePoints); pointsZ_.resize(sizePoints);
 		for (unsigned int i=0; i<sizePoints; i++) {
 			points[i] = (*listeTriangles_)[i]->getPosition();
 			normales[i] = (*listeTriangles_)[i]->getNormal();
+			pointsX_[i] = points[i][0]; pointsY_[i] = points[i][1]; pointsZ_[i] = points[i][2];
 		}
-		type_image_factor = image_->getTypeImageFactor();
 	}
 
 	// Method used by ITK - Derivative can only be use with unique rotation, not translation
@@ -67,53 +87,75 @@ public:
 		for (unsigned int i=0; i<sizePoints; i++) {
 			pnt = rotationP0*(points[i]-pointRotation) + pointRotation;
 			if (image_->TransformPhysicalPointToContinuousIndex(pnt,index))
-				derivative[0] -= image_->GetContinuousPixelMagnitudeGradient(index)*region_->GetContinuousPixelMagnitudeGradient(index);
+				derivative[0] -= image_->GetContinuousPixelMagnitudeGradient(index)*region_->getContinuousValue(index);
 			pnt = rotationP1*(points[i]-pointRotation) + pointRotation;
 			if (image_->TransformPhysicalPointToContinuousIndex(pnt,index))
-				derivative[1] -= image_->GetContinuousPixelMagnitudeGradient(index)*region_->GetContinuousPixelMagnitudeGradient(index);
+				derivative[1] -= image_->GetContinuousPixelMagnitudeGradient(index)*region_->getContinuousValue(index);
 			pnt = rotationP2*(points[i]-pointRotation) + pointRotation;
 			if (image_->TransformPhysicalPointToContinuousIndex(pnt,index))
-				derivative[2] -= image_->GetContinuousPixelMagnitudeGradient(index)*region_->GetContinuousPixelMagnitudeGradient(index);
+				derivative[2] -= image_->GetContinuousPixelMagnitudeGradient(index)*region_->getContinuousValue(index);
 		}
 		//cout << "Derivative : " << derivative << endl;
 	}
  
+	/*
+	 * Sum of the gradient magnitude at the rotated barycentres. The rotation around pointRotation, the translation and the transformation
+	 * from physical point to continuous index are fused in one 3x4 matrix: index = A*point + b. The barycentres (SoA) are transformed by blocks
+	 * in loops without dependency, and each block is sampled at once in the magnitude buffer. Points outside of the image are ignored.
+	 */
 	virtual MeasureType GetValue (const ParametersType &parameters) const
 	{
-		double result = 0.0;
-		CMatrix3x3 rotation;
-		CVector3 pnt, translation, index;
-		rotation[0] = cos(parameters[0])*cos(parameters[1]),	rotation[3] = -cos(parameters[2])*sin(parameters[1]) + sin(parameters[2])*sin(parameters[0])*cos(parameters[1]),	rotation[6] = sin(parameters[2])*sin(parameters[1]) + cos(parameters[2])*sin(parameters[0])*cos(parameters[1]),
-		rotation[1] = cos(parameters[0])*sin(parameters[1]),	rotation[4] = cos(parameters[2])*cos(parameters[1]) + sin(parameters[2])*sin(parameters[0])*sin(parameters[1]),		rotation[7] = -sin(parameters[2])*cos(parameters[1]) + cos(parameters[2])*sin(parameters[0])*sin(parameters[1]),
-		rotation[2] = -sin(parameters[0]),						rotation[5] = sin(parameters[2])*cos(parameters[0]),																rotation[8] = cos(parameters[2])*cos(parameters[0]);
+		double rotation[3][3], translation[3] = {0.0, 0.0, 0.0};
+		rotation[0][0] = cos(parameters[0])*cos(parameters[1]),	rotation[0][1] = -cos(parameters[2])*sin(parameters[1]) + sin(parameters[2])*sin(parameters[0])*cos(parameters[1]),	rotation[0][2] = sin(parameters[2])*sin(parameters[1]) + cos(parameters[2])*sin(parameters[0])*cos(parameters[1]),
+		rotation[1][0] = cos(parameters[0])*sin(parameters[1]),	rotation[1][1] = cos(parameters[2])*cos(parameters[1]) + sin(parameters[2])*sin(parameters[0])*sin(parameters[1]),		rotation[1][2] = -sin(parameters[2])*cos(parameters[1]) + cos(parameters[2])*sin(parameters[0])*sin(parameters[1]),
+		rotation[2][0] = -sin(parameters[0]),					rotation[2][1] = sin(parameters[2])*cos(parameters[0]),																rotation[2][2] = cos(parameters[2])*cos(parameters[0]);
 		if (numberOfParameters_ == 6)
 			translation[0] = parameters[3], translation[1] = parameters[4], translation[2] = parameters[5];
-		else translation = CVector3::ZERO;
-		int nb = 0;
-		for (unsigned int i=0; i<sizePoints; i++) {
-			pnt = rotation*(points[i]-pointRotation) + pointRotation + translation;
-			if (image_->TransformPhysicalPointToContinuousIndex(pnt,index)) {
-                //result -= image_->GetContinuousPixelMagnitudeGradient(index)*region_->GetContinuousPixelMagnitudeGradient(index);
-                result -= image_->GetContinuousPixelMagnitudeGradient(index);
-            }
-				
-			else nb++;
+
+		// physicalToIndex*(rotation*(p-c) + c + t - origin) = A*p + b
+		float A[3][3], b[3];
+		for (int i=0; i<3; i++) {
+			double offset = 0.0;
+			for (int j=0; j<3; j++) {
+				double a = 0.0;
+				for (int k=0; k<3; k++) a += physicalToIndex_[i][k]*rotation[k][j];
+				A[i][j] = a;
+				offset += physicalToIndex_[i][j]*(pointRotation[j]+translation[j]-originImage_[j]) - a*pointRotation[j];
+			}
+			b[i] = offset;
+		}
+
+		const unsigned int blockSize = 256;
+		float ix[blockSize], iy[blockSize], iz[blockSize], values[blockSize];
+		double result = 0.0;
+		for (unsigned int first=0; first<sizePoints; first+=blockSize)
+		{
+			unsigned int n = std::min(blockSize,sizePoints-first);
+			const float *x = &pointsX_[first], *y = &pointsY_[first], *z = &pointsZ_[first];
+			for (unsigned int i=0; i<n; i++) {
+				ix[i] = A[0][0]*x[i] + A[0][1]*y[i] + A[0][2]*z[i] + b[0];
+				iy[i] = A[1][0]*x[i] + A[1][1]*y[i] + A[1][2]*z[i] + b[1];
+				iz[i] = A[2][0]*x[i] + A[2][1]*y[i] + A[2][2]*z[i] + b[2];
+			}
+			image_->GetContinuousPixelsMagnitudeGradient(ix,iy,iz,n,values);
+			for (unsigned int i=0; i<n; i++) result -= values[i];
 		}
-		//if (nb > 0) cout << "Nombre de points du maillage en dehors de l'image : " << nb << endl;
 		//cout << "Result : " << result << endl;
 		return result;
 	}
 	virtual unsigned int GetNumberOfParameters (void) const { return numberOfParameters_; }
 	void setPointRotation(CVector3 point) { pointRotation = point; };
 
-	void setGaussianRegion(SCRegion* gaussianRegion) { region_ = gaussianRegion; };
+	void setGaussianRegion(const GaussianTemplate* gaussianRegion) { region_ = gaussianRegion; };
 
 private:
 	Image3D* image_;
 	std::vector<Vertex*>* listeTriangles_;
 
 	unsigned int sizePoints;
-	CVector3 *points, *normales;
+	std::vector<CVector3> points, normales;
+	std::vector<float> pointsX_, pointsY_, pointsZ_; // memes points, par coordonnee
+	double physicalToIndex_[3][3], originImage_[3];
 
 	CMatrix3x3 rotation;
 	CVector3 pnt, gradient, translation, index;
@@ -126,7 +168,7 @@ private:
 
 	int iterateur;
 
-	SCRegion* region_;
+	const GaussianTemplate* region_; // partagee entre les objets, en lecture seule
 };
 
 /*!
@@ -141,18 +183,40 @@ class GlobalAdaptation
 public:
 	GlobalAdaptation(Image3D* image, Mesh* v, std::string mode="rotation+translation");
 	GlobalAdaptation(Image3D* image, Mesh* v, CVector3 pointRotation, std::string mode="rotation+translation");
-	~GlobalAdaptation() {};
+	~GlobalAdaptation();
+
+	//! Change the mesh and the rotation point. The same object, with its cost function, can then be used at each propagation step.
+	void setInput(Mesh* v, CVector3 pointRotation) { mesh_ = v; pointRotation_ = pointRotation; badOrientation_ = false; };
 
 	double getInitialValue();
 	CMatrix4x4 adaptation(bool itkAmoeba=true);
 	bool getBadOrientation() { return badOrientation_; };
 
 	void setNormalMesh(CVector3 normal) { normal_mesh_ = normal; };
+
+	/*!
+	 * Rotation search used by adaptation(true) in "rotation" mode: the admissible rotations (mean +/- 2.7 std of each angle) are sampled on a grid of
+	 * gridResolution^3 rotations evaluated in parallel, then the numberOfCandidates best rotations are refined by a local pattern search.
+	 * The number of cost evaluations is at most gridResolution^3 + 60*numberOfCandidates. gridResolution=0 uses the simplex optimizer (default).
+	 * numberOfThreads=0 uses the default number of threads of ITK.
+	 */
+	void setGridSearch(int gridResolution=7, int numberOfCandidates=3, int numberOfThreads=0) { gridResolution_ = gridResolution; numberOfCandidates_ = numberOfCandidates; numberOfThreads_ = numberOfThreads; };
     
     void setVerbose(bool verbose) { verbose_ = verbose; };
     bool getVerbose() { return verbose_; };
 
 private:
+	GlobalAdaptation(const GlobalAdaptation&) = delete;
+	GlobalAdaptation& operator=(const GlobalAdaptation&) = delete;
+
+	unsigned int getNumberOfParameters();
+	const GaussianTemplate* getGaussianRegion(std::shared_ptr<const GaussianTemplate>& region, double sigma);
+	FoncteurGlobalAdaptation* getCostFunction();
+	FoncteurGlobalAdaptation* getCostFunction(unsigned int thread);
+	unsigned int getNumberOfThreads(unsigned int numberOfTasks);
+	void evaluateInParallel(unsigned int numberOfTasks, const std::function<void(FoncteurGlobalAdaptation*,unsigned int)>& task);
+	std::vector<double> gridSearch();
+
 	Image3D* image_;
 	Mesh* mesh_;
 
@@ -162,6 +226,13 @@ private:
 	bool badOrientation_;
     
     bool verbose_;
+
+	std::shared_ptr<const GaussianTemplate> adaptationRegion_, initialValueRegion_; // gaussiennes du cache de GaussianTemplate
+	FoncteurGlobalAdaptation* costFunction_;
+
+	int gridResolution_, numberOfCandidates_, numberOfThreads_;
+	std::vector< std::unique_ptr<Image3D> > threadImages_; // copies de l'image pour les threads 1..n-1 (interpolateurs non partages)
+	std::vector<FoncteurGlobalAdaptation*> threadCostFunctions_;
 };
 
 #endif
@@ -0,0 +1,107 @@
+#include "HoughPeaks.h"
+
+#include <queue>
+#include <utility>
+#include <itkDiscreteGaussianImageFilter.h>
+
+using namespace std;
+
+typedef itk::DiscreteGaussianImageFilter<ImageType2D,ImageType2D> GaussianFilterType;
+
+namespace {
+	// Ordre de depilement : accumulation decroissante, puis ordre de balayage de l'image
+	struct PeakOrder
+	{
+		bool operator()(const pair<double,long>& a, const pair<double,long>& b) const
+		{
+			if (a.first != b.first) return a.first < b.first;
+			return a.second > b.second;
+		}
+	};
+}
+
+
+unsigned int HoughPeaks::extract(ImageType2D* accumulator, ImageType2D* radiusImage, unsigned int numberOfPeaks, vector<Peak> &peaks, double discRatio, unsigned int maxIterations)
+{
+	peaks.clear();
+
+	/** Blur the accumulator in order to find the maximum */
+	GaussianFilterType::Pointer gaussianFilter = GaussianFilterType::New();
+	gaussianFilter->SetInput(accumulator);
+	double variance[2];
+	variance[0]=10;
+	variance[1]=10;
+	gaussianFilter->SetVariance(variance);
+	gaussianFilter->SetMaximumError(.01f);
+	gaussianFilter->Update();
+	ImageType2D::Pointer blurred = gaussianFilter->GetOutput();
+
+	const ImageType2D::RegionType region = blurred->GetLargestPossibleRegion();
+	const long startX = region.GetIndex()[0], startY = region.GetIndex()[1];
+	const long sizeX = region.GetSize()[0], sizeY = region.GetSize()[1];
+	const double* values = blurred->GetBufferPointer();
+
+	// Local maxima, in one pass. On a plateau, only the first pixel in raster order is kept:
+	// a candidate must be strictly greater than its preceding neighbours and greater or equal to the following ones.
+	priority_queue< pair<double,long>, vector< pair<double,long> >, PeakOrder > queue;
+	for (long y=0; y<sizeY; y++)
+	{
+		for (long x=0; x<sizeX; x++)
+		{
+			double value = values[y*sizeX+x];
+			if (value <= 0.0) continue;
+			bool isMaximum = true;
+			for (long dy=-1; dy<=1 && isMaximum; dy++)
+			{
+				for (long dx=-1; dx<=1 && isMaximum; dx++)
+				{
+					if ((dx == 0 && dy == 0) || x+dx < 0 || x+dx >= sizeX || y+dy < 0 || y+dy >= sizeY) continue;
+					double neighbour = values[(y+dy)*sizeX+x+dx];
+					bool preceding = dy < 0 || (dy == 0 && dx < 0);
+					if (neighbour > value || (preceding && neighbour == value)) isMaximum = false;
+				}
+			}
+			if (isMaximum) queue.push(make_pair(value,y*sizeX+x));
+		}
+	}
+
+	// Radius-aware suppression: every popped peak (border ones included) removes a disc of radius discRatio*radius around itself
+	vector<double> popped; // x, y, squared suppression radius
+	ImageType2D::IndexType index;
+	unsigned int iteration = 0;
+	while (!queue.empty() && peaks.size() < numberOfPeaks && iteration < maxIterations)
+	{
+		long offset = queue.top().second;
+		double value = queue.top().first;
+		queue.pop();
+		long x = offset%sizeX, y = offset/sizeX;
+
+		bool suppressed = false;
+		for (unsigned int k=0; k<popped.size() && !suppressed; k+=3)
+		{
+			double dx = x-popped[k], dy = y-popped[k+1];
+			suppressed = dx*dx+dy*dy < popped[k+2];
+		}
+		if (suppressed) continue;
+		iteration++;
+
+		index[0] = startX+x;
+		index[1] = startY+y;
+		double radius = radiusImage->GetPixel(index);
+		popped.push_back(x);
+		popped.push_back(y);
+		popped.push_back(discRatio*radius*discRatio*radius);
+
+		if (x != 0 && x != sizeX-1 && y != 0 && y != sizeY-1)
+		{
+			Peak peak;
+			peak.center[0] = index[0];
+			peak.center[1] = index[1];
+			peak.radius = radius;
+			peak.accumulator = value;
+			peaks.push_back(peak);
+		}
+	}
+
+	return peaks.size();
+}
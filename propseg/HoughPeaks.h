@@ -0,0 +1,39 @@
+#ifndef __HOUGH_PEAKS__
+#define __HOUGH_PEAKS__
+
+/*!
+ * \file HoughPeaks.h
+ * \brief Extraction of the circles detected by a circular Hough transform
+ * \author Benjamin De Leener - NeuroPoly (http://www.neuropoly.info)
+ */
+
+#include <vector>
+
+#include <itkImage.h>
+
+typedef itk::Image< double, 2 >	ImageType2D;
+
+/*!
+ * \class HoughPeaks
+ * \brief Non-maximum suppression on the accumulator of a circular Hough transform.
+ *
+ * The accumulator is blurred (gaussian, variance 10), then its local maxima are found in one pass and pushed in a priority queue.
+ * They are popped in decreasing order of accumulation (in raster order for equal values). A peak closer than discRatio*radius
+ * to a previously popped peak is suppressed, radius being the mean radius voted at that peak. Peaks on the border of the image are not
+ * returned but still suppress their neighbourhood.
+ */
+class HoughPeaks
+{
+public:
+	struct Peak
+	{
+		double center[2]; // index in the accumulator
+		double radius; // pixels
+		double accumulator; // value of the blurred accumulator
+	};
+
+	//! Replaces the content of peaks and returns the number of peaks found, at most numberOfPeaks, after at most maxIterations peaks popped from the queue.
+	static unsigned int extract(ImageType2D* accumulator, ImageType2D* radiusImage, unsigned int numberOfPeaks, std::vector<Peak> &peaks, double discRatio=1.1, unsigned int maxIterations=100);
+};
+
+#endif
@@ -29,6 +29,13 @@
 #include <vtkPolyDataNormals.h>
 #include <vtkPointData.h>
 
+#include <itkGradientRecursiveGaussianImageFilter.h>
+#include <itkShrinkImageFilter.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+#include <mutex>
+#include <algorithm>
+
 #include "Image3D.h"
 #include "../util/Matrix3x3.h"
 #include "OrientImage.h"
@@ -71,6 +78,9 @@ typedef itk::VectorLinearInterpolateImageFunction< ImageVectorType, double > Int
 
 typedef itk::SpatialOrientation::ValidCoordinateOrientationFlags OrientationType;
 
+typedef itk::GradientRecursiveGaussianImageFilter< ImageType, ImageVectorType > SmoothedGradientFilterType;
+typedef itk::ShrinkImageFilter< ImageVectorType, ImageVectorType > ShrinkVectorFilterType;
+
 
 
 Image3D::Image3D(ImageVectorType::Pointer im, int hauteur, int largeur, int profondeur, CVector3 origine, CVector3 directionX, CVector3 directionY, CVector3 directionZ, CVector3 spacing, double typeImageFactor)
@@ -105,6 +115,42 @@ Image3D::Image3D(ImageVectorType::Pointer im, int hauteur, int largeur, int prof
     boolLaplacianImage_ = false;
 }
 
+/*!
+ * Copy sharing the image buffers (read-only) but with its own interpolators.
+ * ITK interpolators are not meant to be shared between threads: each thread working on the same volume has to use its own copy of Image3D.
+ */
+Image3D::Image3D(const Image3D& im)
+{
+    imageOriginale_ = im.imageOriginale_;
+    croppedOriginalImage_ = im.croppedOriginalImage_;
+    imageMagnitudeGradient_ = im.imageMagnitudeGradient_;
+    imageSegmentation_ = im.imageSegmentation_;
+    image_ = im.image_;
+    laplacianImage_ = im.laplacianImage_;
+    boolImageOriginale_ = im.boolImageOriginale_;
+    boolCroppedOriginalImage_ = im.boolCroppedOriginalImage_;
+    boolImageMagnitudeGradient_ = im.boolImageMagnitudeGradient_;
+    boolImage_ = im.boolImage_;
+    boolLaplacianImage_ = im.boolLaplacianImage_;
+    hauteur_ = im.hauteur_;
+    largeur_ = im.largeur_;
+    profondeur_ = im.profondeur_;
+    origine_ = im.origine_;
+    directionX_ = im.directionX_;
+    directionY_ = im.directionY_;
+    directionZ_ = im.directionZ_;
+    spacing_ = im.spacing_;
+    extremePoint_ = im.extremePoint_;
+    direction = im.direction;
+    directionInverse = im.directionInverse;
+    type_image_factor_ = im.type_image_factor_;
+    
+    imageInterpolator = InterpolateIntensityFilter::New();
+    if (boolImageMagnitudeGradient_) imageInterpolator->SetInputImage(imageMagnitudeGradient_);
+    vectorImageInterpolator = InterpolateVectorFilter::New();
+    vectorImageInterpolator->SetInputImage(image_);
+}
+
 float Image3D::GetPixelOriginal(const CVector3& index)
 {
     IndexType ind = {static_cast<itk::IndexValueType>(index[0]),static_cast<itk::IndexValueType>(index[1]),static_cast<itk::IndexValueType>(index[2])};
@@ -123,6 +169,36 @@ float Image3D::GetContinuousPixelMagnitudeGradient(const CVector3& index)
     return imageInterpolator->EvaluateAtContinuousIndex(ind);
 }
 
+void Image3D::GetContinuousPixelsMagnitudeGradient(const float* ix, const float* iy, const float* iz, unsigned int numberOfPoints, float* values)
+{
+    const ImageType::RegionType& region = imageMagnitudeGradient_->GetBufferedRegion();
+    const double* buffer = imageMagnitudeGradient_->GetBufferPointer();
+    const int sizeX = region.GetSize()[0], sizeY = region.GetSize()[1], sizeZ = region.GetSize()[2];
+    const float startX = region.GetIndex()[0], startY = region.GetIndex()[1], startZ = region.GetIndex()[2];
+    const int strideY = sizeX, strideZ = sizeX*sizeY;
+    for (unsigned int n=0; n<numberOfPoints; n++)
+    {
+        float x = ix[n]-startX, y = iy[n]-startY, z = iz[n]-startZ;
+        // meme test que ImageRegion::IsInside pour un index continu
+        if (!(x >= -0.5f && x <= sizeX-0.5f && y >= -0.5f && y <= sizeY-0.5f && z >= -0.5f && z <= sizeZ-0.5f)) {
+            values[n] = 0.0f;
+            continue;
+        }
+        // bords : comme l'interpolateur lineaire d'ITK, les indices sont ramenes dans l'image
+        x = std::min(std::max(x,0.0f),(float)(sizeX-1)); y = std::min(std::max(y,0.0f),(float)(sizeY-1)); z = std::min(std::max(z,0.0f),(float)(sizeZ-1));
+        int bx = (int)x, by = (int)y, bz = (int)z;
+        float wx = x-bx, wy = y-by, wz = z-bz;
+        int dx = bx < sizeX-1 ? 1 : 0, dy = by < sizeY-1 ? strideY : 0, dz = bz < sizeZ-1 ? strideZ : 0;
+        const double* p = buffer+bz*strideZ+by*strideY+bx;
+        double v00 = p[0] + wx*(p[dx]-p[0]);
+        double v10 = p[dy] + wx*(p[dy+dx]-p[dy]);
+        double v01 = p[dz] + wx*(p[dz+dx]-p[dz]);
+        double v11 = p[dz+dy] + wx*(p[dz+dy+dx]-p[dz+dy]);
+        double v0 = v00 + wy*(v10-v00), v1 = v01 + wy*(v11-v01);
+        values[n] = v0 + wz*(v1-v0);
+    }
+}
+
 PixelType Image3D::GetPixel(const CVector3& index)
 {
     IndexType ind = {static_cast<itk::IndexValueType>(index[0]),static_cast<itk::IndexValueType>(index[1]),static_cast<itk::IndexValueType>(index[2])};
@@ -238,18 +314,15 @@ void Image3D::DeleteHighVector()
     }
 }
 
-BinaryImageType::Pointer Image3D::TransformMeshToBinaryImage(Mesh* m)
+// Conversion du maillage en maillage ITK pour TriangleMeshToBinaryImageFilter
+static MeshTypeB::Pointer createBinaryMesh(Mesh* m)
 {
-    MeshTypeB::Pointer mesh;
-    MeshFilterType::Pointer meshFilter = MeshFilterType::New();
-    
-	mesh = MeshTypeB::New();
+	MeshTypeB::Pointer mesh = MeshTypeB::New();
 	vector<Vertex*> points = m->getListPoints();
 	PointType pnt;
-	CVector3 p, n;
+	CVector3 p;
 	for (unsigned int i = 0; i < points.size(); i++) {
 		p = points[i]->getPosition();
-		n = points[i]->getNormal();
 		pnt[0] = p[0]; pnt[1] = p[1]; pnt[2] = p[2];
 		mesh->SetPoint(i, pnt);
 	}
@@ -263,7 +336,13 @@ BinaryImageType::Pointer Image3D::TransformMeshToBinaryImage(Mesh* m)
 		triangle->SetPointId(2, triangles[i + 2]);
 		mesh->SetCell((int)(i + 1) / 3, triangle);
 	}
-	meshFilter->SetInput(mesh);
+	return mesh;
+}
+
+BinaryImageType::Pointer Image3D::TransformMeshToBinaryImage(Mesh* m)
+{
+    MeshFilterType::Pointer meshFilter = MeshFilterType::New();
+	meshFilter->SetInput(createBinaryMesh(m));
 
     meshFilter->SetOrigin(imageOriginale_->GetOrigin());
     meshFilter->SetSpacing(imageOriginale_->GetSpacing());
@@ -288,6 +367,64 @@ BinaryImageType::Pointer Image3D::TransformMeshToBinaryImage(Mesh* m)
     return meshFilter->GetOutput();
 }
 
+/*!
+ * Rasterization of the mesh restricted to the voxels of the bounding box of regionPoints (plus one voxel on each side), copied in mask.
+ * Used after a local modification of the mesh: regionPoints are the old and new positions of the modified points, so that the voxels that are no longer inside the mesh are cleared.
+ * mask must have the geometry of the original image (output of TransformMeshToBinaryImage).
+ */
+void Image3D::UpdateBinaryImageFromMesh(Mesh* m, BinaryImageType::Pointer mask, const vector<CVector3>& regionPoints)
+{
+	if (regionPoints.empty()) return;
+	BinaryImageType::RegionType largestRegion = mask->GetLargestPossibleRegion();
+	BinaryImageType::IndexType lower, upper;
+	for (unsigned int d=0; d<3; d++) {
+		lower[d] = largestRegion.GetUpperIndex()[d];
+		upper[d] = largestRegion.GetIndex()[d];
+	}
+	ContinuousIndexType index;
+	itk::Point<double,3> pnt;
+	for (unsigned int i=0; i<regionPoints.size(); i++)
+	{
+		pnt[0] = regionPoints[i][0]; pnt[1] = regionPoints[i][1]; pnt[2] = regionPoints[i][2];
+		mask->TransformPhysicalPointToContinuousIndex(pnt,index);
+		for (unsigned int d=0; d<3; d++) {
+			lower[d] = min(lower[d],(BinaryImageType::IndexValueType)floor(index[d])-1);
+			upper[d] = max(upper[d],(BinaryImageType::IndexValueType)ceil(index[d])+1);
+		}
+	}
+	BinaryImageType::RegionType region;
+	region.SetIndex(lower);
+	region.SetUpperIndex(upper);
+	if (!region.Crop(largestRegion)) return;
+
+	MeshFilterType::Pointer meshFilter = MeshFilterType::New();
+	meshFilter->SetInput(createBinaryMesh(m));
+	meshFilter->SetOrigin(mask->GetOrigin());
+	meshFilter->SetSpacing(mask->GetSpacing());
+	meshFilter->SetDirection(mask->GetDirection());
+	meshFilter->SetIndex(region.GetIndex());
+	meshFilter->SetSize(region.GetSize());
+	meshFilter->SetInsideValue(1.0);
+	meshFilter->SetOutsideValue(0.0);
+	try
+	{
+		meshFilter->Update();
+	}
+	catch( itk::ExceptionObject & e )
+	{
+		cout << "Exception thrown ! " << endl;
+		cout << "An error ocurred during updating binary image" << endl;
+		cout << "Location    = " << e.GetLocation()    << endl;
+		cout << "Description = " << e.GetDescription() << endl;
+		return;
+	}
+
+	itk::ImageRegionConstIterator<BinaryImageType> itSlab(meshFilter->GetOutput(),region);
+	itk::ImageRegionIterator<BinaryImageType> itMask(mask,region);
+	for (itSlab.GoToBegin(), itMask.GoToBegin(); !itSlab.IsAtEnd(); ++itSlab, ++itMask)
+		itMask.Set(itSlab.Get());
+}
+
 void Image3D::setImageOriginale(ImageType::Pointer i)
 {
     imageOriginale_ = i;
@@ -314,6 +451,60 @@ void Image3D::setLaplacianImage(ImageVectorType::Pointer i)
 }
 
 
+/*!
+ * Build a coarse level of the gradient vector image, for coarse-to-fine deformation.
+ * The gradient is computed on the original image smoothed by a gaussian (sigma in millimeters) and downsampled so that the spacing is close to coarseSpacing (millimeters).
+ * Dimensions with a spacing already larger than coarseSpacing are not downsampled. The returned image has to be deleted by the caller.
+ */
+Image3D* Image3D::createCoarseLevel(double coarseSpacing, double sigma)
+{
+    if (!boolImageOriginale_) {
+        cerr << "Error: original image is needed to compute coarse level of gradient image" << endl;
+        return 0;
+    }
+
+    // Le pipeline modifie la region demandee de l'image originale, partagee entre les copies de Image3D utilisees par plusieurs threads
+    static std::mutex coarseLevelMutex;
+    std::lock_guard<std::mutex> lock(coarseLevelMutex);
+
+    SmoothedGradientFilterType::Pointer gradientFilter = SmoothedGradientFilterType::New();
+    gradientFilter->SetInput(imageOriginale_);
+    gradientFilter->SetSigma(sigma);
+
+    ImageType::SpacingType spacingI = imageOriginale_->GetSpacing();
+    ShrinkVectorFilterType::Pointer shrinkFilter = ShrinkVectorFilterType::New();
+    shrinkFilter->SetInput(gradientFilter->GetOutput());
+    for (unsigned int i=0; i<3; i++) {
+        unsigned int factor = static_cast<unsigned int>(coarseSpacing/spacingI[i]);
+        if (factor < 1) factor = 1;
+        shrinkFilter->SetShrinkFactor(i,factor);
+    }
+    try {
+        shrinkFilter->Update();
+    } catch( itk::ExceptionObject & e ) {
+        cerr << "Exception caught while computing coarse gradient image" << endl;
+        cerr << e << endl;
+        return 0;
+    }
+    ImageVectorType::Pointer coarseGradient = shrinkFilter->GetOutput();
+
+    ImageVectorType::SizeType regionSize = coarseGradient->GetLargestPossibleRegion().GetSize();
+    ImageVectorType::PointType origineI = coarseGradient->GetOrigin();
+    ImageVectorType::SpacingType spacingC = coarseGradient->GetSpacing();
+    ImageVectorType::DirectionType directionI = coarseGradient->GetInverseDirection();
+    CVector3 origine = CVector3(origineI[0], origineI[1], origineI[2]);
+    CVector3 directionX = CVector3(directionI[0][0], directionI[0][1], directionI[0][2]),
+        directionY = CVector3(directionI[1][0], directionI[1][1], directionI[1][2]),
+        directionZ = CVector3(directionI[2][0], directionI[2][1], directionI[2][2]);
+    CVector3 spacing = CVector3(spacingC[0], spacingC[1], spacingC[2]);
+
+    Image3D* coarseImage = new Image3D(coarseGradient, regionSize[0], regionSize[1], regionSize[2], origine, directionX, directionY, directionZ, spacing, type_image_factor_);
+    coarseImage->setImageOriginale(imageOriginale_);
+    if (boolCroppedOriginalImage_) coarseImage->setCroppedImageOriginale(croppedOriginalImage_);
+    return coarseImage;
+}
+
+
 void Image3D::releaseMemory()
 {
     if (boolImageMagnitudeGradient_) imageMagnitudeGradient_->Delete();
@@ -48,6 +48,7 @@ class Image3D
 public:
 	Image3D();
 	Image3D(ImageVectorType::Pointer im, int hauteur, int largeur, int profondeur, CVector3 origine, CVector3 directionX, CVector3 directionY, CVector3 directionZ, CVector3 spacing, double typeImageFactor);
+	Image3D(const Image3D& im); // partage les images, interpolateurs propres a la copie (une copie par thread)
 	~Image3D() {};
 
 	ImageVectorType::Pointer getImage() { return image_; };
@@ -55,6 +56,9 @@ public:
 	float GetPixelOriginal(const CVector3& index);
 	float GetPixelMagnitudeGradient(const CVector3& index);
 	float GetContinuousPixelMagnitudeGradient(const CVector3& index);
+	//! Trilinear values of the gradient magnitude at numberOfPoints continuous indices, read directly in the buffer (no interpolator, can be called by several threads).
+	//! Indices outside of the image, as for TransformPhysicalPointToContinuousIndex, give 0.
+	void GetContinuousPixelsMagnitudeGradient(const float* ix, const float* iy, const float* iz, unsigned int numberOfPoints, float* values);
 	PixelType GetPixel(const CVector3& index);
 	CVector3 GetPixelVector(const CVector3& index);
 	CVector3 GetContinuousPixelVector(const CVector3& index);
@@ -79,6 +83,7 @@ public:
 	void DeleteHighVector();
 
 	BinaryImageType::Pointer TransformMeshToBinaryImage(Mesh* m);
+	void UpdateBinaryImageFromMesh(Mesh* m, BinaryImageType::Pointer mask, const std::vector<CVector3>& regionPoints);
 
 	void setImageOriginale(ImageType::Pointer i);
 	ImageType::Pointer getImageOriginale() { return imageOriginale_; };
@@ -95,6 +100,8 @@ public:
 	void setTypeImageFactor(double f) { type_image_factor_ = f; };
 	double getTypeImageFactor() { return type_image_factor_; };
 
+	Image3D* createCoarseLevel(double coarseSpacing, double sigma);
+
 	void releaseMemory();
 
 private:
@@ -5,6 +5,11 @@
 #include <cmath>
 #include <map>
 #include <list>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <functional>
 
 #include <itkImage.h>
 #include <itkNiftiImageIO.h>
@@ -26,11 +31,14 @@
 #include <itkImageFileWriter.h>
 #include <itkScaleTransform.h>
 #include <itkResampleImageFilter.h>
+#include <itkBinShrinkImageFilter.h>
 #include <itkDiscreteGaussianImageFilter.h>
 #include <itkRescaleIntensityImageFilter.h>
 #include <itkRGBPixel.h>
+#include <itkMultiThreaderBase.h>
 
 #include "Initialisation.h"
+#include "HoughPeaks.h"
 #include "OrientImage.h"
 
 using namespace std;
@@ -50,10 +58,15 @@ typedef itk::Point< double, 3 > PointType;
 typedef itk::GradientMagnitudeImageFilter< ImageType2D, ImageType2D > GradientMFilterType;
 typedef itk::IdentityTransform<double, 2> TransformType;
 typedef itk::ResampleImageFilter<ImageType2D, ImageType2D> ResampleImageFilterType;
+typedef itk::BinShrinkImageFilter<ImageType2D, ImageType2D> BinShrinkFilterType;
+typedef itk::ExtractImageFilter<ImageType2D, ImageType2D> WindowFilterType;
 typedef itk::DiscreteGaussianImageFilter<ImageType2D, ImageType2D> SmoothFilterType;
 typedef itk::ImageRegionConstIterator<BinaryImageType> ImageIterator;
 typedef itk::RescaleIntensityImageFilter< ImageType, ImageType > RescaleFilterType;
 
+// Circles kept in each Hough accumulator (spinal cord and CSF), for each axial slice and stretching factor
+static const unsigned int numberOfHoughCircles = 20;
+
 
 class Node
 {
@@ -98,6 +111,7 @@ Initialisation::Initialisation()
     startSlice_ = -1.0;
     numberOfSlices_ = 5;
     radius_ = 4.0;
+    pyramidFactor_ = 1;
 	verbose_ = false;
 }
 
@@ -115,6 +129,7 @@ Initialisation::Initialisation(ImageType::Pointer image, double imageFactor, dou
     startSlice_ = -1.0;
     numberOfSlices_ = 5;
     radius_ = 4.0;
+    pyramidFactor_ = 1;
 
 	verbose_ = false;
 }
@@ -208,11 +223,25 @@ bool Initialisation::computeInitialParameters(float startFactor)
     // Creation of a matrix of potential spinal cord centers
 	vector<vector <vector <Node*> > > centers;
     
-    // Start of the detection of circles and ellipses. For each axial slices, a Hough transform is performed to detect circles. Each axial image is stretched in the antero-posterior direction in order to detect the spinal cord as a ellipse as well as a circle.
+    // Start of the detection of circles and ellipses. For each axial slices, a Hough transform is performed to detect circles. The transform also votes as if the axial image was stretched in the antero-posterior direction, in order to detect the spinal cord as a ellipse as well as a circle.
+    // Every axial slice is an independent work item: the images of all the items are first prepared, then the Hough transforms of the items are computed in parallel.
+	vector<int> sliceOffsets;
 	for (int i=round(-((numberOfSlices_-1.0)/2.0)*(gap_/spacing[1])); i<=round(((numberOfSlices_-1.0)/2.0)*(gap_/spacing[1])); i+=round(gap_/spacing[1]))
+		sliceOffsets.push_back(i);
+    // A stretchingFactor equals to 1 doesn't change the image
+	vector<double> stretchingFactors;
+	double stretchingFactor = 1.0, step = 0.25;
+	while (stretchingFactor <= 2.0) {
+		stretchingFactors.push_back(stretchingFactor);
+		stretchingFactor += step;
+	}
+	unsigned int numberOfStretchings = stretchingFactors.size(), numberOfItems = sliceOffsets.size();
+	vector<ImageType2D::Pointer> itemImages(numberOfItems);
+	vector<double> itemThresholds(numberOfItems);
+	for (unsigned int n=0; n<sliceOffsets.size(); n++)
 	{
         // Cropping of the image
-		if (verbose_) cout << "Slice num " << i << endl;
+		int i = sliceOffsets[n];
 		desiredStart[1] = startZ+i;
 		ImageType::RegionType desiredRegion(desiredStart, desiredSize);
 		FilterType::Pointer filter = FilterType::New();
@@ -244,42 +273,44 @@ bool Initialisation::computeInitialParameters(float startFactor)
 		clonedImageDirection[1][1] = imageDirection[1][2];
 		clonedImage->SetDirection(clonedImageDirection);
         
+		// each item owns its image, which is not connected to any pipeline anymore and can be used by any thread
+		clonedImage->DisconnectPipeline();
+		itemImages[n] = clonedImage;
+        
+		// Only the pixels brighter than 1/20 of the intensity range of the slice vote in the Hough transform
+		MinMaxCalculatorType::Pointer sliceMinMaxCalculator = MinMaxCalculatorType::New();
+		sliceMinMaxCalculator->SetImage(clonedImage);
+		sliceMinMaxCalculator->Compute();
+		itemThresholds[n] = (sliceMinMaxCalculator->GetMaximum()-sliceMinMaxCalculator->GetMinimum())/20.0;
+	}
+    
+    // Searching the circles in the images using circular Hough transform, adapted from ITK
+    // The results are stored by item, so that they do not depend on the order of execution
+	vector< vector< vector<CVector3> > > itemCenters(numberOfItems);
+	vector< vector< vector<double> > > itemRadii(numberOfItems), itemAccumulators(numberOfItems);
+    // Multiscale detection: with pyramidFactor_ = 0, the coarse pixels are kept below 1 mm so that the spinal cord still spans a few pixels
+	unsigned int pyramidFactor = pyramidFactor_ > 0 ? pyramidFactor_ : 1;
+	if (pyramidFactor_ == 0)
+		while (pyramidFactor < 4 && mean_resolution_*pyramidFactor*2 <= 1.0) pyramidFactor *= 2;
+	if (pyramidFactor <= 1 || !searchCentersPyramid(itemImages,itemThresholds,sliceOffsets,stretchingFactors,startZ,pyramidFactor,itemCenters,itemRadii,itemAccumulators))
+	{
+		runInParallel(numberOfItems, [&](unsigned int k) {
+			searchCenters(itemImages[k],stretchingFactors,1.0,itemThresholds[k],itemCenters[k],itemRadii[k],itemAccumulators[k],startZ+sliceOffsets[k]);
+		});
+	}
+    
+    // Gathering of the results in the matrix of centers, by slice then by stretching factor
+	for (unsigned int n=0; n<sliceOffsets.size(); n++)
+	{
+		if (verbose_) cout << "Slice num " << sliceOffsets[n] << endl;
 		// Initialization of resulting spinal cord center list.
 		vector<vector <Node*> > vecNode;
-        
-        // Initialization of stretching parameters
-        // A stretchingFactor equals to 1 doesn't change the image
-		double stretchingFactor = 1.0, step = 0.25;
-		while (stretchingFactor <= 2.0)
+		for (unsigned int s=0; s<numberOfStretchings; s++)
 		{
+			double stretchingFactor = stretchingFactors[s];
 			if (verbose_) cout << "Stretching factor " << stretchingFactor << endl;
-            // Stretching the image in the antero-posterior direction. This direction is chosen because potential elliptical spinal cord will be transformed to circles and wil be detected by the Hough transform. The resulting circles will then be stretch in the other direction.
-			if (stretchingFactor != 1.0)
-			{
-				ImageType2D::SizeType inputSize = clonedImage->GetLargestPossibleRegion().GetSize(), outputSize;
-				outputSize[0] = inputSize[0]*stretchingFactor;
-				outputSize[1] = inputSize[1];
-				ImageType2D::SpacingType outputSpacing;
-				outputSpacing[0] = static_cast<double>(clonedImage->GetSpacing()[0] * inputSize[0] / outputSize[0]);
-				outputSpacing[1] = static_cast<double>(clonedImage->GetSpacing()[1] * inputSize[1] / outputSize[1]);
-                
-				ResampleImageFilterType::Pointer resample = ResampleImageFilterType::New();
-				resample->SetInput(clonedImage);
-				resample->SetSize(outputSize);
-				resample->SetOutputDirection(clonedImage->GetDirection());
-				resample->SetOutputOrigin(clonedImage->GetOrigin());
-				resample->SetOutputSpacing(outputSpacing);
-				resample->SetTransform(TransformType::New());
-				resample->Update();
-                
-				im = resample->GetOutput();
-			}
-            
-            // Searching the circles in the image using circular Hough transform, adapted from ITK
-            // The list of radii and accumulator values are then extracted for analyses
-			vector<CVector3> vecCenter;
-			vector<double> vecRadii, vecAccumulator;
-			searchCenters(im,vecCenter,vecRadii,vecAccumulator,startZ+i);
+			const vector<CVector3>& vecCenter = itemCenters[n][s];
+			const vector<double>& vecRadii = itemRadii[n][s], &vecAccumulator = itemAccumulators[n][s];
 			
             // Reformating of the detected circles in the image. Each detected circle is push in a Node with all its information.
             // The radii are transformed in mm using mean axial resolution
@@ -291,9 +322,6 @@ bool Initialisation::computeInitialParameters(float startFactor)
 				}
 			}
 			vecNode.push_back(vecNodeTemp);
-			
-            // Preparing next iteration of the spinal cord detection
-			stretchingFactor += step;
 		}
         // Saving the detected centers
 		centers.push_back(vecNode);
@@ -474,172 +502,279 @@ bool Initialisation::computeInitialParameters(float startFactor)
 }
 
 
-void Initialisation::searchCenters(ImageType2D::Pointer im, vector<CVector3> &vecCenter, vector<double> &vecRadii, vector<double> &vecAccumulator, float startZ)
+void Initialisation::runInParallel(unsigned int numberOfItems, const function<void(unsigned int)> &work)
 {
-	DuplicatorType::Pointer duplicator = DuplicatorType::New();
-	duplicator->SetInputImage(im);
-	duplicator->Update();
-	ImageType2D::Pointer clonedOutput = duplicator->GetOutput();
-    
-	MinMaxCalculatorType::Pointer minMaxCalculator = MinMaxCalculatorType::New();
+    // The work items are distributed to a pool of threads
+	unsigned int numberOfThreads = max(1u,min((unsigned int)itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads(),numberOfItems));
+	atomic<unsigned int> nextItem(0);
+	vector<exception_ptr> errors(numberOfThreads);
+	auto worker = [&](unsigned int t) {
+		try {
+			for (unsigned int k=nextItem++; k<numberOfItems; k=nextItem++)
+				work(k);
+		}
+		catch (...) { errors[t] = current_exception(); }
+	};
+	vector<thread> workers;
+	for (unsigned int t=1; t<numberOfThreads; t++) workers.push_back(thread(worker,t));
+	worker(0);
+	for (unsigned int t=0; t<workers.size(); t++) workers[t].join();
+	for (unsigned int t=0; t<numberOfThreads; t++)
+		if (errors[t]) rethrow_exception(errors[t]);
+}
+
+
+bool Initialisation::hasNeighborCircle(const vector< vector< vector<CVector3> > > &centers, const vector< vector< vector<double> > > &radii, unsigned int n, unsigned int s, unsigned int m, double stretchingFactor, double pixelFactor) const
+{
+	double limitDistance = sqrt(2.0*gap_*gap_); // in mm
+	const CVector3& candidate = centers[n][s][m];
+	double radius = radii[n][s][m];
+	for (int dn=-1; dn<=1; dn+=2)
+	{
+		if ((int)n+dn < 0 || (int)n+dn >= (int)centers.size()) continue;
+		for (unsigned int j=0; j<centers[n+dn][s].size(); j++)
+		{
+			const CVector3& neighbor = centers[n+dn][s][j];
+			double currentDistance = mean_resolution_*sqrt(pow(pixelFactor*(candidate[0]-neighbor[0])/stretchingFactor,2)+pow(candidate[1]-neighbor[1],2)+pow(pixelFactor*(candidate[2]-neighbor[2]),2));
+			double radiusNeighbor = radii[n+dn][s][j];
+			if (currentDistance <= limitDistance && radiusNeighbor >= radius*0.8 && radiusNeighbor <= radius*1.2) return true;
+		}
+	}
+	return false;
+}
+
+
+bool Initialisation::searchCentersPyramid(const vector<ImageType2D::Pointer> &images, const vector<double> &thresholds, const vector<int> &sliceOffsets, const vector<double> &stretchingFactors, float startZ, unsigned int factor, vector< vector< vector<CVector3> > > &centers, vector< vector< vector<double> > > &radii, vector< vector< vector<double> > > &accumulators)
+{
+	unsigned int numberOfSlices = images.size(), numberOfStretchings = stretchingFactors.size();
     
-	unsigned int numberOfCircles = 20;
-	double **center_result_small = new double*[numberOfCircles], **center_result_large = new double*[numberOfCircles];
-	for (unsigned int k=0; k<numberOfCircles; k++) {
-		center_result_small[k] = new double[2];
-		center_result_large[k] = new double[2];
+	// Coarse level: the axial slices are downsampled by averaging blocks of factor x factor pixels, and the circles are searched on the whole slices
+	vector<ImageType2D::Pointer> coarseImages(numberOfSlices);
+	for (unsigned int n=0; n<numberOfSlices; n++)
+	{
+		BinShrinkFilterType::Pointer shrinkFilter = BinShrinkFilterType::New();
+		shrinkFilter->SetInput(images[n]);
+		shrinkFilter->SetShrinkFactors(factor);
+		shrinkFilter->Update();
+		coarseImages[n] = shrinkFilter->GetOutput();
+		coarseImages[n]->DisconnectPipeline();
 	}
-	double *radius_result_small = new double[numberOfCircles], *radius_result_large = new double[numberOfCircles];
-	double *accumulator_result_small = new double[numberOfCircles], *accumulator_result_large = new double[numberOfCircles];
-	unsigned int numSmall = houghTransformCircles(im,numberOfCircles,center_result_small,radius_result_small,accumulator_result_small,radius_/mean_resolution_,-1.0);
-	unsigned int numLarge = houghTransformCircles(clonedOutput,numberOfCircles,center_result_large,radius_result_large,accumulator_result_large,radius_/mean_resolution_+6.0,1.0);
+	vector< vector< vector<CVector3> > > coarseCenters(numberOfSlices);
+	vector< vector< vector<double> > > coarseRadii(numberOfSlices), coarseAccumulators(numberOfSlices);
+	runInParallel(numberOfSlices, [&](unsigned int n) {
+		searchCenters(coarseImages[n],stretchingFactors,factor,thresholds[n],coarseCenters[n],coarseRadii[n],coarseAccumulators[n],startZ+sliceOffsets[n]);
+	});
     
-	// search along results for nested circles
-	vector<unsigned int> listMostPromisingCenters;
-	vector<unsigned int> listMostPromisingCentersLarge;
-	double distance = 0.0;
-	for (unsigned int i=0; i<numSmall; i++)
+	// Surviving candidates: as for the chains at full resolution, a circle is kept only if a circle of similar radius
+	// is detected with the same stretching factor on a neighbouring slice. A window around each of them is searched again at full resolution.
+	// The window contains the outer circle of the detection (radius_+9 pixels) for every stretching factor, and the error of the coarse position.
+	long halfSize = (long)ceil(2.0*(radius_/mean_resolution_+9.0)) + 2*factor;
+	vector<unsigned int> windowSlices;
+	vector<ImageType2D::RegionType> windowRegions;
+	for (unsigned int n=0; n<numberOfSlices; n++)
 	{
-		for (unsigned int j=0; j<numLarge; j++)
+		ImageType2D::RegionType sliceRegion = images[n]->GetLargestPossibleRegion();
+		vector<ImageType2D::RegionType> boxes;
+		for (unsigned int s=0; s<numberOfStretchings; s++)
 		{
-			// distance between center + small_radius must be smaller than large_radius
-			distance = sqrt(pow(center_result_small[i][0]-center_result_large[j][0],2)+pow(center_result_small[i][1]-center_result_large[j][1],2));
-			if ((distance+radius_result_small[i])*0.8 <= radius_result_large[j]) {
-				listMostPromisingCenters.push_back(i);
-				listMostPromisingCentersLarge.push_back(j);
+			for (unsigned int m=0; m<coarseCenters[n][s].size(); m++)
+			{
+				if (coarseRadii[n][s][m] == 0.0 || !hasNeighborCircle(coarseCenters,coarseRadii,n,s,m,stretchingFactors[s],factor)) continue;
+                
+				// center of the candidate at full resolution (the coarse pixel j covers the pixels j*factor to j*factor+factor-1)
+				const CVector3& candidate = coarseCenters[n][s][m];
+				double x = candidate[0]/stretchingFactors[s]*factor + (factor-1)/2.0, y = candidate[2]*factor + (factor-1)/2.0;
+				ImageType2D::IndexType start;
+				ImageType2D::SizeType size;
+				start[0] = (long)floor(x)-halfSize;
+				start[1] = (long)floor(y)-halfSize;
+				size[0] = 2*halfSize+1;
+				size[1] = 2*halfSize+1;
+				ImageType2D::RegionType box(start,size);
+				if (box.Crop(sliceRegion)) boxes.push_back(box);
 			}
 		}
+        
+		// Overlapping windows are merged, so that a circle is only detected once
+		bool merged = true;
+		while (merged)
+		{
+			merged = false;
+			for (unsigned int i=0; i<boxes.size() && !merged; i++)
+			{
+				for (unsigned int j=i+1; j<boxes.size() && !merged; j++)
+				{
+					ImageType2D::IndexType startI = boxes[i].GetIndex(), startJ = boxes[j].GetIndex(), start;
+					ImageType2D::IndexType endI = boxes[i].GetUpperIndex(), endJ = boxes[j].GetUpperIndex(), end;
+					if (startI[0] > endJ[0] || startJ[0] > endI[0] || startI[1] > endJ[1] || startJ[1] > endI[1]) continue;
+					for (unsigned int d=0; d<2; d++) {
+						start[d] = min(startI[d],startJ[d]);
+						end[d] = max(endI[d],endJ[d]);
+					}
+					boxes[i].SetIndex(start);
+					boxes[i].SetUpperIndex(end);
+					boxes.erase(boxes.begin()+j);
+					merged = true;
+				}
+			}
+		}
+		for (unsigned int b=0; b<boxes.size(); b++) {
+			windowSlices.push_back(n);
+			windowRegions.push_back(boxes[b]);
+		}
+	}
+	if (windowRegions.empty()) return false;
+	if (verbose_) cout << "Multiscale initialization: " << windowRegions.size() << " windows searched at full resolution" << endl;
+    
+	// Full resolution: the circles are searched in the windows only, with the threshold of the whole slice
+	unsigned int numberOfWindows = windowRegions.size();
+	vector<ImageType2D::Pointer> windowImages(numberOfWindows);
+	for (unsigned int w=0; w<numberOfWindows; w++)
+	{
+		WindowFilterType::Pointer windowFilter = WindowFilterType::New();
+		windowFilter->SetExtractionRegion(windowRegions[w]);
+		windowFilter->SetInput(images[windowSlices[w]]);
+		windowFilter->Update();
+		windowImages[w] = windowFilter->GetOutput();
+		windowImages[w]->DisconnectPipeline();
 	}
-	for (unsigned int i=0; i<listMostPromisingCenters.size(); i++)
+	vector< vector< vector<HoughPeaks::Peak> > > windowCirclesSmall(numberOfWindows), windowCirclesLarge(numberOfWindows);
+	runInParallel(numberOfWindows, [&](unsigned int w) {
+		searchCircles(windowImages[w],stretchingFactors,1.0,thresholds[windowSlices[w]],windowCirclesSmall[w],windowCirclesLarge[w]);
+	});
+    
+	// The circles of the windows of a slice are gathered and, as for a whole slice, only the numberOfHoughCircles best ones of each accumulator are kept
+	// (decreasing accumulation, then raster order), before the search for nested circles
+	auto peakOrder = [](const HoughPeaks::Peak& a, const HoughPeaks::Peak& b) {
+		if (a.accumulator != b.accumulator) return a.accumulator > b.accumulator;
+		if (a.center[1] != b.center[1]) return a.center[1] < b.center[1];
+		return a.center[0] < b.center[0];
+	};
+	for (unsigned int n=0; n<numberOfSlices; n++)
 	{
-		vecCenter.push_back(CVector3(center_result_small[listMostPromisingCenters[i]][0],startZ,center_result_small[listMostPromisingCenters[i]][1]));
-		vecRadii.push_back(radius_result_small[listMostPromisingCenters[i]]);
-		vecAccumulator.push_back(accumulator_result_small[listMostPromisingCenters[i]]);
+		vector< vector<HoughPeaks::Peak> > circlesSmall(numberOfStretchings), circlesLarge(numberOfStretchings);
+		for (unsigned int w=0; w<numberOfWindows; w++)
+		{
+			if (windowSlices[w] != n) continue;
+			for (unsigned int s=0; s<numberOfStretchings; s++)
+			{
+				circlesSmall[s].insert(circlesSmall[s].end(),windowCirclesSmall[w][s].begin(),windowCirclesSmall[w][s].end());
+				circlesLarge[s].insert(circlesLarge[s].end(),windowCirclesLarge[w][s].begin(),windowCirclesLarge[w][s].end());
+			}
+		}
+		for (unsigned int s=0; s<numberOfStretchings; s++)
+		{
+			stable_sort(circlesSmall[s].begin(),circlesSmall[s].end(),peakOrder);
+			stable_sort(circlesLarge[s].begin(),circlesLarge[s].end(),peakOrder);
+			if (circlesSmall[s].size() > numberOfHoughCircles) circlesSmall[s].resize(numberOfHoughCircles);
+			if (circlesLarge[s].size() > numberOfHoughCircles) circlesLarge[s].resize(numberOfHoughCircles);
+		}
+		selectNestedCircles(circlesSmall,circlesLarge,startZ+sliceOffsets[n],centers[n],radii[n],accumulators[n]);
 	}
+    
+	// The chain search needs at least one circle with a neighbour on the next or previous slice: otherwise the windows missed the spinal cord
+	// and the whole slices are searched at full resolution
+	bool hasNeighbor = false;
+	for (unsigned int n=0; n<numberOfSlices && !hasNeighbor; n++)
+		for (unsigned int s=0; s<numberOfStretchings && !hasNeighbor; s++)
+			for (unsigned int m=0; m<centers[n][s].size() && !hasNeighbor; m++)
+				hasNeighbor = radii[n][s][m] != 0.0 && hasNeighborCircle(centers,radii,n,s,m,stretchingFactors[s],1.0);
+	if (!hasNeighbor && verbose_) cout << "Multiscale initialization: no chain of circles in the windows, search on the whole slices" << endl;
+	return hasNeighbor;
 }
 
 
-unsigned int Initialisation::houghTransformCircles(ImageType2D* im, unsigned int numberOfCircles, double** center_result, double* radius_result, double* accumulator_result, double meanRadius, double valPrint)
+void Initialisation::searchCenters(ImageType2D::Pointer im, const vector<double> &stretchingFactors, double pixelFactor, double threshold, vector< vector<CVector3> > &vecCenter, vector< vector<double> > &vecRadii, vector< vector<double> > &vecAccumulator, float startZ)
 {
-	MinMaxCalculatorType::Pointer minMaxCalculator = MinMaxCalculatorType::New();
-	minMaxCalculator->SetImage(im);
-	minMaxCalculator->ComputeMaximum();
-	minMaxCalculator->ComputeMinimum();
-	ImageType2D::PixelType maxIm = minMaxCalculator->GetMaximum(), minIm = minMaxCalculator->GetMinimum();
-	double val_Print = maxIm;
+	vector< vector<HoughPeaks::Peak> > circlesSmall, circlesLarge;
+	searchCircles(im,stretchingFactors,pixelFactor,threshold,circlesSmall,circlesLarge);
+	selectNestedCircles(circlesSmall,circlesLarge,startZ,vecCenter,vecRadii,vecAccumulator);
+}
+
+
+void Initialisation::searchCircles(ImageType2D::Pointer im, const vector<double> &stretchingFactors, double pixelFactor, double threshold, vector< vector<HoughPeaks::Peak> > &circlesSmall, vector< vector<HoughPeaks::Peak> > &circlesLarge)
+{
+	// One Hough transform votes in two accumulators from the same gradient: the spinal cord (inward votes, radius around radius_)
+	// and the CSF around it (outward votes, radius around radius_+6). It votes for every stretching factor of the image in the antero-posterior direction (elliptical Hough transform).
+	// The radii are given in pixels of the full resolution, and divided by pixelFactor for downsampled images.
+	double meanRadius = radius_/mean_resolution_/pixelFactor, meanRadiusLarge = meanRadius+6.0/pixelFactor;
+	double min_radius = meanRadius-3.0/pixelFactor, min_radius_large = meanRadiusLarge-3.0/pixelFactor;
+	if (min_radius < 0) min_radius = 0;
+	if (min_radius_large < 0) min_radius_large = 0;
     
-    double min_radius = meanRadius-3.0;
-    if (min_radius < 0) min_radius = 0;
-	
 	HoughCirclesFilter::Pointer houghfilter = HoughCirclesFilter::New();
 	houghfilter->SetInput(im);
 	houghfilter->SetMinimumRadius(min_radius);
-	houghfilter->SetMaximumRadius(meanRadius+3.0);
+	houghfilter->SetMaximumRadius(meanRadius+3.0/pixelFactor);
+	houghfilter->SetGradientFactor(-1.0*typeImageFactor_);
+	houghfilter->SetSecondaryRadii(min_radius_large,meanRadiusLarge+3.0/pixelFactor,1.0*typeImageFactor_);
+	houghfilter->SetStretchingFactors(stretchingFactors);
 	houghfilter->SetSigmaGradient(2);
-	houghfilter->SetGradientFactor(valPrint*typeImageFactor_);
 	houghfilter->SetSweepAngle(M_PI/180.0*5.0);
-	houghfilter->SetThreshold((maxIm-minIm)/20.0);
+	houghfilter->SetThreshold(threshold);
 	houghfilter->Update();
-	
-    
-	const double nPI = 4.0 * std::atan( 1.0 );
-	ImageType2D::IndexType index;
-    
-	ImageType2D::Pointer m_Accumulator= houghfilter->GetOutput();
-    
-	ImageType2D::Pointer m_RadiusImage= houghfilter->GetRadiusImage();
     
-	/** Blur the accumulator in order to find the maximum */
-	ImageType2D::Pointer m_PostProcessImage = ImageType2D::New();
-	GaussianFilterType::Pointer gaussianFilter = GaussianFilterType::New();
-	gaussianFilter->SetInput(m_Accumulator);
-	double variance[2];
-	variance[0]=10;
-	variance[1]=10;
-	gaussianFilter->SetVariance(variance);
-	gaussianFilter->SetMaximumError(.01f);
-	gaussianFilter->Update();
-	m_PostProcessImage = gaussianFilter->GetOutput();
-    
-	ImageType2D::SizeType bound = m_PostProcessImage->GetLargestPossibleRegion().GetSize();
-    
-	itk::ImageRegionIterator<ImageType2D> it_output(im,im->GetLargestPossibleRegion());
-	itk::ImageRegionIterator<ImageType2D> it_input(m_PostProcessImage,m_PostProcessImage->GetLargestPossibleRegion());
-    
-    
-	/** Set the disc ratio */
-	double discRatio = 1.1;
-    
-	/** Search for maxima */
-	unsigned int circles=0, maxIteration=100, it=0;
-	do{
-		it++;
-		minMaxCalculator->SetImage(m_PostProcessImage);
-		minMaxCalculator->ComputeMaximum();
-		ImageType2D::PixelType max = minMaxCalculator->GetMaximum();
+	// The centers are returned in the stretched coordinates of the image: index of the image (not of the stretched accumulator) times the stretching factor
+	ImageType2D::RegionType region = im->GetLargestPossibleRegion();
+	circlesSmall.assign(stretchingFactors.size(),vector<HoughPeaks::Peak>());
+	circlesLarge.assign(stretchingFactors.size(),vector<HoughPeaks::Peak>());
+	for (unsigned int s=0; s<stretchingFactors.size(); s++)
+	{
+		HoughPeaks::extract(houghfilter->GetStretchedAccumulator(s),houghfilter->GetStretchedRadiusImage(s),numberOfHoughCircles,circlesSmall[s]);
+		HoughPeaks::extract(houghfilter->GetStretchedAccumulator(s,true),houghfilter->GetStretchedRadiusImage(s,true),numberOfHoughCircles,circlesLarge[s]);
+		ImageType2D::RegionType stretchedRegion = houghfilter->GetStretchedAccumulator(s)->GetLargestPossibleRegion();
+		double scale = (double)stretchedRegion.GetSize()[0]/region.GetSize()[0];
+		vector<HoughPeaks::Peak>* circles[2] = { &circlesSmall[s], &circlesLarge[s] };
+		for (unsigned int b=0; b<2; b++)
+		{
+			for (unsigned int i=0; i<circles[b]->size(); i++)
+			{
+				HoughPeaks::Peak& peak = (*circles[b])[i];
+				peak.center[0] = (region.GetIndex()[0]+(peak.center[0]-stretchedRegion.GetIndex()[0])/scale)*stretchingFactors[s];
+				peak.center[1] = region.GetIndex()[1]+peak.center[1]-stretchedRegion.GetIndex()[1];
+			}
+		}
+	}
+}
+
+
+void Initialisation::selectNestedCircles(const vector< vector<HoughPeaks::Peak> > &circlesSmall, const vector< vector<HoughPeaks::Peak> > &circlesLarge, float startZ, vector< vector<CVector3> > &vecCenter, vector< vector<double> > &vecRadii, vector< vector<double> > &vecAccumulator)
+{
+	unsigned int numberOfStretchings = circlesSmall.size();
+	vecCenter.assign(numberOfStretchings,vector<CVector3>());
+	vecRadii.assign(numberOfStretchings,vector<double>());
+	vecAccumulator.assign(numberOfStretchings,vector<double>());
+	for (unsigned int s=0; s<numberOfStretchings; s++)
+	{
+		unsigned int numSmall = circlesSmall[s].size(), numLarge = circlesLarge[s].size();
         
-		it_output.GoToBegin();
-		for(it_input.GoToBegin();!it_input.IsAtEnd();++it_input)
+		// search along results for nested circles
+		vector<unsigned int> listMostPromisingCenters;
+		vector<unsigned int> listMostPromisingCentersLarge;
+		double distance = 0.0;
+		for (unsigned int i=0; i<numSmall; i++)
 		{
-			if(it_input.Get() == max)
+			for (unsigned int j=0; j<numLarge; j++)
 			{
-				it_output.Set(val_Print);
-				index = it_output.GetIndex();
-				double radius2 = m_RadiusImage->GetPixel(index);
-				if (index[0]!=0 && index[0]!=bound[0]-1 && index[1]!=0 && index[1]!=bound[1]-1)
-				{
-					center_result[circles][0] = it_output.GetIndex()[0];
-					center_result[circles][1] = it_output.GetIndex()[1];
-					radius_result[circles] = radius2;
-					accumulator_result[circles] = m_PostProcessImage->GetPixel(index);
-                    
-					// Draw the circle
-					for(double angle = 0; angle <= 2 * nPI; angle += nPI / 1000)
-					{
-						index[0] = (long int)(it_output.GetIndex()[0] + radius2 * cos(angle));
-						index[1] = (long int)(it_output.GetIndex()[1] + radius2 * sin(angle));
-						if (index[0]>=0 && index[0]<bound[0] && index[1]>=0 && index[1]<bound[1])
-							im->SetPixel(index,val_Print);
-                        
-						// Remove the maximum from the accumulator
-						for(double length = 0; length < discRatio*radius2;length+=1)
-						{
-							index[0] = (long int)(it_output.GetIndex()[0] + length * cos(angle));
-							index[1] = (long int)(it_output.GetIndex()[1] + length* sin(angle));
-							if (index[0]>=0 && index[0]<bound[0] && index[1]>=0 && index[1]<bound[1])
-								m_PostProcessImage->SetPixel(index,0);
-						}
-					}
-					circles++;
-					if(circles == numberOfCircles) break;
-				}
-				else
-				{
-					// Draw the circle
-					for(double angle = 0; angle <= 2 * nPI; angle += nPI / 1000)
-					{
-						// Remove the maximum from the accumulator
-						for(double length = 0; length < discRatio*radius2;length+=1)
-						{
-							index[0] = (long int)(it_output.GetIndex()[0] + length * cos(angle));
-							index[1] = (long int)(it_output.GetIndex()[1] + length* sin(angle));
-							if (index[0]>=0 && index[0]<bound[0] && index[1]>=0 && index[1]<bound[1])
-								m_PostProcessImage->SetPixel(index,0);
-						}
-					}
+				// distance between center + small_radius must be smaller than large_radius
+				distance = sqrt(pow(circlesSmall[s][i].center[0]-circlesLarge[s][j].center[0],2)+pow(circlesSmall[s][i].center[1]-circlesLarge[s][j].center[1],2));
+				if ((distance+circlesSmall[s][i].radius)*0.8 <= circlesLarge[s][j].radius) {
+					listMostPromisingCenters.push_back(i);
+					listMostPromisingCentersLarge.push_back(j);
 				}
-				minMaxCalculator->SetImage(m_PostProcessImage);
-				minMaxCalculator->ComputeMaximum();
-				max = minMaxCalculator->GetMaximum();
 			}
-			++it_output;
+		}
+		for (unsigned int i=0; i<listMostPromisingCenters.size(); i++)
+		{
+			const HoughPeaks::Peak& peak = circlesSmall[s][listMostPromisingCenters[i]];
+			vecCenter[s].push_back(CVector3(peak.center[0],startZ,peak.center[1]));
+			vecRadii[s].push_back(peak.radius);
+			vecAccumulator[s].push_back(peak.accumulator);
 		}
 	}
-	while(circles<numberOfCircles && it<=maxIteration);
-    
-	return circles;
 }
 
+
 void Initialisation::getPoints(CVector3 &point, CVector3 &normal1, CVector3 &normal2, double &radius, double &stretchingFactor)
 {
 	point = initialPoint_;
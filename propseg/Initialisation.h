@@ -9,10 +9,12 @@
 
 #include <vector>
 #include <string>
+#include <functional>
 
 #include <itkImage.h>
 
 #include "../util/Vector3.h"
+#include "HoughPeaks.h"
 
 
 typedef itk::Image< double, 3 >	ImageType;
@@ -41,6 +43,8 @@ public:
     void setStartSlice(int slice) { startSlice_ = slice; };
     void setNumberOfSlices(int nbSlice) { numberOfSlices_ = nbSlice-(1-nbSlice%2); }; //need to be impair
     void setRadius(double radius) { radius_ = radius; };
+    //! Multiscale detection: the circles are first searched on axial slices downsampled by factor (2 or 4), then again at full resolution only in windows around the candidates found on neighbouring slices. 1 disables it (default), 0 chooses the factor from the in-plane resolution.
+    void setPyramidFactor(int factor) { pyramidFactor_ = factor; };
     
     std::vector<CVector3> getCenterlineUsingMinimalPath(std::vector<int> middle_slices, double alpha=0.15, double beta=1.0, double gamma=5.0, double sigmaMinimum=1.5, double sigmaMaximum=4.5, unsigned int numberOfSigmaSteps=5, double sigmaDistance=10.0);
     ImageType::Pointer minimalPath3d(ImageType::Pointer image, std::vector<CVector3> &centerline, bool homoInt=false, bool invert=true, double factx=sqrt(2));
@@ -57,8 +61,19 @@ public:
     bool getVerbose() { return verbose_; };
     
 private:
-	void searchCenters(ImageType2D::Pointer im, std::vector<CVector3> &vecCenter, std::vector<double> &vecRadii, std::vector<double> &vecAccumulator, float startZ);
-	unsigned int houghTransformCircles(ImageType2D* im, unsigned int numberOfCircles, double** center_result, double* radius_result, double* accumulator_result, double meanRadius, double valPrint=255);
+	// Circles detected in the axial slice im, for each stretching factor of the slice in the antero-posterior direction. pixelFactor is the size of the pixels of im relative to the input image,
+	// threshold the minimal intensity of the pixels voting in the Hough transform.
+	void searchCenters(ImageType2D::Pointer im, const std::vector<double> &stretchingFactors, double pixelFactor, double threshold, std::vector< std::vector<CVector3> > &vecCenter, std::vector< std::vector<double> > &vecRadii, std::vector< std::vector<double> > &vecAccumulator, float startZ);
+	// Best circles of the spinal cord (small) and CSF (large) Hough accumulators of im, centers in the stretched coordinates of the slice (index of im times the stretching factor)
+	void searchCircles(ImageType2D::Pointer im, const std::vector<double> &stretchingFactors, double pixelFactor, double threshold, std::vector< std::vector<HoughPeaks::Peak> > &circlesSmall, std::vector< std::vector<HoughPeaks::Peak> > &circlesLarge);
+	// Spinal cord circles nested in a CSF circle, for each stretching factor
+	static void selectNestedCircles(const std::vector< std::vector<HoughPeaks::Peak> > &circlesSmall, const std::vector< std::vector<HoughPeaks::Peak> > &circlesLarge, float startZ, std::vector< std::vector<CVector3> > &vecCenter, std::vector< std::vector<double> > &vecRadii, std::vector< std::vector<double> > &vecAccumulator);
+	// Same results as searchCenters on each slice, from a detection on the slices downsampled by factor refined in windows at full resolution (with the thresholds of the whole slices).
+	// Returns false if no candidate survives at the coarse level or if no circle of the windows has a neighbour on the next or previous slice.
+	bool searchCentersPyramid(const std::vector<ImageType2D::Pointer> &images, const std::vector<double> &thresholds, const std::vector<int> &sliceOffsets, const std::vector<double> &stretchingFactors, float startZ, unsigned int factor, std::vector< std::vector< std::vector<CVector3> > > &centers, std::vector< std::vector< std::vector<double> > > &radii, std::vector< std::vector< std::vector<double> > > &accumulators);
+	// True if the circle m (slice n, stretching factor s) has a circle of similar radius (less than 20% of difference) closer than sqrt(2)*gap_ on the next or previous slice, as in the chain search
+	bool hasNeighborCircle(const std::vector< std::vector< std::vector<CVector3> > > &centers, const std::vector< std::vector< std::vector<double> > > &radii, unsigned int n, unsigned int s, unsigned int m, double stretchingFactor, double pixelFactor) const;
+	static void runInParallel(unsigned int numberOfItems, const std::function<void(unsigned int)> &work);
     ImageType::Pointer vesselnessFilter(std::vector<int> middle_slices, ImageType::Pointer im, double alpha=0.15, double beta=1.0, double gamma=5.0, double sigmaMinimum=1.5, double sigmaMaximum=4.5, unsigned int numberOfSigmaSteps=10, double sigmaDistance=30.0);
     ImageType::Pointer vesselnessFilter2(ImageType::Pointer im);
     int symmetryDetection(ImageType2D::Pointer im, double cropWidth_, double bandWidth_);
@@ -72,6 +87,7 @@ private:
 	double typeImageFactor_, gap_, radius_;
     unsigned int numberOfSlices_;
     float startSlice_;
+    int pyramidFactor_;
     double mean_resolution_;
     
     OrientationType orientation_;
@@ -0,0 +1,129 @@
+#include "LBFGSWarmStartOptimizer.h"
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+#include <itkExceptionObject.h>
+
+using namespace std;
+
+
+LBFGSWarmStartOptimizer::LBFGSWarmStartOptimizer(unsigned int memory)
+	: costFunction_(0), memory_(memory), maxEvaluations_(500), fTolerance_(1e-4), gTolerance_(1e-6),
+	numberOfEvaluations_(0), numberOfIterations_(0), value_(0.0)
+{
+    verbose_ = false;
+}
+
+
+void LBFGSWarmStartOptimizer::resetMemory()
+{
+	s_.clear();
+	y_.clear();
+	rho_.clear();
+}
+
+
+// Two-loop recursion : direction = -H*gradient, H etant l'approximation de l'inverse du Hessien construite a partir des paires (s,y)
+void LBFGSWarmStartOptimizer::computeDirection(const vnl_vector<double>& gradient, vnl_vector<double>& direction)
+{
+	unsigned int m = (unsigned int)s_.size();
+	vector<double> a(m);
+	vnl_vector<double> q = gradient;
+	for (int i=(int)m-1; i>=0; i--) {
+		a[i] = rho_[i]*dot_product(s_[i],q);
+		q -= a[i]*y_[i];
+	}
+	if (m != 0) {
+		double gamma = dot_product(s_[m-1],y_[m-1])/dot_product(y_[m-1],y_[m-1]);
+		q *= gamma;
+	}
+	for (unsigned int i=0; i<m; i++) {
+		double b = rho_[i]*dot_product(y_[i],q);
+		q += (a[i]-b)*s_[i];
+	}
+	direction = -q;
+}
+
+
+double LBFGSWarmStartOptimizer::optimize(ParametersType& position)
+{
+	if (costFunction_ == 0)
+		throw itk::ExceptionObject(__FILE__,__LINE__,"No cost function set","LBFGSWarmStartOptimizer::optimize");
+
+	unsigned int n = position.size();
+	if (!s_.empty() && s_[0].size() != n) resetMemory();
+
+	numberOfEvaluations_ = 0;
+	numberOfIterations_ = 0;
+
+	ParametersType x = position, xNew(n);
+	DerivativeType gradient(n), gradientNew(n);
+	double value = 0.0, valueNew = 0.0;
+	costFunction_->GetValueAndDerivative(x,value,gradient);
+	numberOfEvaluations_++;
+
+	vnl_vector<double> direction(n);
+	const double c1 = 1e-4; // condition d'Armijo
+	while (numberOfEvaluations_ < maxEvaluations_)
+	{
+		double gradientNorm = gradient.magnitude();
+		if (gradientNorm <= gTolerance_) break;
+
+		computeDirection(gradient,direction);
+		double slope = dot_product(direction,gradient);
+		if (slope >= 0.0) {
+			// La memoire ne correspond plus a la fonction de cout : on repart de la plus forte pente
+			resetMemory();
+			direction = -gradient;
+			slope = -gradientNorm*gradientNorm;
+		}
+
+		// Sans memoire, le premier pas est normalise pour eviter un deplacement demesure
+		double step = 1.0;
+		if (s_.empty()) step = min(1.0,1.0/gradientNorm);
+
+		// Recherche lineaire par rebroussement avec interpolation quadratique (exacte pour l'energie quadratique du modele deformable)
+		bool accepted = false;
+		while (numberOfEvaluations_ < maxEvaluations_)
+		{
+			for (unsigned int i=0; i<n; i++) xNew[i] = x[i] + step*direction[i];
+			costFunction_->GetValueAndDerivative(xNew,valueNew,gradientNew);
+			numberOfEvaluations_++;
+			if (valueNew <= value + c1*step*slope) {
+				accepted = true;
+				break;
+			}
+			double stepQuadratic = -slope*step*step/(2.0*(valueNew-value-slope*step));
+			step = max(0.1*step,min(0.5*step,stepQuadratic));
+		}
+		if (!accepted) break;
+		numberOfIterations_++;
+
+		vnl_vector<double> s = xNew - x, y = gradientNew - gradient;
+		double sy = dot_product(s,y);
+		if (sy > 1e-10*dot_product(y,y)) {
+			if (s_.size() == memory_) {
+				s_.pop_front();
+				y_.pop_front();
+				rho_.pop_front();
+			}
+			s_.push_back(s);
+			y_.push_back(y);
+			rho_.push_back(1.0/sy);
+		}
+
+		double decrease = value - valueNew;
+		x = xNew;
+		gradient = gradientNew;
+		value = valueNew;
+		if (decrease <= fTolerance_*max(1.0,fabs(value))) break;
+	}
+
+	if (verbose_) cout << "L-BFGS : " << numberOfIterations_ << " iterations, " << numberOfEvaluations_ << " evaluations, memory " << s_.size() << ", value " << value << endl;
+
+	position = x;
+	value_ = value;
+	return value;
+}
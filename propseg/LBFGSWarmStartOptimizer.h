@@ -0,0 +1,68 @@
+#ifndef __LBFGSWarmStartOptimizer__
+#define __LBFGSWarmStartOptimizer__
+
+/*!
+ * \file LBFGSWarmStartOptimizer.h
+ * \brief Limited memory BFGS optimizer keeping its curvature memory between successive optimizations.
+ * \author Benjamin De Leener - NeuroPoly (http://www.neuropoly.info)
+ */
+
+#include <deque>
+
+#include <itkSingleValuedCostFunction.h>
+#include <vnl/vnl_vector.h>
+
+/*!
+ * \class LBFGSWarmStartOptimizer
+ * \brief Limited memory BFGS optimizer with warm start.
+ *
+ * The deformable model is optimized several times in a row with an energy that only slightly changes between outer iterations (new optimal points and rigid transformation).
+ * The internal energy, which dominates the Hessian, does not change. This optimizer therefore keeps its (s,y) curvature pairs between calls to optimize(), instead of
+ * restarting from a steepest descent like itk::ConjugateGradientOptimizer does. Call resetMemory() when the cost function changes completely.
+ */
+class LBFGSWarmStartOptimizer
+{
+public:
+	typedef itk::SingleValuedCostFunction		CostFunctionType;
+	typedef CostFunctionType::ParametersType	ParametersType;
+	typedef CostFunctionType::DerivativeType	DerivativeType;
+
+	LBFGSWarmStartOptimizer(unsigned int memory=7);
+	~LBFGSWarmStartOptimizer() {};
+
+	void setCostFunction(CostFunctionType* costFunction) { costFunction_ = costFunction; };
+	void setMemory(unsigned int memory) { memory_ = memory; resetMemory(); };
+	void setMaximumNumberOfEvaluations(unsigned int nb) { maxEvaluations_ = nb; };
+	void setFunctionTolerance(double f) { fTolerance_ = f; };
+	void setGradientTolerance(double g) { gTolerance_ = g; };
+
+	//! Minimize the cost function starting from position. The result is returned in position and the final value of the cost function is returned.
+	double optimize(ParametersType& position);
+	void resetMemory();
+
+	unsigned int getNumberOfEvaluations() { return numberOfEvaluations_; };
+	unsigned int getNumberOfIterations() { return numberOfIterations_; };
+	unsigned int getMemorySize() { return (unsigned int)s_.size(); };
+	double getValue() { return value_; };
+
+    void setVerbose(bool verbose) { verbose_ = verbose; };
+    bool getVerbose() { return verbose_; };
+
+private:
+	void computeDirection(const vnl_vector<double>& gradient, vnl_vector<double>& direction);
+
+	CostFunctionType* costFunction_;
+
+	unsigned int memory_, maxEvaluations_;
+	double fTolerance_, gTolerance_;
+
+	std::deque< vnl_vector<double> > s_, y_;
+	std::deque<double> rho_;
+
+	unsigned int numberOfEvaluations_, numberOfIterations_;
+	double value_;
+
+    bool verbose_;
+};
+
+#endif
@@ -16,16 +16,20 @@
 #include <vtkLandmarkTransform.h>
 #include <vtkDoubleArray.h>
 #include <vtkDecimatePro.h>
-#include <vtkPolyDataNormals.h>
 #include <vtkSmoothPolyDataFilter.h>
 #include <vtkLoopSubdivisionFilter.h>
 #include <vtkBYUWriter.h>
 
+#include <vnl/vnl_matrix.h>
+#include <vnl/algo/vnl_svd.h>
+#include <vnl/algo/vnl_determinant.h>
+
 #include <itkImage.h>
 #include <itkTriangleMeshToBinaryImageFilter.h>
 #include <itkTriangleCell.h>
 #include <itkCastImageFilter.h>
 #include <itkImageRegionConstIterator.h>
+#include <itkMultiThreaderBase.h>
 
 using namespace std;
 
@@ -64,8 +68,7 @@ Mesh::Mesh(const Mesh& m)
     triangles_ = m.triangles_;
     for (unsigned int i=0; i<m.trianglesBarycentre_.size(); i++)
         trianglesBarycentre_.push_back(new Vertex(*m.trianglesBarycentre_[i]));
-    connectiviteTriangles_ = m.connectiviteTriangles_;
-    neighbors_ = m.neighbors_;
+    topology_ = m.topology_;
     for (unsigned int i=0; i<m.markers_.size(); i++)
         markers_.push_back(new Vertex(*m.markers_[i]));
     verbose_ = false;
@@ -83,6 +86,11 @@ void Mesh::clear()
         delete points_[i];
     points_.clear();
     triangles_.clear();
+    for (unsigned int i=0; i<trianglesBarycentre_.size(); i++)
+        delete trianglesBarycentre_[i];
+    trianglesBarycentre_.clear();
+    topology_.reset();
+    pointsModified(0);
 }
 
 
@@ -107,6 +115,17 @@ void Mesh::removeLastPoints(int number)
         delete points_[points_.size()-1];
         points_.pop_back();
     }
+    topology_.reset();
+    pointsModified(points_.size());
+}
+
+
+// Deplacement de tous les points (x y z pour chaque point), sans reallocation
+void Mesh::setPositions(const double* positions, unsigned int nbPoints)
+{
+    for (unsigned int i=0; i<nbPoints && i<points_.size(); i++)
+        points_[i]->setPosition(CVector3(positions[3*i],positions[3*i+1],positions[3*i+2]));
+    pointsModified(0);
 }
 
 
@@ -122,6 +141,12 @@ void Mesh::removeLastTriangles(int number)
 {
     for (int i=0; i<3*number; i++)
         triangles_.pop_back();
+    while (trianglesBarycentre_.size() > triangles_.size()/3)
+    {
+        delete trianglesBarycentre_[trianglesBarycentre_.size()-1];
+        trianglesBarycentre_.pop_back();
+    }
+    topology_.reset();
 }
 
 
@@ -155,15 +180,32 @@ void Mesh::calculateLocalPoints(CMatrix3x3 rotation, CVector3 translation)
 }
 
 
+// Les barycentres existants sont recalcules en place (pas de reallocation quand les points bougent), puis ceux des nouveaux triangles sont ajoutes
 void Mesh::computeTrianglesBarycentre()
 {
-    if (trianglesBarycentre_.size() > 0) {
-        for (unsigned int i=0; i<trianglesBarycentre_.size(); i++)
-            delete trianglesBarycentre_[i];
-        trianglesBarycentre_.clear();
+    while (trianglesBarycentre_.size() > triangles_.size()/3)
+    {
+        delete trianglesBarycentre_[trianglesBarycentre_.size()-1];
+        trianglesBarycentre_.pop_back();
     }
+    CVector3 point1, point2, point3, normal;
+    for (unsigned int i=0; i<trianglesBarycentre_.size(); i++) {
+        point1 = points_[triangles_[3*i]]->getPosition();
+        point2 = points_[triangles_[3*i+1]]->getPosition();
+        point3 = points_[triangles_[3*i+2]]->getPosition();
+        normal = ((point1-point2)^(point1-point3)).Normalize();
+        trianglesBarycentre_[i]->setPosition((point1+point2+point3)/3);
+        trianglesBarycentre_[i]->setNormal(normal[0],normal[1],normal[2]);
+    }
+    updateTrianglesBarycentre();
+}
+
+
+// Barycentres des triangles ajoutes depuis le dernier calcul seulement (les points existants n'ont pas bouge)
+void Mesh::updateTrianglesBarycentre()
+{
     CVector3 point1, point2, point3;
-    for (unsigned int i=0; i<triangles_.size(); i+=3) {
+    for (unsigned int i=3*trianglesBarycentre_.size(); i<triangles_.size(); i+=3) {
         point1 = points_[triangles_[i]]->getPosition();
         point2 = points_[triangles_[i+1]]->getPosition();
         point3 = points_[triangles_[i+2]]->getPosition();
@@ -176,6 +218,7 @@ void Mesh::transform(CMatrix4x4 transformation)
 {
     for (unsigned int i=0; i<points_.size(); i++)
         points_[i]->setPosition(transformation*points_[i]->getPosition());
+    pointsModified(0);
     computeTrianglesBarycentre();
 }
 
@@ -184,6 +227,7 @@ void Mesh::transform(CMatrix4x4 transformation, CVector3 rotationPoint)
 {
     for (unsigned int i=0; i<points_.size(); i++)
         points_[i]->setPosition(transformation*(points_[i]->getPosition()-rotationPoint)+rotationPoint);
+    pointsModified(0);
     computeTrianglesBarycentre();
 }
 
@@ -199,38 +243,31 @@ void Mesh::localTransform(CMatrix4x4 transformation)
         CVector3 translationInv(transfRef[12],transfRef[13],transfRef[14]);
         for (unsigned int i=0; i<points_.size(); i++)
             points_[i]->setPosition(rotationInv*(points_[i]->getPosition()+translationInv));
+        pointsModified(0);
     }
 }
 
 void Mesh::computeConnectivity()
 {
-	unsigned int pointSize = points_.size();
-	connectiviteTriangles_.resize(pointSize);
-	unsigned int num, size;
-	for (unsigned int i=0; i<pointSize; i++) {
-		vector<int> temp;
-		size = triangles_.size();
-		for (unsigned int j=0; j<size; j++) {
-			if (j==size-1) num = j/3;
-			else num = (j+1)/3;
-			if (triangles_[j] == i) temp.push_back(num);
-		}
-		connectiviteTriangles_[i] = temp;
-	}
+	topology_ = std::make_shared<MeshTopology>(triangles_,points_.size());
+}
 
-	neighbors_.resize(pointSize);
-	int pointCourant;
-	for (unsigned int i=0; i<pointSize; i++) {
-		vector<int> temp;
-		for (unsigned int j=0; j<connectiviteTriangles_[i].size(); j++) {
-			for (int k=0; k<3; k++) {
-				pointCourant = triangles_[3*connectiviteTriangles_[i][j]+k];
-				if (pointCourant != i && count(temp.begin(), temp.end(), pointCourant) == 0)
-					temp.push_back(pointCourant);
-			}
-		}
-		neighbors_[i] = temp;
+
+/*!
+ * Incremental version of computeConnectivity() for a mesh to which points and triangles have only been added.
+ * The topology is updated in place if this mesh is its only owner, otherwise it is copied first (the copies and cost functions keep the old one).
+ */
+void Mesh::updateConnectivity()
+{
+	if (!topology_ || topology_->getNbrOfPoints() > points_.size() || topology_->getNbrOfTriangles() > triangles_.size()/3) {
+		computeConnectivity();
+		return;
 	}
+	std::shared_ptr<MeshTopology> topology;
+	if (topology_.use_count() == 1) topology = std::const_pointer_cast<MeshTopology>(topology_);
+	else topology = std::make_shared<MeshTopology>(*topology_);
+	topology->append(triangles_,points_.size());
+	topology_ = topology;
 }
 
 
@@ -448,6 +485,64 @@ CMatrix4x4 Mesh::ICP(Mesh *vTarget)
 }
 
 
+/*!
+ * Closed-form rigid alignment (Kabsch) between two sets of points with known correspondences (point i of source is matched to point i of target).
+ * Points are given as flat arrays [x1 y1 z1 x2 y2 z2 ...]. The returned matrix takes the source points to the target points, like ICP.
+ */
+CMatrix4x4 Mesh::rigidAlignment(const double* source, const double* target, unsigned int nbPoints)
+{
+	CMatrix4x4 transformation;
+	if (nbPoints == 0) return transformation;
+
+	double centreSource[3] = {0.0,0.0,0.0}, centreTarget[3] = {0.0,0.0,0.0};
+	for (unsigned int i=0; i<nbPoints; i++) {
+		for (int k=0; k<3; k++) {
+			centreSource[k] += source[3*i+k];
+			centreTarget[k] += target[3*i+k];
+		}
+	}
+	for (int k=0; k<3; k++) {
+		centreSource[k] /= (double)nbPoints;
+		centreTarget[k] /= (double)nbPoints;
+	}
+
+	// Matrice de covariance croisee H = sum (s_i - cs)(t_i - ct)^T
+	double h[9] = {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0};
+	double s[3], t[3];
+	for (unsigned int i=0; i<nbPoints; i++) {
+		for (int k=0; k<3; k++) {
+			s[k] = source[3*i+k]-centreSource[k];
+			t[k] = target[3*i+k]-centreTarget[k];
+		}
+		for (int r=0; r<3; r++) {
+			h[3*r] += s[r]*t[0];
+			h[3*r+1] += s[r]*t[1];
+			h[3*r+2] += s[r]*t[2];
+		}
+	}
+
+	vnl_matrix<double> covariance(h,3,3);
+	vnl_svd<double> svd(covariance);
+	vnl_matrix<double> u = svd.U(), v = svd.V();
+	// R = V U^T, avec correction de la reflexion si det(R) < 0
+	vnl_matrix<double> rotation = v*u.transpose();
+	if (vnl_determinant(rotation) < 0.0) {
+		for (int r=0; r<3; r++) v(r,2) = -v(r,2);
+		rotation = v*u.transpose();
+	}
+
+	for (int i=0; i<3; i++) {
+		double translation = centreTarget[i];
+		for (int j=0; j<3; j++) {
+			transformation[4*j+i] = rotation(i,j);
+			translation -= rotation(i,j)*centreSource[j];
+		}
+		transformation[12+i] = translation;
+	}
+	return transformation;
+}
+
+
 void Mesh::decimation(float nb)
 {
 	double ratio = 1.0;
@@ -489,30 +584,17 @@ void Mesh::decimation(float nb)
 	decimate->SetTargetReduction(1-ratio); // exemple 0.1 : 10% reduction -> if there was 100 triangles, now there will be 90
 	decimate->Update();
 
-	vtkSmartPointer<vtkPolyDataNormals> skinNormals = vtkSmartPointer<vtkPolyDataNormals>::New();
-	skinNormals->SetInputConnection(decimate->GetOutputPort());
-	skinNormals->SetFeatureAngle(60.0);
-	skinNormals->ComputePointNormalsOn();
-	skinNormals->ComputeCellNormalsOff();
-	skinNormals->ConsistencyOff();
-	skinNormals->SplittingOff();
-	skinNormals->Update();
- 
-	vtkSmartPointer<vtkPolyData> decimated = vtkSmartPointer<vtkPolyData>::New();
-	decimated->ShallowCopy(skinNormals->GetOutput());
+	vtkSmartPointer<vtkPolyData> decimated = decimate->GetOutput();
 	
 	this->clear();
 	points = decimated->GetPoints();
-	double *pt, *norm;
+	double *pt;
 	for (vtkIdType i = 0; i<points->GetNumberOfPoints(); i++)
 	{
 		pt = points->GetPoint(i);
-		norm = decimated->GetPointData()->GetNormals()->GetTuple(i);
-		CVector3 p = CVector3(pt[0],pt[1],pt[2]), n = CVector3(norm[0],norm[1],norm[2]);
-		addPoint(new Vertex(p,n,label));
+		addPoint(new Vertex(CVector3(pt[0],pt[1],pt[2]),CVector3(),label));
 	}
 	polys = decimated->GetPolys();
-	vtkSmartPointer<vtkIdList> cells = vtkSmartPointer<vtkIdList>::New();
 	vtkIdType nbTriangle;
 	const vtkIdType* p;
 	for (vtkIdType i = 0; i<polys->GetNumberOfCells(); i++)
@@ -520,6 +602,7 @@ void Mesh::decimation(float nb)
 		polys->GetCell(4*i,nbTriangle,p);
 		addTriangle(p[0],p[1],p[2]);
 	}
+	computeNormals();
  
     if (verbose_) {
         std::cout << "After decimation" << std::endl << "------------" << std::endl;
@@ -568,65 +651,24 @@ void Mesh::subdivision(int numberOfSubdivision, bool computeFinalMesh)
 	#endif
 		subdivisionFilter->Update();
 
-	if (computeFinalMesh)
+	vtkSmartPointer<vtkPolyData> subdivised = subdivisionFilter->GetOutput();
+	this->clear();
+	points = subdivised->GetPoints();
+	double *pt;
+	for (vtkIdType i = 0; i<points->GetNumberOfPoints(); i++)
 	{
-		vtkSmartPointer<vtkPolyDataNormals> skinNormals = vtkSmartPointer<vtkPolyDataNormals>::New();
-		skinNormals->SetInputConnection(subdivisionFilter->GetOutputPort());
-		skinNormals->SetFeatureAngle(60.0);
-		skinNormals->ComputePointNormalsOn();
-		skinNormals->ComputeCellNormalsOff();
-		skinNormals->ConsistencyOff();
-		skinNormals->SplittingOff();
-		skinNormals->Update();
-
-		vtkSmartPointer<vtkPolyData> subdivised = skinNormals->GetOutput();
-
-
-		this->clear();
-		points = subdivised->GetPoints();
-		double *pt, *norm;
-		for (vtkIdType i = 0; i<points->GetNumberOfPoints(); i++)
-		{
-			pt = points->GetPoint(i);
-			norm = subdivised->GetPointData()->GetNormals()->GetTuple(i);
-			CVector3 p = CVector3(pt[0],pt[1],pt[2]), n = CVector3(norm[0],norm[1],norm[2]);
-			addPoint(new Vertex(p,n,label));
-		}
-		polys = subdivised->GetPolys();
-		vtkSmartPointer<vtkIdList> cells = vtkSmartPointer<vtkIdList>::New();
-		vtkIdType nbTriangle;
-		const vtkIdType* p;
-		for (vtkIdType i = 0; i<polys->GetNumberOfCells(); i++)
-		{
-			polys->GetCell(4*i, nbTriangle, p);
-			addTriangle(p[0],p[1],p[2]);
-		}
- 
-		/*std::cout << "After subdivision" << std::endl << "------------" << std::endl;
-		std::cout << "There are " << subdivised->GetNumberOfPoints() << " points." << std::endl;
-		std::cout << "There are " << subdivised->GetNumberOfPolys() << " polygons." << std::endl;*/
+		pt = points->GetPoint(i);
+		addPoint(new Vertex(CVector3(pt[0],pt[1],pt[2]),CVector3(),label));
 	}
-	else
+	polys = subdivised->GetPolys();
+	vtkIdType nbTriangle;
+	const vtkIdType* p;
+	for (vtkIdType i = 0; i<polys->GetNumberOfCells(); i++)
 	{
-		vtkSmartPointer<vtkPolyData> subdivised = subdivisionFilter->GetOutput();
-		this->clear();
-		points = subdivised->GetPoints();
-		double *pt, *norm;
-		for (vtkIdType i = 0; i<points->GetNumberOfPoints(); i++)
-		{
-			pt = points->GetPoint(i);
-			addPoint(new Vertex(pt[0],pt[1],pt[2]));
-		}
-		polys = subdivised->GetPolys();
-		vtkSmartPointer<vtkIdList> cells = vtkSmartPointer<vtkIdList>::New();
-		vtkIdType nbTriangle;
-		const vtkIdType* p;
-		for (vtkIdType i = 0; i<polys->GetNumberOfCells(); i++)
-		{
-			polys->GetCell(4*i,nbTriangle,p);
-			addTriangle(p[0],p[1],p[2]);
-		}
+		polys->GetCell(4*i,nbTriangle,p);
+		addTriangle(p[0],p[1],p[2]);
 	}
+	if (computeFinalMesh) computeNormals();
 }
 
 
@@ -660,37 +702,17 @@ void Mesh::smoothing(int numberOfIterations)
 	smooth->SetNumberOfIterations(numberOfIterations);
 	smooth->Update();
 
-	vtkSmartPointer<vtkPolyDataNormals> skinNormals = vtkSmartPointer<vtkPolyDataNormals>::New();
-	skinNormals->SetInputConnection(smooth->GetOutputPort());
-	skinNormals->SetFeatureAngle(60.0);
-	skinNormals->ComputePointNormalsOn();
-	skinNormals->ComputeCellNormalsOff();
-	skinNormals->ConsistencyOff();
-	skinNormals->SplittingOff();
-	skinNormals->Update();
- 
-	vtkSmartPointer<vtkPolyData> smoothed = vtkSmartPointer<vtkPolyData>::New();
-	smoothed->ShallowCopy(skinNormals->GetOutput());
-	
-	this->clear();
-	points = smoothed->GetPoints();
-	double *pt, *norm;
-	for (vtkIdType i = 0; i<points->GetNumberOfPoints(); i++)
+	// Le lissage ne change pas la topologie : on met a jour les positions sans recreer les points
+	vtkSmartPointer<vtkPoints> smoothedPoints = smooth->GetOutput()->GetPoints();
+	double *pt;
+	for (vtkIdType i = 0; i<smoothedPoints->GetNumberOfPoints(); i++)
 	{
-		pt = points->GetPoint(i);
-		norm = smoothed->GetPointData()->GetNormals()->GetTuple(i);
-		CVector3 p = CVector3(pt[0],pt[1],pt[2]), n = CVector3(norm[0],norm[1],norm[2]);
-		addPoint(new Vertex(p,n,label));
-	}
-	polys = smoothed->GetPolys();
-	vtkSmartPointer<vtkIdList> cells = vtkSmartPointer<vtkIdList>::New();
-	vtkIdType nbTriangle;
-	const vtkIdType* p;
-	for (vtkIdType i = 0; i<polys->GetNumberOfCells(); i++)
-	{
-		polys->GetCell(4*i,nbTriangle,p);
-		addTriangle(p[0],p[1],p[2]);
+		pt = smoothedPoints->GetPoint(i);
+		points_[i]->setPosition(CVector3(pt[0],pt[1],pt[2]));
+		points_[i]->setLabel(label);
 	}
+	pointsModified(0);
+	computeNormals();
 	if (verbose_) cout << " Done" << endl;
 
 	/*cout << "Calcul des connectivites...";
@@ -711,58 +733,86 @@ double Mesh::distanceMean(Mesh *sp)
 }
 
 
+double Mesh::distanceMean(const double* points1, const double* points2, unsigned int nbPoints)
+{
+	if (nbPoints == 0) return 0.0;
+	double result = 0.0, dx, dy, dz;
+	for (unsigned int i=0; i<nbPoints; i++) {
+		dx = points1[3*i]-points2[3*i];
+		dy = points1[3*i+1]-points2[3*i+1];
+		dz = points1[3*i+2]-points2[3*i+2];
+		result += sqrt(dx*dx+dy*dy+dz*dz);
+	}
+	return result/(double)nbPoints;
+}
+
+
 
 void Mesh::computeMeshNormals()
 {
-	int label = getLabel();
-
 	if (verbose_) cout << "Calcul des normales";
-	vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-	for (unsigned int i=0; i<points_.size(); i++)
-		points->InsertNextPoint(points_[i]->getPosition()[0],points_[i]->getPosition()[1],points_[i]->getPosition()[2]);
-	vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
-	for (unsigned int i=0; i<triangles_.size(); i+=3) {
-		vtkIdType pts[3] = {triangles_[i],triangles_[i+1],triangles_[i+2]};
-		polys->InsertNextCell(3,pts);
+	computeNormals();
+	if (verbose_) cout << " Done" << endl;
+}
+
+
+void Mesh::computeNormals()
+{
+	unsigned int nbPoints = points_.size();
+	if (!topology_ || topology_->getNbrOfPoints() != nbPoints || topology_->getNbrOfTriangles() != triangles_.size()/3)
+		computeConnectivity();
+
+	vector<double> positions(3*nbPoints), normals(3*nbPoints);
+	CVector3 p;
+	for (unsigned int i=0; i<nbPoints; i++) {
+		p = points_[i]->getPosition();
+		positions[3*i] = p[0]; positions[3*i+1] = p[1]; positions[3*i+2] = p[2];
 	}
+	computeVertexNormals(&positions[0],triangles_,*topology_,&normals[0]);
+	for (unsigned int i=0; i<nbPoints; i++)
+		points_[i]->setNormal(normals[3*i],normals[3*i+1],normals[3*i+2]);
+}
 
-	vtkSmartPointer<vtkPolyData> pPolyData = vtkSmartPointer<vtkPolyData>::New();
-	pPolyData->SetPoints(points);
-	pPolyData->SetPolys(polys);
 
+/*!
+ * Area-weighted vertex normals (same orientation as vtkPolyDataNormals without consistency and splitting).
+ * Triangle normals are computed in parallel, then each point sums the normals of its triangles in the order of the topology, so the result does not depend on the number of threads.
+ */
+void Mesh::computeVertexNormals(const double* positions, const vector<int>& triangles, const MeshTopology& topology, double* normals)
+{
+	const unsigned int nbTriangles = triangles.size()/3, nbPoints = topology.getNbrOfPoints(), chunk = 4096;
+	vector<double> trianglesNormals(3*nbTriangles);
 
-	vtkSmartPointer<vtkPolyDataNormals> skinNormals = vtkSmartPointer<vtkPolyDataNormals>::New();
-	skinNormals->SetInputData(pPolyData);
-	skinNormals->SetFeatureAngle(60.0);
-	skinNormals->ComputePointNormalsOn();
-	skinNormals->ComputeCellNormalsOff();
-	skinNormals->ConsistencyOff();
-	skinNormals->SplittingOff();
-	skinNormals->Update();
- 
-	vtkSmartPointer<vtkPolyData> output = vtkSmartPointer<vtkPolyData>::New();
-	output->ShallowCopy(skinNormals->GetOutput());
-	
-	this->clear();
-	points = output->GetPoints();
-	double *pt, *norm;
-	for (vtkIdType i = 0; i<points->GetNumberOfPoints(); i++)
+	itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+	threader->ParallelizeArray(0, (nbTriangles+chunk-1)/chunk, [&](itk::SizeValueType c)
 	{
-		pt = points->GetPoint(i);
-		norm = output->GetPointData()->GetNormals()->GetTuple(i);
-		CVector3 p = CVector3(pt[0],pt[1],pt[2]), n = CVector3(norm[0],norm[1],norm[2]);
-		addPoint(new Vertex(p,n,label));
-	}
-	polys = output->GetPolys();
-	vtkSmartPointer<vtkIdList> cells = vtkSmartPointer<vtkIdList>::New();
-	vtkIdType nbTriangle;
-	const vtkIdType* p;
-	for (vtkIdType i = 0; i<polys->GetNumberOfCells(); i++)
+		unsigned int end = min(nbTriangles,(unsigned int)(c+1)*chunk);
+		for (unsigned int t=c*chunk; t<end; t++) {
+			const double *p0 = positions+3*triangles[3*t], *p1 = positions+3*triangles[3*t+1], *p2 = positions+3*triangles[3*t+2];
+			double u[3] = {p1[0]-p0[0],p1[1]-p0[1],p1[2]-p0[2]}, v[3] = {p2[0]-p0[0],p2[1]-p0[1],p2[2]-p0[2]};
+			// Norme du produit vectoriel = 2 x aire du triangle : ponderation par l'aire
+			trianglesNormals[3*t] = u[1]*v[2]-u[2]*v[1];
+			trianglesNormals[3*t+1] = u[2]*v[0]-u[0]*v[2];
+			trianglesNormals[3*t+2] = u[0]*v[1]-u[1]*v[0];
+		}
+	}, nullptr);
+
+	threader->ParallelizeArray(0, (nbPoints+chunk-1)/chunk, [&](itk::SizeValueType c)
 	{
-		polys->GetCell(4*i,nbTriangle,p);
-		addTriangle(p[0],p[1],p[2]);
-	}
-	if (verbose_) cout << " Done" << endl;
+		unsigned int end = min(nbPoints,(unsigned int)(c+1)*chunk);
+		for (unsigned int i=c*chunk; i<end; i++) {
+			double n[3] = {0.0,0.0,0.0};
+			const int* trianglesPoint = topology.getTriangles(i);
+			for (int j=0; j<topology.getNumberOfTriangles(i); j++) {
+				n[0] += trianglesNormals[3*trianglesPoint[j]];
+				n[1] += trianglesNormals[3*trianglesPoint[j]+1];
+				n[2] += trianglesNormals[3*trianglesPoint[j]+2];
+			}
+			double norm = sqrt(n[0]*n[0]+n[1]*n[1]+n[2]*n[2]);
+			if (norm > 0.0) { n[0] /= norm; n[1] /= norm; n[2] /= norm; }
+			normals[3*i] = n[0]; normals[3*i+1] = n[1]; normals[3*i+2] = n[2];
+		}
+	}, nullptr);
 }
 
 
@@ -9,12 +9,14 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 
 #include <itkImage.h>
 #include <vtkSmartPointer.h>
 #include <vtkPolyData.h>
 
 #include "Vertex.h"
+#include "MeshTopology.h"
 #include "../util/Vector3.h"
 #include "referential.h"
 
@@ -42,6 +44,7 @@ public:
 	virtual int addPoint(Vertex *v); // ajoute le point dans le vecteur et retourne sa position
 	virtual int addPointLocal(Vertex *v);
 	virtual void removeLastPoints(int number);
+	void setPositions(const double* positions, unsigned int nbPoints);
 	virtual std::vector<Vertex*>& getListPoints() { return points_; };
 	virtual std::vector<Vertex*>& getListLocalPoints() { return pointsLocal_; };
 	virtual void addTriangle(int p1, int p2, int p3);
@@ -65,23 +68,28 @@ public:
 
 	virtual void setReferential(const Referential& ref, bool local=false);
 	virtual void computeTrianglesBarycentre();
+	void updateTrianglesBarycentre();
 	virtual void transform(CMatrix4x4 transformation);
 	virtual void transform(CMatrix4x4 transformation, CVector3 rotationPoint);
     virtual void localTransform(CMatrix4x4 transformation);
 
 	virtual CMatrix4x4 ICP(Mesh* sp);
+	static CMatrix4x4 rigidAlignment(const double* source, const double* target, unsigned int nbPoints);
 
 	virtual void computeConnectivity();
-	virtual std::vector< std::vector<int> >& getConnectiviteTriangles() { return connectiviteTriangles_; };
-	virtual std::vector< std::vector<int> >& getNeighbors() { return neighbors_; };
+	void updateConnectivity();
+	std::shared_ptr<const MeshTopology> getTopology() const { return topology_; };
 
 	virtual void decimation(float nb);
 	virtual void smoothing(int numberOfIterations);
 	virtual void subdivision(int numberOfSubdivision=1, bool computeFinalMesh=true);
 
 	virtual double distanceMean(Mesh *sp);
+	static double distanceMean(const double* points1, const double* points2, unsigned int nbPoints);
 
 	virtual void computeMeshNormals();
+	void computeNormals();
+	static void computeVertexNormals(const double* positions, const std::vector<int>& triangles, const MeshTopology& topology, double* normals);
     
     virtual double computeStandardDeviationFromPixelsInside(itk::Image<double,3>::Pointer image);
     
@@ -95,13 +103,13 @@ public:
 
 protected:
 	void calculateLocalPoints(CMatrix3x3 rotation, CVector3 translation);
+	virtual void pointsModified(unsigned int firstPoint) {}; // appelee quand les points a partir de firstPoint ont ete deplaces ou supprimes
 
 	std::vector<Vertex*> points_;
 	std::vector<Vertex*> pointsLocal_;
 	std::vector<int> triangles_; // Triangles sous format [T1_p1 T1_p2 T1_p3 T2_p1 ...]
 	std::vector<Vertex*> trianglesBarycentre_;
-	std::vector< std::vector<int> > connectiviteTriangles_; // liste, pour chaque point, des triangles qui le contiennent
-	std::vector< std::vector<int> > neighbors_; // liste, pour chaque point, de ses voisins
+	std::shared_ptr<const MeshTopology> topology_; // pour chaque point, triangles qui le contiennent et voisins (CSR, partage entre les copies)
 
 	int label_;
 
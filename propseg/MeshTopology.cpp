@@ -0,0 +1,96 @@
+#include "MeshTopology.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+MeshTopology::MeshTopology(const vector<int>& triangles, unsigned int nbPoints) : nbPoints_(nbPoints), nbTriangles_(triangles.size()/3)
+{
+	unsigned int nbTriangles = nbTriangles_;
+
+	// Tri par denombrement : nombre de triangles par point, puis sommes cumulees
+	incidenceOffset_.assign(nbPoints_+1,0);
+	for (unsigned int j=0; j<3*nbTriangles; j++)
+		incidenceOffset_[triangles[j]+1]++;
+	for (unsigned int i=0; i<nbPoints_; i++)
+		incidenceOffset_[i+1] += incidenceOffset_[i];
+
+	incidence_.resize(3*nbTriangles+1);
+	vector<int> position(incidenceOffset_.begin(),incidenceOffset_.end()-1);
+	for (unsigned int j=0; j<3*nbTriangles; j++)
+		incidence_[position[triangles[j]]++] = j/3;
+
+	// Voisins : points des triangles contenant i, sans doublons (marqueur du dernier point visite)
+	neighborsOffset_.assign(nbPoints_+1,0);
+	neighbors_.reserve(2*3*nbTriangles+1);
+	vector<int> lastVisit(nbPoints_,-1);
+	int pointCourant;
+	for (unsigned int i=0; i<nbPoints_; i++) {
+		for (int j=incidenceOffset_[i]; j<incidenceOffset_[i+1]; j++) {
+			for (int k=0; k<3; k++) {
+				pointCourant = triangles[3*incidence_[j]+k];
+				if (pointCourant != (int)i && lastVisit[pointCourant] != (int)i) {
+					lastVisit[pointCourant] = i;
+					neighbors_.push_back(pointCourant);
+				}
+			}
+		}
+		neighborsOffset_[i+1] = neighbors_.size();
+	}
+	if (neighbors_.empty()) neighbors_.push_back(-1); // garantit un pointeur valide pour getNeighbors
+}
+
+
+/*!
+ * The new triangles are in the rows of their points only : the rows of the points before the smallest point of the new triangles are unchanged.
+ * For a tube growing by its last disk, only the rows of the last disk and of the new points are rebuilt, whatever the size of the mesh.
+ */
+void MeshTopology::append(const vector<int>& triangles, unsigned int nbPoints)
+{
+	unsigned int nbTriangles = triangles.size()/3;
+	if (nbTriangles == nbTriangles_ && nbPoints == nbPoints_) return;
+
+	unsigned int first = nbPoints_;
+	for (unsigned int j=3*nbTriangles_; j<3*nbTriangles; j++)
+		first = min(first,(unsigned int)triangles[j]);
+
+	// Lignes reconstruites : anciens triangles de la ligne (deja tries) puis nouveaux triangles
+	vector<int> oldOffset(incidenceOffset_.begin()+first,incidenceOffset_.end());
+	vector<int> oldIncidence(incidence_.begin()+incidenceOffset_[first],incidence_.begin()+incidenceOffset_[nbPoints_]);
+	vector<int> count(nbPoints-first,0);
+	for (unsigned int i=first; i<nbPoints_; i++)
+		count[i-first] = oldOffset[i-first+1]-oldOffset[i-first];
+	for (unsigned int j=3*nbTriangles_; j<3*nbTriangles; j++)
+		count[triangles[j]-first]++;
+
+	incidenceOffset_.resize(nbPoints+1);
+	for (unsigned int i=first; i<nbPoints; i++)
+		incidenceOffset_[i+1] = incidenceOffset_[i]+count[i-first];
+	incidence_.resize(incidenceOffset_[nbPoints]+1);
+	vector<int> position(incidenceOffset_.begin()+first,incidenceOffset_.end()-1);
+	for (unsigned int i=first; i<nbPoints_; i++)
+		for (int j=oldOffset[i-first]; j<oldOffset[i-first+1]; j++)
+			incidence_[position[i-first]++] = oldIncidence[j-oldOffset[0]];
+	for (unsigned int j=3*nbTriangles_; j<3*nbTriangles; j++)
+		incidence_[position[triangles[j]-first]++] = j/3;
+
+	// Voisins des lignes reconstruites, dans le meme ordre que le constructeur (les lignes sont courtes, la recherche des doublons est lineaire)
+	neighbors_.resize(neighborsOffset_[first]);
+	neighborsOffset_.resize(nbPoints+1);
+	int pointCourant;
+	for (unsigned int i=first; i<nbPoints; i++) {
+		for (int j=incidenceOffset_[i]; j<incidenceOffset_[i+1]; j++) {
+			for (int k=0; k<3; k++) {
+				pointCourant = triangles[3*incidence_[j]+k];
+				if (pointCourant != (int)i && find(neighbors_.begin()+neighborsOffset_[i],neighbors_.end(),pointCourant) == neighbors_.end())
+					neighbors_.push_back(pointCourant);
+			}
+		}
+		neighborsOffset_[i+1] = neighbors_.size();
+	}
+	if (neighbors_.empty()) neighbors_.push_back(-1); // garantit un pointeur valide pour getNeighbors
+
+	nbPoints_ = nbPoints;
+	nbTriangles_ = nbTriangles;
+}
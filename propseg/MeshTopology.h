@@ -0,0 +1,45 @@
+#ifndef __MESH_TOPOLOGY__
+#define __MESH_TOPOLOGY__
+
+/*!
+ * \file MeshTopology.h
+ * \brief Compressed (CSR) topology of a triangular mesh
+ * \author Benjamin De Leener - NeuroPoly (http://www.neuropoly.info)
+ */
+
+#include <vector>
+
+/*!
+ * \class MeshTopology
+ * \brief Compressed sparse row storage of the triangles containing each point and of the neighbors of each point.
+ *
+ * The triangles containing point i are incidence_[incidenceOffset_[i]] ... incidence_[incidenceOffset_[i+1]-1], in increasing order.
+ * The neighbors of point i are stored the same way, in order of first appearance in the triangles containing i.
+ * Both tables are built in O(number of triangles) by counting sort. The topology is shared (read-only) between a mesh, its copies and the cost functions.
+ * A mesh that only grows (propagation) can update its own topology with append(): only the rows of the points touched by the new triangles are rebuilt.
+ */
+class MeshTopology
+{
+public:
+	MeshTopology(const std::vector<int>& triangles, unsigned int nbPoints);
+	~MeshTopology() {};
+
+	//! Add the triangles of triangles after getNbrOfTriangles() and the points after getNbrOfPoints(). The result is identical to a complete construction.
+	void append(const std::vector<int>& triangles, unsigned int nbPoints);
+
+	unsigned int getNbrOfPoints() const { return nbPoints_; };
+	unsigned int getNbrOfTriangles() const { return nbTriangles_; };
+
+	int getNumberOfTriangles(int point) const { return incidenceOffset_[point+1]-incidenceOffset_[point]; };
+	const int* getTriangles(int point) const { return &incidence_[0]+incidenceOffset_[point]; };
+
+	int getNumberOfNeighbors(int point) const { return neighborsOffset_[point+1]-neighborsOffset_[point]; };
+	const int* getNeighbors(int point) const { return &neighbors_[0]+neighborsOffset_[point]; };
+
+private:
+	unsigned int nbPoints_, nbTriangles_;
+	std::vector<int> incidenceOffset_, incidence_;
+	std::vector<int> neighborsOffset_, neighbors_;
+};
+
+#endif
@@ -4,6 +4,7 @@
 
 #include "Orientation.h"
 #include "referential.h"
+#include "HoughPeaks.h"
 #include "itkHoughTransform2DCirclesImageFilter.h"
 #include <itkExtractImageFilter.h>
 #include <itkResampleImageFilter.h>
@@ -191,22 +192,30 @@ bool Orientation::computeOrientation(double &distance)
 
 void Orientation::searchCenters(ImageType2D::Pointer im, vector<CVector3> &center, vector<double> &radius, vector<double> &accumulator, float z, CVector3 c)
 {
-    typedef itk::ImageDuplicator< ImageType2D > DuplicatorType;
-	DuplicatorType::Pointer duplicator = DuplicatorType::New();
-	duplicator->SetInputImage(im);
-	duplicator->Update();
-	ImageType2D::Pointer clonedOutput = duplicator->GetOutput();
+    typedef itk::MinimumMaximumImageCalculator<ImageType2D> MinMaxCalculatorType;
+	MinMaxCalculatorType::Pointer minMaxCalculator = MinMaxCalculatorType::New();
+	minMaxCalculator->SetImage(im);
+	minMaxCalculator->ComputeMaximum();
+	minMaxCalculator->ComputeMinimum();
+	ImageType2D::PixelType maxIm = minMaxCalculator->GetMaximum(), minIm = minMaxCalculator->GetMinimum();
+    
+    // Spinal cord (inward votes, radius 1 to 7) and CSF around it (outward votes, radius 5 to 11) in the same Hough transform
+    typedef itk::HoughTransform2DCirclesImageFilter< double, double > HoughCirclesFilter;
+	HoughCirclesFilter::Pointer houghfilter = HoughCirclesFilter::New();
+	houghfilter->SetInput(im);
+	houghfilter->SetMinimumRadius(4.0-3.0);
+	houghfilter->SetMaximumRadius(4.0+3.0);
+	houghfilter->SetGradientFactor(-1.0*typeImageFactor_);
+	houghfilter->SetSecondaryRadii(8.0-3.0,8.0+3.0,1.0*typeImageFactor_);
+	houghfilter->SetSigmaGradient(2);
+	houghfilter->SetSweepAngle(M_PI/180.0*5.0);
+	houghfilter->SetThreshold((maxIm-minIm)/20.0);
+	houghfilter->Update();
     
     unsigned int numberOfCircles = 15;
-	double **center_result_small = new double*[numberOfCircles], **center_result_large = new double*[numberOfCircles];
-	for (unsigned int k=0; k<numberOfCircles; k++) {
-		center_result_small[k] = new double[2];
-		center_result_large[k] = new double[2];
-	}
-	double *radius_result_small = new double[numberOfCircles], *radius_result_large = new double[numberOfCircles];
-	double *accumulator_result_small = new double[numberOfCircles], *accumulator_result_large = new double[numberOfCircles];
-	unsigned int numSmall = houghTransformCircles(im,numberOfCircles,center_result_small,radius_result_small,accumulator_result_small,4.0,-1.0);
-	unsigned int numLarge = houghTransformCircles(clonedOutput,numberOfCircles,center_result_large,radius_result_large,accumulator_result_large,4.0+4.0,1.0);
+	vector<HoughPeaks::Peak> circlesSmall, circlesLarge;
+	unsigned int numSmall = HoughPeaks::extract(houghfilter->GetOutput(),houghfilter->GetRadiusImage(),numberOfCircles,circlesSmall);
+	unsigned int numLarge = HoughPeaks::extract(houghfilter->GetSecondaryAccumulator(),houghfilter->GetSecondaryRadiusImage(),numberOfCircles,circlesLarge);
     
 	// search along results for nested circles
 	vector<unsigned int> listMostPromisingCenters;
@@ -217,8 +226,8 @@ void Orientation::searchCenters(ImageType2D::Pointer im, vector<CVector3> &cente
 		for (unsigned int j=0; j<numLarge; j++)
 		{
 			// distance between center + small_radius must be smaller than large_radius
-			distance = sqrt(pow(center_result_small[i][0]-center_result_large[j][0],2)+pow(center_result_small[i][1]-center_result_large[j][1],2));
-			if ((distance+radius_result_small[i])*0.8 <= radius_result_large[j]) {
+			distance = sqrt(pow(circlesSmall[i].center[0]-circlesLarge[j].center[0],2)+pow(circlesSmall[i].center[1]-circlesLarge[j].center[1],2));
+			if ((distance+circlesSmall[i].radius)*0.8 <= circlesLarge[j].radius) {
 				listMostPromisingCenters.push_back(i);
 				listMostPromisingCentersLarge.push_back(j);
 			}
@@ -227,7 +236,8 @@ void Orientation::searchCenters(ImageType2D::Pointer im, vector<CVector3> &cente
     map< double,CVector3,greater<double> > centers;
 	for (unsigned int i=0; i<listMostPromisingCenters.size(); i++)
 	{
-		centers[accumulator_result_small[listMostPromisingCenters[i]]] = CVector3(center_result_small[listMostPromisingCenters[i]][0],z,center_result_small[listMostPromisingCenters[i]][1]);
+		const HoughPeaks::Peak& peak = circlesSmall[listMostPromisingCenters[i]];
+		centers[peak.accumulator] = CVector3(peak.center[0],z,peak.center[1]);
 	}
     
     for (int l=0; l<3; l++ ) {
@@ -239,129 +249,3 @@ void Orientation::searchCenters(ImageType2D::Pointer im, vector<CVector3> &cente
         }
     }
 }
-
-
-unsigned int Orientation::houghTransformCircles(ImageType2D* im, unsigned int numberOfCircles, double** center_result, double* radius_result, double* accumulator_result, double meanRadius, double valPrint)
-{
-    typedef itk::MinimumMaximumImageCalculator<ImageType2D> MinMaxCalculatorType;
-	MinMaxCalculatorType::Pointer minMaxCalculator = MinMaxCalculatorType::New();
-	minMaxCalculator->SetImage(im);
-	minMaxCalculator->ComputeMaximum();
-	minMaxCalculator->ComputeMinimum();
-	ImageType2D::PixelType maxIm = minMaxCalculator->GetMaximum(), minIm = minMaxCalculator->GetMinimum();
-	double val_Print = maxIm;
-    
-    double min_radius = meanRadius-3.0;
-    if (min_radius < 0) min_radius = 0;
-	
-    typedef itk::HoughTransform2DCirclesImageFilter< double, double > HoughCirclesFilter;
-	HoughCirclesFilter::Pointer houghfilter = HoughCirclesFilter::New();
-	houghfilter->SetInput(im);
-	houghfilter->SetMinimumRadius(min_radius);
-	houghfilter->SetMaximumRadius(meanRadius+3.0);
-	houghfilter->SetSigmaGradient(2);
-	houghfilter->SetGradientFactor(valPrint*typeImageFactor_);
-	houghfilter->SetSweepAngle(M_PI/180.0*5.0);
-	houghfilter->SetThreshold((maxIm-minIm)/20.0);
-	houghfilter->Update();
-	
-    
-	const double nPI = 4.0 * std::atan( 1.0 );
-	ImageType2D::IndexType index;
-    
-	ImageType2D::Pointer m_Accumulator= houghfilter->GetOutput();
-    
-	ImageType2D::Pointer m_RadiusImage= houghfilter->GetRadiusImage();
-    
-	/** Blur the accumulator in order to find the maximum */
-	ImageType2D::Pointer m_PostProcessImage = ImageType2D::New();
-    typedef itk::DiscreteGaussianImageFilter<ImageType2D,ImageType2D> GaussianFilterType;
-	GaussianFilterType::Pointer gaussianFilter = GaussianFilterType::New();
-	gaussianFilter->SetInput(m_Accumulator);
-	double variance[2];
-	variance[0]=10;
-	variance[1]=10;
-	gaussianFilter->SetVariance(variance);
-	gaussianFilter->SetMaximumError(.01f);
-	gaussianFilter->Update();
-	m_PostProcessImage = gaussianFilter->GetOutput();
-    
-    ImageType2D::IndexType start = m_PostProcessImage->GetLargestPossibleRegion().GetIndex();
-	ImageType2D::SizeType bound = m_PostProcessImage->GetLargestPossibleRegion().GetSize();
-    
-	itk::ImageRegionIterator<ImageType2D> it_output(im,im->GetLargestPossibleRegion());
-	itk::ImageRegionIterator<ImageType2D> it_input(m_PostProcessImage,m_PostProcessImage->GetLargestPossibleRegion());
-    
-    
-	/** Set the disc ratio */
-	double discRatio = 1.1;
-    
-	/** Search for maxima */
-	unsigned int circles=0, maxIteration=100, it=0;
-	do {
-		it++;
-		minMaxCalculator->SetImage(m_PostProcessImage);
-		minMaxCalculator->ComputeMaximum();
-		ImageType2D::PixelType max = minMaxCalculator->GetMaximum();
-        
-		it_output.GoToBegin();
-		for(it_input.GoToBegin();!it_input.IsAtEnd();++it_input)
-		{
-			if(it_input.Get() == max)
-			{
-				it_output.Set(val_Print);
-				index = it_output.GetIndex();
-				double radius2 = m_RadiusImage->GetPixel(index);
-				if (index[0]!=start[0] && index[0]!=start[0]+bound[0]-1 && index[1]!=start[1] && index[1]!=start[1]+bound[1]-1)
-				{
-					center_result[circles][0] = it_output.GetIndex()[0];
-					center_result[circles][1] = it_output.GetIndex()[1];
-					radius_result[circles] = radius2;
-					accumulator_result[circles] = m_PostProcessImage->GetPixel(index);
-                    
-					// Draw the circle
-					for(double angle = 0; angle <= 2 * nPI; angle += nPI / 1000)
-					{
-						index[0] = (long int)(it_output.GetIndex()[0] + radius2 * cos(angle));
-						index[1] = (long int)(it_output.GetIndex()[1] + radius2 * sin(angle));
-						if (index[0]>=start[0] && index[0]<start[0]+bound[0] && index[1]>=start[1] && index[1]<start[1]+bound[1])
-							im->SetPixel(index,val_Print);
-                        
-						// Remove the maximum from the accumulator
-						for(double length = 0; length < discRatio*radius2;length+=1)
-						{
-							index[0] = (long int)(it_output.GetIndex()[0] + length * cos(angle));
-							index[1] = (long int)(it_output.GetIndex()[1] + length* sin(angle));
-							if (index[0]>=start[0] && index[0]<start[0]+bound[0] && index[1]>=start[1] && index[1]<start[1]+bound[1])
-								m_PostProcessImage->SetPixel(index,0);
-						}
-					}
-					circles++;
-					if(circles == numberOfCircles) break;
-				}
-				else
-				{
-					// Draw the circle
-					for(double angle = 0; angle <= 2 * nPI; angle += nPI / 1000)
-					{
-						// Remove the maximum from the accumulator
-						for(double length = 0; length < discRatio*radius2;length+=1)
-						{
-							index[0] = (long int)(it_output.GetIndex()[0] + length * cos(angle));
-							index[1] = (long int)(it_output.GetIndex()[1] + length* sin(angle));
-							if (index[0]>=start[0] && index[0]<start[0]+bound[0] && index[1]>=start[1] && index[1]<start[1]+bound[1])
-								m_PostProcessImage->SetPixel(index,0);
-						}
-					}
-				}
-				minMaxCalculator->SetImage(m_PostProcessImage);
-				minMaxCalculator->ComputeMaximum();
-				max = minMaxCalculator->GetMaximum();
-			}
-			++it_output;
-		}
-	}
-	while(circles<numberOfCircles && it<=maxIteration);
-    
-	return circles;
-}
@@ -40,7 +40,6 @@ public:
     
 private:
     void searchCenters(ImageType2D::Pointer im, std::vector<CVector3> &center, std::vector<double> &radius, std::vector<double> &accumulator, float z, CVector3 c);
-	unsigned int houghTransformCircles(ImageType2D* im, unsigned int numberOfCircles, double** center_result, double* radius_result, double* accumulator_result, double meanRadius, double valPrint=255);
     
 	Image3D* image_;
 	SpinalCord* mesh_;
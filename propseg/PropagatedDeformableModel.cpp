@@ -9,6 +9,9 @@
 #include <sstream>
 #include <string>
 #include <time.h>
+#include <thread>
+#include <exception>
+#include <memory>
 
 #include "PropagatedDeformableModel.h"
 #include "DeformableModelBasicAdaptator.h"
@@ -18,6 +21,8 @@
 #include "foncteurPlan.h"
 #include "BSplineApproximation.h"
 
+#include <itkMultiThreaderBase.h>
+
 using namespace std;
 
 PropagatedDeformableModel::PropagatedDeformableModel()
@@ -51,6 +56,25 @@ PropagatedDeformableModel::PropagatedDeformableModel()
 	
 	range = 500;
 
+	adaptiveAxialStep_ = false;
+	minAxialStep_ = 0.5*deplacementAxial_;
+	maxAxialStep_ = 2.0*deplacementAxial_;
+	maxTurnAngle_ = 5.0;
+
+	checkpointInterval_ = 0;
+	hasResumeCheckpoint_[0] = false; hasResumeCheckpoint_[1] = false;
+
+	coarseToFineRefinement_ = false;
+	partitionedRefinement_ = false;
+	hasAxialBounds_ = false;
+	lowerAxialBound_ = 0.0;
+	upperAxialBound_ = 0.0;
+	refinementSegments_ = 0;
+	refinementOverlap_ = 5;
+	rotationGridResolution_ = 0;
+	rotationCandidates_ = 3;
+	rotationSearchThreads_ = 0;
+
 	tradeoff_d_bool = false;
 	tradeoff_d_ = 0.0;
 
@@ -89,6 +113,25 @@ PropagatedDeformableModel::PropagatedDeformableModel(int resolutionRadiale, int
 	
 	range = 500;
 
+	adaptiveAxialStep_ = false;
+	minAxialStep_ = 0.5*deplacementAxial_;
+	maxAxialStep_ = 2.0*deplacementAxial_;
+	maxTurnAngle_ = 5.0;
+
+	checkpointInterval_ = 0;
+	hasResumeCheckpoint_[0] = false; hasResumeCheckpoint_[1] = false;
+
+	coarseToFineRefinement_ = false;
+	partitionedRefinement_ = false;
+	hasAxialBounds_ = false;
+	lowerAxialBound_ = 0.0;
+	upperAxialBound_ = 0.0;
+	refinementSegments_ = 0;
+	refinementOverlap_ = 5;
+	rotationGridResolution_ = 0;
+	rotationCandidates_ = 3;
+	rotationSearchThreads_ = 0;
+
 	tradeoff_d_bool = false;
 	tradeoff_d_ = 0.0;
 
@@ -120,6 +163,24 @@ void PropagatedDeformableModel::setUpAndDownLimits(int downLimit, int upLimit)
 }
 
 
+// Limites physiques de la propagation le long d'un axe (position = point*axis), independantes de l'orientation de l'image
+void PropagatedDeformableModel::setAxialBounds(CVector3 axis, double lowerBound, double upperBound)
+{
+	hasAxialBounds_ = true;
+	axialBoundsAxis_ = axis;
+	lowerAxialBound_ = lowerBound;
+	upperAxialBound_ = upperBound;
+}
+
+
+bool PropagatedDeformableModel::insideAxialBounds(const CVector3& point)
+{
+	if (!hasAxialBounds_) return true;
+	double position = point*axialBoundsAxis_;
+	return position >= lowerAxialBound_ && position <= upperAxialBound_;
+}
+
+
 void PropagatedDeformableModel::computeMeshInitial()
 {
 	// centerline can be added to be followed. Points of centerline have to be added from bottom to top
@@ -174,7 +235,7 @@ void PropagatedDeformableModel::computeMeshInitial()
 
 		isMeshInitialized = true;
 
-		meanContrast = computeContrast(refInitial);
+		meanContrast = computeContrast(refInitial,image3D_);
 		//cout << "Contrast = " << contrast << endl;
 	}
 	else if (hasInitialPointAndNormals_) {
@@ -233,7 +294,7 @@ void PropagatedDeformableModel::computeMeshInitial()
 
 		isMeshInitialized = true;
 
-		meanContrast = computeContrast(refInitial);
+		meanContrast = computeContrast(refInitial,image3D_);
 	}
 	else {
 		initialTube1 = new SpinalCord;
@@ -266,7 +327,7 @@ void PropagatedDeformableModel::computeMeshInitial()
 }
 
 
-float PropagatedDeformableModel::computeContrast(Referential& refInitial)
+float PropagatedDeformableModel::computeContrast(Referential& refInitial, Image3D* image)
 {
 	// Calcul du profil de la moelle et du LCR perpendiculairement au tube
 	CVector3 pointS, indexS;
@@ -274,7 +335,7 @@ float PropagatedDeformableModel::computeContrast(Referential& refInitial)
 	float angle;
 	CMatrix3x3 trZ;
 	CMatrix4x4 transformationFromOrigin = refInitial.getTransformationInverse();
-	float factor = image3D_->getTypeImageFactor();
+	float factor = image->getTypeImageFactor();
 	for (int k=0; k<resolutionRadiale_; k++)
 	{
 		vector<float> profilIntensite;
@@ -282,8 +343,8 @@ float PropagatedDeformableModel::computeContrast(Referential& refInitial)
 		trZ[0] = cos(angle), trZ[1] = sin(angle), trZ[3] = -sin(angle), trZ[4] = cos(angle);
 		for (int l=0; l<2.5*rayon_; l++) {
 			pointS = transformationFromOrigin*(trZ*CVector3(l,0.0,0.0));
-			if (image3D_->TransformPhysicalPointToIndex(pointS,indexS))
-				profilIntensite.push_back(factor*image3D_->GetPixelOriginal(indexS));
+			if (image->TransformPhysicalPointToIndex(pointS,indexS))
+				profilIntensite.push_back(factor*image->GetPixelOriginal(indexS));
 		}
 		float min = 0.0, max = 0.0, maxVal = 0.0, valCourante;
 		unsigned int m = 0;
@@ -374,130 +435,194 @@ void PropagatedDeformableModel::adaptationGlobale()
 				upLimit = up[1]+2;
 			}
 		
-			SpinalCord *mesh1 = propagationMesh(1);
-			SpinalCord *mesh2 = propagationMesh(2);
+			/******************************************************************************************
+			 * Both directions start from independent initial tubes and only meet at the merging step: they are propagated at the same time on two threads.
+			 * Each direction has its own context, including its own copy of the image (the image buffers are shared, the interpolators are not).
+			 *****************************************************************************************/
+			Image3D image1(*image3D_), image2(*image3D_);
+			PropagationContext context1(&image1, contrast, centerline), context2(&image2);
+			initializeContext(1,context1);
+			initializeContext(2,context2);
+			SpinalCord *mesh1 = 0, *mesh2 = 0;
+			exception_ptr error1, error2;
+			thread propagation1([&]() {
+				try { mesh1 = propagationMesh(1,context1); }
+				catch (...) { error1 = current_exception(); }
+			});
+			try { mesh2 = propagationMesh(2,context2); }
+			catch (...) { error2 = current_exception(); }
+			propagation1.join();
+			if (error1) rethrow_exception(error1);
+			if (error2) rethrow_exception(error2);
+			storeCheckpoints(1,context1);
+			storeCheckpoints(2,context2);
+
 			// meshes merging
 			meshOutput = mergeBidirectionalSpinalCord(mesh1,mesh2);
+			delete mesh1;
+			delete mesh2;
+
+			// the contrast vector is ordered from the end of the first mesh to the end of the second mesh, as the merged mesh
+			contrast.assign(context1.contrast.rbegin(),context1.contrast.rend());
+			contrast.insert(contrast.end(),context2.contrast.begin(),context2.contrast.end());
+			centerline = meshOutput->computeCenterline();
+			meanContrast = context2.meanContrast;
+		}
+		else // unidirectional propagation
+		{
+			PropagationContext context(image3D_, contrast, centerline);
+			initializeContext(1,context);
+			meshOutput = propagationMesh(1,context);
+			storeCheckpoints(1,context);
+			contrast = context.contrast;
+			centerline = context.centerline;
+			meanContrast = context.meanContrast;
 		}
-		else propagationMesh(); // unidirectional propagation
 	}
 	else {
 		cout << "Error: The initial mesh is not initialized" << endl;
 	}
 }
 
+void PropagatedDeformableModel::resumeFromCheckpoint(const PropagationCheckpoint& checkpoint)
+{
+	if (checkpoint.direction != 1 && checkpoint.direction != 2) {
+		cerr << "Error: wrong propagation direction in checkpoint : " << checkpoint.direction << endl;
+		return;
+	}
+	resumeCheckpoint_[checkpoint.direction-1] = checkpoint;
+	hasResumeCheckpoint_[checkpoint.direction-1] = true;
+}
+
+bool PropagatedDeformableModel::resumeFromCheckpoint(string filename)
+{
+	PropagationCheckpoint checkpoint;
+	if (!checkpoint.load(filename)) return false;
+	resumeFromCheckpoint(checkpoint);
+	return true;
+}
+
+// Reprise eventuelle a partir d'un checkpoint. Les checkpoints precedant la reprise sont conserves pour pouvoir reprendre a nouveau plus tot.
+void PropagatedDeformableModel::initializeContext(int direction, PropagationContext& context)
+{
+	if (!hasResumeCheckpoint_[direction-1]) return;
+	context.resume = &resumeCheckpoint_[direction-1];
+	const vector<PropagationCheckpoint>& previous = checkpoints_[direction-1];
+	for (unsigned int k=0; k<previous.size() && previous[k].step <= context.resume->step; k++)
+		context.checkpoints.push_back(previous[k]);
+}
+
+void PropagatedDeformableModel::storeCheckpoints(int direction, PropagationContext& context)
+{
+	checkpoints_[direction-1].swap(context.checkpoints);
+}
+
 SpinalCord* PropagatedDeformableModel::mergeBidirectionalSpinalCord(SpinalCord* spinalCord1, SpinalCord* spinalCord2)
 {
+	// Both meshes start from the same disk: the first mesh is added backward, then the second mesh without its first disk
+	vector<SpinalCord*> pieces(2);
+	pieces[0] = spinalCord1; pieces[1] = spinalCord2;
 	int radialResolution = spinalCord1->getRadialResolution();
+	vector<int> firstDisk(2), lastDisk(2);
+	firstDisk[0] = 0; lastDisk[0] = spinalCord1->getNbrOfPoints()/radialResolution-1;
+	firstDisk[1] = 1; lastDisk[1] = spinalCord2->getNbrOfPoints()/radialResolution-1;
+	vector<bool> reversed(2);
+	reversed[0] = true; reversed[1] = false;
+	return mergeSpinalCordPieces(pieces,firstDisk,lastDisk,reversed);
+}
+
+/*!
+ * Assembling of pieces of spinal cord meshes with the same radial resolution. The disks firstDisk[i] to lastDisk[i] of each piece are added in order,
+ * backward if reversed[i] (the points of each disk are then also reversed to keep the orientation of the triangles).
+ * Each piece is rotated around its axis so that its first point is the nearest to the first point of the last disk already added, and a band of triangles links them.
+ */
+SpinalCord* PropagatedDeformableModel::mergeSpinalCordPieces(const vector<SpinalCord*>& pieces, const vector<int>& firstDisk, const vector<int>& lastDisk, const vector<bool>& reversed)
+{
+	int radialResolution = pieces[0]->getRadialResolution();
 	SpinalCord* mesh = new SpinalCord();
 	mesh->setRadialResolution(radialResolution);
 
-	// Adding first mesh
-	unsigned int numberOfPoints = spinalCord1->getNbrOfPoints(), numberOfTriangles = spinalCord2->getNbrOfTriangles();
-	int numberOfDisk = numberOfPoints/radialResolution;
-	vector<Vertex*> listPoints1 = spinalCord1->getListPoints();
-	// Ajout du premier disque
-	for (int j=0; j<radialResolution; j++)
+	for (unsigned int p=0; p<pieces.size(); p++)
 	{
-		mesh->addPoint(new Vertex(*listPoints1[numberOfDisk*radialResolution-1-j]));//(numberOfDisk-1)*radialResolution+j]));
-	}
-	// Ajout des suivants
-	for (int i=1; i<numberOfDisk; i++)
-	{
-		for (int j=0; j<radialResolution; j++)
-		{
-			mesh->addPoint(new Vertex(*listPoints1[(numberOfDisk-i)*radialResolution-1-j]));//(numberOfDisk-1-i)*radialResolution+j]));
-		}
-		// Ajout des triangles - attention � la structure en cercle
-		for (int k=0; k<radialResolution-1; k++)
-		{
-			mesh->addTriangle((i-1)*radialResolution+k,(i-1)*radialResolution+k+1,i*radialResolution+k);
-			mesh->addTriangle((i-1)*radialResolution+k+1,i*radialResolution+k+1,i*radialResolution+k);
-		}
-		// Ajout des deux derniers triangles pour fermer le tube
-		mesh->addTriangle((i-1)*radialResolution+radialResolution-1,(i-1)*radialResolution,i*radialResolution+radialResolution-1);
-		mesh->addTriangle((i-1)*radialResolution,i*radialResolution,i*radialResolution+radialResolution-1);
-	}
+		vector<Vertex*> listPoints = pieces[p]->getListPoints();
+		int numberOfDisk = listPoints.size()/radialResolution;
+		int step = 1, start = firstDisk[p], end = lastDisk[p];
+		if (reversed[p]) { step = -1; start = lastDisk[p]; end = firstDisk[p]; }
+		bool backward = reversed[p];
+		auto pointIndex = [radialResolution,backward](int disk, int j) { return backward ? disk*radialResolution+radialResolution-1-j : disk*radialResolution+j; };
 
-	// Adding second mesh
-	numberOfPoints = spinalCord2->getNbrOfPoints(), numberOfTriangles = spinalCord2->getNbrOfTriangles();
-	numberOfDisk = numberOfPoints/radialResolution;
-	vector<Vertex*> listPoints2 = spinalCord2->getListPoints();
-	int offsetTriangles = mesh->getNbrOfPoints()-radialResolution;
-	// Points between meshes need offset to adjust properly triangles
-	double distanceMin = 10000.0, dist;
-	int indexMin = 0;
-	Vertex* point = mesh->getListPoints()[offsetTriangles];
-	for (int m=0; m<radialResolution; m++)
-	{
-		dist = point->distance(*listPoints2[m]);
-		if (dist < distanceMin) {
-			distanceMin = dist;
-			indexMin = m;
-		}
-	}
-	// Ajout des suivants
-	for (int i=1; i<numberOfDisk; i++)
-	{
-		for (int j=0; j<radialResolution; j++)
+		// Points between meshes need offset to adjust properly triangles. The disk of the piece just before the junction is used if it exists.
+		int indexMin = 0;
+		if (mesh->getNbrOfPoints() != 0)
 		{
-			mesh->addPoint(new Vertex(*listPoints2[i*radialResolution+(j+indexMin)%radialResolution]));
+			int alignmentDisk = start-step;
+			if (alignmentDisk < 0 || alignmentDisk >= numberOfDisk) alignmentDisk = start;
+			double distanceMin = 10000.0, dist;
+			Vertex* point = mesh->getListPoints()[mesh->getNbrOfPoints()-radialResolution];
+			for (int m=0; m<radialResolution; m++)
+			{
+				dist = point->distance(*listPoints[pointIndex(alignmentDisk,m)]);
+				if (dist < distanceMin) {
+					distanceMin = dist;
+					indexMin = m;
+				}
+			}
 		}
-		// Ajout des triangles - attention � la structure en cercle
-		for (int k=0; k<radialResolution-1; k++)
+
+		for (int i=start; i!=end+step; i+=step)
 		{
-			mesh->addTriangle(offsetTriangles+(i-1)*radialResolution+k,offsetTriangles+(i-1)*radialResolution+k+1,offsetTriangles+i*radialResolution+k);
-			mesh->addTriangle(offsetTriangles+(i-1)*radialResolution+k+1,offsetTriangles+i*radialResolution+k+1,offsetTriangles+i*radialResolution+k);
+			int offsetPoint = mesh->getNbrOfPoints();
+			for (int j=0; j<radialResolution; j++)
+				mesh->addPoint(new Vertex(*listPoints[pointIndex(i,(j+indexMin)%radialResolution)]));
+			if (offsetPoint == 0) continue;
+			int offsetTriangles = offsetPoint-radialResolution;
+			// Ajout des triangles - attention a la structure en cercle
+			for (int k=0; k<radialResolution-1; k++)
+			{
+				mesh->addTriangle(offsetTriangles+k,offsetTriangles+k+1,offsetPoint+k);
+				mesh->addTriangle(offsetTriangles+k+1,offsetPoint+k+1,offsetPoint+k);
+			}
+			// Ajout des deux derniers triangles pour fermer le tube
+			mesh->addTriangle(offsetTriangles+radialResolution-1,offsetTriangles,offsetPoint+radialResolution-1);
+			mesh->addTriangle(offsetTriangles,offsetPoint,offsetPoint+radialResolution-1);
 		}
-		// Ajout des deux derniers triangles pour fermer le tube
-		mesh->addTriangle(offsetTriangles+(i-1)*radialResolution+radialResolution-1,offsetTriangles+(i-1)*radialResolution,offsetTriangles+i*radialResolution+radialResolution-1);
-		mesh->addTriangle(offsetTriangles+(i-1)*radialResolution,offsetTriangles+i*radialResolution,offsetTriangles+i*radialResolution+radialResolution-1);
 	}
 	return mesh;
 }
 
-SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
+/*!
+ * Objects used by each step of the propagation in one direction. They are created once by propagationMesh() and reset between steps instead of being
+ * allocated and released at each step: the deformed part of mesh and the result of its deformation keep their vertices and connectivity,
+ * the adaptators keep their cost functions, buffers and gaussian regions.
+ */
+struct PropagationWorkspace
+{
+	PropagationWorkspace(Image3D* image, int numberOfDeformIteration): globalAdaptation(image,0,"rotation"), deformableAdaptator(image,&partMesh,numberOfDeformIteration,0.0,false)
+	{
+		deformableAdaptator.setOutputMesh(&deformedMesh);
+	};
+	~PropagationWorkspace()
+	{
+		partMesh.clear();
+		deformedMesh.clear();
+	};
+
+	SpinalCord partMesh; // dernier disque de la segmentation suivi du maillage duplique
+	SpinalCord deformedMesh; // resultat de la deformation de partMesh
+	GlobalAdaptation globalAdaptation;
+	DeformableModelBasicAdaptator deformableAdaptator;
+};
+
+
+/*!
+ * Propagation of the mesh in one direction. All the state modified during the propagation (image interpolators, contrast, areas, output mesh and centerline) is in context,
+ * so that both directions can run at the same time on different threads. The other members of the class are only read.
+ */
+SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh, PropagationContext& context)
 {
 	double const_contrast = 200.0;
-	if (image3D_->getTypeImageFactor() == 1.0) const_contrast = 445.0; // if T2
+	if (context.image->getTypeImageFactor() == 1.0) const_contrast = 445.0; // if T2
 	
-	/******************************************************************************************
-	 * Initialization of the spinal cord mesh
-	 * Depending of the choice of propagation, the contrast vector is reversed to take the correct values
-	 *****************************************************************************************/
-	SpinalCord* initialMesh = new SpinalCord();
-	if (numberOfMesh == 1) initialMesh = initialTube1;
-	else if (numberOfMesh == 2) {
-		reverse(contrast.begin(),contrast.end());
-		initialMesh = initialTube2;
-	}
-	vector< vector<CVector3> > lastDisks;
-		
-	/******************************************************************************************
-	 * Deformation of the initial mesh.
-	 * This deformation must be accurate to have a correct initialization. If not, errors can be propagated.
-	 * The number of iteration and the stop condition of the deformation is 0.05 mm by default
-	 *****************************************************************************************/
-	if (verbose_) cout << endl << endl << "Initial deformation : " << initialMesh->getNbrOfPoints() << " points and " << initialMesh->getNbrOfTriangles() << " triangles" << endl;
-	DeformableModelBasicAdaptator *deformableAdaptator = new DeformableModelBasicAdaptator(image3D_,initialMesh,numberOfDeformIteration_,const_contrast,false);
-	deformableAdaptator->setVerbose(verbose_);
-	deformableAdaptator->setNumberOfIteration(8); //8
-	deformableAdaptator->setStopCondition(0.05);
-	if (tradeoff_d_bool) deformableAdaptator->setTradeOff(tradeoff_d_);
-	//deformableAdaptator->setProgressiveLineSearchLength(true);// tested but not optimal
-	deformableAdaptator->addCorrectionPoints(points_mask_correction_);
-
-	deformableAdaptator->adaptation(); // launch the deformation
-	meshOutput = deformableAdaptator->getSpinalCordOutput(); // get the spinal cord segmentation mesh
-	delete deformableAdaptator; // release memory
-		
-		
-	meshOutput->setRadialResolution(resolutionRadiale_); // the output of DeformableModelBasicAdaptator is a mesh and we need to provide the radial resolution for further computation
-	// we remove the last disk to prevent edges issues in the deformation process. Indeed, edges have less neighbors and the last disk retract itself.
-	meshOutput->removeLastPoints(resolutionRadiale_);
-	meshOutput->removeLastTriangles(2*resolutionRadiale_);
-		
-		
 	/******************************************************************************************
 	 * Initialization of variables
 	 * numberOfDisks is a constant of propagation - don't change it
@@ -505,47 +630,134 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 	 * newStartPoint is the center of the last disk of the mesh. It is the new start point of the propagation. The mesh is duplicated and translated on this point.
 	 *****************************************************************************************/
 	unsigned int numberOfDisks = resolutionAxiale_+1;
-	CVector3 nextPoint, newStartPoint, lastPoint, firstPoint = meshOutput->computeGravityCenterFirstDisk(numberOfDisks); // computation of first point = center of mass of the fisrt disk
-	centerline.push_back(firstPoint); // add point to centerline - first point necessary
-	SpinalCord	*uniqueMesh = meshOutput->extractPartOfMesh(numberOfDisks,true,true); // extraction of a part of the mesh
-	uniqueMesh->computeConnectivity();
-	uniqueMesh->computeTrianglesBarycentre();
-	newStartPoint = meshOutput->computeGravityCenterFirstDisk(numberOfDisks); // compute first point of the mesh
-		
-	/******************************************************************************************
-	 * Computation of the initial rotation value.
-	 * It is used as a mesh refreshing condition. If the difference between initial and updated rotation value if too high, a new part of mesh is used as the template to be duplicated. Rotation value is the sum of intensity at vertices positions.
-	 *****************************************************************************************/
-	GlobalAdaptation* gAdaptI = new GlobalAdaptation(image3D_,uniqueMesh,newStartPoint,"rotation");
-	CVector3 normal_mesh = CVector3(initialNormal2_[0],initialNormal2_[1],initialNormal2_[2]);
-	gAdaptI->setNormalMesh(normal_mesh);
-	gAdaptI->setVerbose(verbose_);
-	double initialRotationValue = gAdaptI->getInitialValue(), rotationValue = 0.0;
-	delete gAdaptI;
-	CVector3 position;
-		
+	CVector3 nextPoint, newStartPoint, lastPoint, position, normal_mesh;
+	SpinalCord *uniqueMesh = 0;
+	DeformableModelBasicAdaptator *deformableAdaptator = 0;
+	double initialRotationValue = 0.0, rotationValue = 0.0;
+	vector< vector<CVector3> > lastDisks;
+	
 	/******************************************************************************************
 	 * initialization of stop condition variables
 	 *****************************************************************************************/
 	bool done = false;
-	area[0] = 0.0; area[1] = 0.0; area[2] = 0.0;
+	context.area[0] = 0.0; context.area[1] = 0.0; context.area[2] = 0.0;
 	double meanVoxels[3]; meanVoxels[0] = 0.0; meanVoxels[1] = 0.0; meanVoxels[2] = 0.0;
 	//double meanVoxelsInit = meshOutput->computeStandardDeviationFromPixelsInside(image3D_->getImageOriginale()); // homogeneity stop condition - not optimal
 	int numberOfBadOrientation = 0, numberOfBadOrientationTotal = 0, maxBadOrientation = 150;
-	meanContrast = 0.0;
+	context.meanContrast = 0.0;
+	
+	// adaptive axial step: length of the duplicated mesh and rotation applied at the last step
+	double axialStep = deplacementAxial_, lastRotationAngle = 0.0;
+	int firstStep = 1;
+	
+	/******************************************************************************************
+	 * Objects reused at each propagation step
+	 *****************************************************************************************/
+	PropagationWorkspace workspace(context.image,numberOfDeformIteration_);
+	workspace.globalAdaptation.setVerbose(verbose_);
+	if (rotationGridResolution_ > 0) {
+		// les deux directions sont propagees en meme temps : chacune utilise la moitie des threads
+		int numberOfThreads = rotationSearchThreads_ > 0 ? rotationSearchThreads_ : itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+		if (hasInitialPointAndNormals_) numberOfThreads = max(1,numberOfThreads/2);
+		workspace.globalAdaptation.setGridSearch(rotationGridResolution_,rotationCandidates_,numberOfThreads);
+	}
+	DeformableModelBasicAdaptator& stepAdaptator = workspace.deformableAdaptator;
+	if (tradeoff_d_bool) stepAdaptator.setTradeOff(tradeoff_d_);
+	stepAdaptator.setVerbose(verbose_);
+	if (this->changedParameters_) {
+		stepAdaptator.changedParameters();
+		stepAdaptator.setAlpha(alpha);
+		stepAdaptator.setBeta(beta);
+		stepAdaptator.setLineSearch(line_search);
+	}
+	stepAdaptator.addCorrectionPoints(points_mask_correction_);
+	
+	if (context.resume == 0)
+	{
+		/******************************************************************************************
+		 * Initialization of the spinal cord mesh
+		 * Each direction has its own contrast vector, the contrast vectors are concatenated after the propagation
+		 *****************************************************************************************/
+		SpinalCord* initialMesh = initialTube1;
+		if (numberOfMesh == 2) initialMesh = initialTube2;
+
+		/******************************************************************************************
+		 * Deformation of the initial mesh.
+		 * This deformation must be accurate to have a correct initialization. If not, errors can be propagated.
+		 * The number of iteration and the stop condition of the deformation is 0.05 mm by default
+		 *****************************************************************************************/
+		if (verbose_) cout << endl << endl << "Initial deformation : " << initialMesh->getNbrOfPoints() << " points and " << initialMesh->getNbrOfTriangles() << " triangles" << endl;
+		deformableAdaptator = new DeformableModelBasicAdaptator(context.image,initialMesh,numberOfDeformIteration_,const_contrast,false);
+		deformableAdaptator->setVerbose(verbose_);
+		deformableAdaptator->setNumberOfIteration(8); //8
+		deformableAdaptator->setStopCondition(0.05);
+		if (tradeoff_d_bool) deformableAdaptator->setTradeOff(tradeoff_d_);
+		//deformableAdaptator->setProgressiveLineSearchLength(true);// tested but not optimal
+		deformableAdaptator->addCorrectionPoints(points_mask_correction_);
+
+		deformableAdaptator->adaptation(); // launch the deformation
+		context.meshOutput = deformableAdaptator->getSpinalCordOutput(); // get the spinal cord segmentation mesh
+		delete deformableAdaptator; // release memory
+
+
+		context.meshOutput->setRadialResolution(resolutionRadiale_); // the output of DeformableModelBasicAdaptator is a mesh and we need to provide the radial resolution for further computation
+		// we remove the last disk to prevent edges issues in the deformation process. Indeed, edges have less neighbors and the last disk retract itself.
+		context.meshOutput->removeLastPoints(resolutionRadiale_);
+		context.meshOutput->removeLastTriangles(2*resolutionRadiale_);
+
+
+		CVector3 firstPoint = context.meshOutput->computeGravityCenterFirstDisk(numberOfDisks); // computation of first point = center of mass of the fisrt disk
+		context.centerline.push_back(firstPoint); // add point to centerline - first point necessary
+		uniqueMesh = context.meshOutput->extractPartOfMesh(numberOfDisks,true,true); // extraction of a part of the mesh
+		uniqueMesh->computeConnectivity();
+		uniqueMesh->computeTrianglesBarycentre();
+		newStartPoint = context.meshOutput->computeGravityCenterFirstDisk(numberOfDisks); // compute first point of the mesh
+
+
+		/******************************************************************************************
+		 * Computation of the initial rotation value.
+		 * It is used as a mesh refreshing condition. If the difference between initial and updated rotation value if too high, a new part of mesh is used as the template to be duplicated. Rotation value is the sum of intensity at vertices positions.
+		 *****************************************************************************************/
+		workspace.globalAdaptation.setInput(uniqueMesh,newStartPoint);
+		normal_mesh = CVector3(initialNormal2_[0],initialNormal2_[1],initialNormal2_[2]);
+		workspace.globalAdaptation.setNormalMesh(normal_mesh);
+		initialRotationValue = workspace.globalAdaptation.getInitialValue();
+	}
+	else
+	{
+		/******************************************************************************************
+		 * Resume from a checkpoint: the initial deformation and the propagation steps before the checkpoint are skipped
+		 *****************************************************************************************/
+		const PropagationCheckpoint& checkpoint = *context.resume;
+		if (verbose_) cout << endl << "Resume propagation " << numberOfMesh << " from step " << checkpoint.step << endl;
+		context.meshOutput = checkpoint.getMeshOutput();
+		uniqueMesh = checkpoint.getTemplateMesh();
+		context.contrast = checkpoint.contrast;
+		context.centerline = checkpoint.centerline;
+		context.meanContrast = checkpoint.meanContrast;
+		context.area[0] = checkpoint.area[0]; context.area[1] = checkpoint.area[1]; context.area[2] = checkpoint.area[2]; context.meanArea = checkpoint.meanArea;
+		numberOfBadOrientation = checkpoint.numberOfBadOrientation;
+		numberOfBadOrientationTotal = checkpoint.numberOfBadOrientationTotal;
+		position = checkpoint.position;
+		lastPoint = checkpoint.lastPoint;
+		initialRotationValue = checkpoint.initialRotationValue;
+		axialStep = checkpoint.axialStep;
+		lastRotationAngle = checkpoint.lastRotationAngle;
+		firstStep = checkpoint.step+1;
+		done = checkpoint.finished;
+	}
 	
 	
 	/******************************************************************************************
 	 * Iterative deformation by adding a portion of mesh at each iteration
 	 *****************************************************************************************/
 	int i;
-	for (i=1; i<=numberOfPropagationIteration_ && !done; i++)
+	for (i=firstStep; i<=numberOfPropagationIteration_ && !done; i++)
 	{
 		if (verbose_) cout << endl << "Propagation step " << i << "/" << numberOfPropagationIteration_ << endl;
-		centerline = meshOutput->computeCenterline();
-		double segmentationLength = 0.0;
-		for (unsigned int c=1; c<centerline.size(); c++)
-			segmentationLength += (centerline[c]-centerline[c-1]).Norm();
+		// centres des disques et longueur maintenus incrementalement par le maillage
+		const vector<CVector3>& diskCentroids = context.meshOutput->getDiskCentroids();
+		double segmentationLength = context.meshOutput->getCenterlineLength();
 		if (verbose_) cout << "Propagation length [mm] : " << segmentationLength << " / " << propagationLength_ <<  endl;
 			
 		/******************************************************************************************
@@ -553,28 +765,28 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 		 * Computation of the local spinal cord / CSF contrast along the mesh
 		 * Computation of the mean contrast from last disk positions. The mean contrast is used as a parameter in the local deformation and as a stop condition
 		 *****************************************************************************************/
-		CVector3 sourcePoint1 = centerline[centerline.size()-1], sourcePoint2 = centerline[centerline.size()-5];
+		CVector3 sourcePoint1 = diskCentroids[diskCentroids.size()-1], sourcePoint2 = diskCentroids[diskCentroids.size()-5];
 		CVector3 lastNormal = (sourcePoint1-sourcePoint2).Normalize(), directionCourantePerpendiculaire;
 		if (lastNormal[2] == 0.0) directionCourantePerpendiculaire = CVector3(0.0,0.0,1.0);
 		else directionCourantePerpendiculaire = CVector3(1.0,2.0,-(lastNormal[0]+2*lastNormal[1])/lastNormal[2]).Normalize();
 		Referential refCourant = Referential(lastNormal^directionCourantePerpendiculaire, directionCourantePerpendiculaire, lastNormal, sourcePoint2);
-		contrast.push_back(pair<CVector3,double>(refCourant.getOrigine(),computeContrast(refCourant)));
-		int nbContrast = contrast.size()-1;
+		context.contrast.push_back(pair<CVector3,double>(refCourant.getOrigine(),computeContrast(refCourant,context.image)));
+		int nbContrast = context.contrast.size()-1;
 		
-		if (verbose_) cout << "Contrast = " << contrast[nbContrast].second << endl;
-		if (nbContrast == 0) meanContrast = (contrast[0].second+2*const_contrast)/3.0;
-		else if (nbContrast == 1) meanContrast = (contrast[nbContrast].second+contrast[nbContrast-1].second+const_contrast)/3.0;
-		else meanContrast = (contrast[nbContrast].second+contrast[nbContrast-1].second+contrast[nbContrast-2].second)/3.0;
+		if (verbose_) cout << "Contrast = " << context.contrast[nbContrast].second << endl;
+		if (nbContrast == 0) context.meanContrast = (context.contrast[0].second+2*const_contrast)/3.0;
+		else if (nbContrast == 1) context.meanContrast = (context.contrast[nbContrast].second+context.contrast[nbContrast-1].second+const_contrast)/3.0;
+		else context.meanContrast = (context.contrast[nbContrast].second+context.contrast[nbContrast-1].second+context.contrast[nbContrast-2].second)/3.0;
 		// mean 445.8476 std 113.5695 max 708.9200 min 148.6900
 		if (verbose_) cout << "Iteration Position = " << sourcePoint1 << endl;
 		
 		/******************************************************************************************
 		 * newStartPoint is the last point of the mesh and will be the first point of the new section (for duplication and translation)
 		 *****************************************************************************************/
-		newStartPoint = meshOutput->computeGravityCenterLastDisk(numberOfDisks);
+		newStartPoint = context.meshOutput->computeGravityCenterLastDisk(numberOfDisks);
 			
 		CVector3 indexPosition, temp;
-		bool inOut = image3D_->TransformPhysicalPointToIndex(newStartPoint,indexPosition); // stop condition
+		bool inOut = context.image->TransformPhysicalPointToIndex(newStartPoint,indexPosition); // stop condition
 		CVector3 lastPointReal = lastPoint;
 		if (lastPointReal == CVector3::ZERO) lastPointReal = newStartPoint;
 		
@@ -585,18 +797,26 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 		 * abnormalities - not good if the new starting point is behind the last starting point
 		 * inferior and superior limits can be imposed by the user
 		 *****************************************************************************************/
-		if (segmentationLength < propagationLength_ && meanContrast > minContrast && abs(newStartPoint[1]-lastPointReal[1]) <= 15.0 && indexPosition[1]<upLimit && indexPosition[1]>downLimit)
+		if (segmentationLength < propagationLength_ && context.meanContrast > minContrast && abs(newStartPoint[1]-lastPointReal[1]) <= 15.0 && indexPosition[1]<upLimit && indexPosition[1]>downLimit && insideAxialBounds(newStartPoint))
 		{
-			lastPoint = meshOutput->computeGravityCenterFirstDisk(numberOfDisks);
+			lastPoint = context.meshOutput->computeGravityCenterFirstDisk(numberOfDisks);
 			if (position == CVector3()) position = lastPoint;
 				
-			SpinalCord *partMesh = meshOutput->extractLastDiskOfMesh(false);
-				
 			CMatrix4x4 translation, transformation; translation[12] = newStartPoint[0]-position[0]; translation[13] = newStartPoint[1]-position[1]; translation[14] = newStartPoint[2]-position[2];
 			position = newStartPoint;
 				
 			uniqueMesh->transform(translation);
 			
+			/******************************************************************************************
+			 * Adaptive axial step: the duplicated mesh is stretched or shortened along its axis, depending on the curvature of the centerline,
+			 * the rotation of the last step and the contrast
+			 *****************************************************************************************/
+			if (adaptiveAxialStep_) {
+				axialStep = computeAdaptiveAxialStep(diskCentroids, numberOfDisks, axialStep, lastRotationAngle, context.meanContrast/const_contrast);
+				setMeshAxialLength(uniqueMesh, numberOfDisks, axialStep);
+				if (verbose_) cout << "Axial step [mm] = " << axialStep << endl;
+			}
+			
 			bool orientationBool = true;
 				
 			/******************************************************************************************
@@ -605,25 +825,22 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 			 * This value is used to change the mesh when it doesn't correspond anymore to the spinal cord edges - this value is negative
 			 * The function adaptation() compute the orientation and transform the mesh
 			 *****************************************************************************************/
-			GlobalAdaptation* gAdapt = new GlobalAdaptation(image3D_,uniqueMesh,newStartPoint,"rotation");
+			GlobalAdaptation* gAdapt = &workspace.globalAdaptation;
+			gAdapt->setInput(uniqueMesh,newStartPoint);
 			normal_mesh = CVector3(translation[12],translation[13],translation[14]);
 			gAdapt->setNormalMesh(normal_mesh);
-			gAdapt->setVerbose(verbose_);
 			rotationValue = gAdapt->getInitialValue();
 			if (rotationValue >= 0.75*initialRotationValue || rotationValue <= 1.5*initialRotationValue) { // if the value of GlobalAdaptation isn't in range, we replace the mesh
-				// release the memory and create a new mesh using the last disks
-				delete uniqueMesh;
-				uniqueMesh = meshOutput->extractPartOfMesh(numberOfDisks,true,true);
-				uniqueMesh->computeConnectivity();
-				uniqueMesh->computeTrianglesBarycentre();
-				lastPoint = meshOutput->computeGravityCenterFirstDisk(numberOfDisks);
+				// the mesh is replaced in place by the last disks
+				context.meshOutput->extractPartOfMesh(uniqueMesh,numberOfDisks,true,true);
+				lastPoint = context.meshOutput->computeGravityCenterFirstDisk(numberOfDisks);
 				CMatrix4x4 translation, transformation; translation[12] = newStartPoint[0]-lastPoint[0]; translation[13] = newStartPoint[1]-lastPoint[1]; translation[14] = newStartPoint[2]-lastPoint[2];
 				position = newStartPoint;
 				uniqueMesh->transform(translation); // translate the mesh to its new position
-				gAdapt = new GlobalAdaptation(image3D_,uniqueMesh,newStartPoint,"rotation");
+				if (adaptiveAxialStep_) setMeshAxialLength(uniqueMesh, numberOfDisks, axialStep);
+				gAdapt->setInput(uniqueMesh,newStartPoint);
 				normal_mesh = CVector3(translation[12],translation[13],translation[14]);
 				gAdapt->setNormalMesh(normal_mesh);
-				gAdapt->setVerbose(verbose_);
 				initialRotationValue = gAdapt->getInitialValue();
 				rotationValue = gAdapt->getInitialValue();
 			}
@@ -657,13 +874,14 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 				// As the referential origin is the starting point of our mesh, the transformation that is computed is only a rotation and does not contain any translation.
 				
 				uniqueMesh->transform(transformationRotation,newStartPoint);
+				lastRotationAngle = rotationAngle(transformationRotation);
 			}
 			/******************************************************************************************
 			 * if the centerline is not provided, the rotation computation used GlobalAdaptation
 			 *****************************************************************************************/
 			else
 			{
-				gAdapt->adaptation(true);
+				lastRotationAngle = rotationAngle(gAdapt->adaptation(true));
 				// bad orientation (out of known orientation range) can happened
 				if (gAdapt->getBadOrientation()) {
 					numberOfBadOrientation++;
@@ -677,29 +895,19 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 				/******************************************************************************************
 				 * Creation of a new mesh with the last disk of meshOutput and the new mesh (uniqueMesh) correctly oriented
 				 *****************************************************************************************/
-				partMesh->assembleMeshes(uniqueMesh,numberOfDisks,resolutionRadiale_);
-				partMesh->computeConnectivity();
-				partMesh->computeTrianglesBarycentre();
+				SpinalCord* partMesh = &workspace.partMesh;
+				context.meshOutput->assemblePropagationMesh(partMesh,uniqueMesh,numberOfDisks);
 				if (verbose_) cout << "Mesh deformation : " << partMesh->getNbrOfPoints() << " points and " << partMesh->getNbrOfTriangles() << " triangles" << endl;
 				
 				/******************************************************************************************
-				 * Creation of the deformation object, including the image, the mesh and the deformation parameters
+				 * The deformation object of the workspace (image, mesh and deformation parameters) only needs the local contrast
 				 *****************************************************************************************/
-				deformableAdaptator = new DeformableModelBasicAdaptator(image3D_,partMesh,numberOfDeformIteration_,meanContrast,false);
-				if (tradeoff_d_bool) deformableAdaptator->setTradeOff(tradeoff_d_);
-				deformableAdaptator->setVerbose(verbose_);
-				if (this->changedParameters_) {
-					deformableAdaptator->changedParameters();
-					deformableAdaptator->setAlpha(alpha);
-					deformableAdaptator->setBeta(beta);
-					deformableAdaptator->setLineSearch(line_search);
-				}
-				deformableAdaptator->addCorrectionPoints(points_mask_correction_);
+				stepAdaptator.setContrast(context.meanContrast);
 				
 				/******************************************************************************************
 				 * Deformation of the mesh
 				 *****************************************************************************************/
-				double deformation = deformableAdaptator->adaptation();
+				double deformation = stepAdaptator.adaptation();
 				
 				/******************************************************************************************
 				 * Extraction of the deformation result and verification of stop conditions:
@@ -708,13 +916,15 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 				 * maximum cross-sectional area
 				 * number of wrong orientation (sign of a wrong orientation)
 				 *****************************************************************************************/
-				SpinalCord* deformed_spinalcord = deformableAdaptator->getSpinalCordOutput();
-				deformed_spinalcord->computeConnectivity();
+				SpinalCord* deformed_spinalcord = &workspace.deformedMesh; // output of stepAdaptator, same structure as partMesh
+				shared_ptr<const MeshTopology> deformedTopology = deformed_spinalcord->getTopology();
+				if (!deformedTopology || deformedTopology->getNbrOfPoints() != (unsigned int)deformed_spinalcord->getNbrOfPoints() || deformedTopology->getNbrOfTriangles() != (unsigned int)deformed_spinalcord->getNbrOfTriangles())
+					deformed_spinalcord->computeConnectivity();
 				deformed_spinalcord->computeTrianglesBarycentre();
 				deformed_spinalcord->Initialize(resolutionRadiale_);
 				CVector3 secondPoint = deformed_spinalcord->computeGravityCenterSecondDisk();
 				double lastCrossSectionalArea = deformed_spinalcord->computeLastCrossSectionalArea();
-				area[0] = area[1]; area[1] = area[2]; area[2] = lastCrossSectionalArea; meanArea = (area[0]+area[1]+area[2])/3.0;
+				context.area[0] = context.area[1]; context.area[1] = context.area[2]; context.area[2] = lastCrossSectionalArea; context.meanArea = (context.area[0]+context.area[1]+context.area[2])/3.0;
 				
 				if ((secondPoint-lastPoint)*(newStartPoint-lastPoint)<0.0) {
 					if (verbose_) cout << "Stop by deformation error : overlap during propagation" << endl;
@@ -724,8 +934,8 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 					if (verbose_) cout << "Stop by too large deformation : " << deformation << "/" << maxDeformation << endl;
 					done = true;
 				}
-				if ((meanArea >= maxArea && abs(area[2]-area[1]) >= maxArea/7.0) || meanArea >= 1.2*maxArea) {// || (area[1]>=maxArea && area[2]<maxArea)) {
-					if (verbose_) cout << "Stop by too large cross sectionnal area : " << meanArea << "/" << maxArea << endl;
+				if ((context.meanArea >= maxArea && abs(context.area[2]-context.area[1]) >= maxArea/7.0) || context.meanArea >= 1.2*maxArea) {// || (area[1]>=maxArea && area[2]<maxArea)) {
+					if (verbose_) cout << "Stop by too large cross sectionnal area : " << context.meanArea << "/" << maxArea << endl;
 					done = true;
 				}
 				if (numberOfBadOrientation >= maxBadOrientation)
@@ -739,9 +949,7 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 				 *****************************************************************************************/
 				if (!done)
 				{
-					meshOutput->assembleMeshes(deformed_spinalcord,numberOfDisks,resolutionRadiale_);
-					meshOutput->computeConnectivity();
-					meshOutput->computeTrianglesBarycentre();
+					context.meshOutput->appendDisks(deformed_spinalcord,numberOfDisks,resolutionRadiale_);
 					
 					// if the mesh get out the image, the propagation has to stop
 					if(!inOut || indexPosition[1]>upLimit || indexPosition[1]<downLimit) {
@@ -751,15 +959,12 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 						if (indexPosition[1]<downLimit && verbose_) cout << "Stop because out of range: down" << endl;
 					}
 				}
-				delete deformed_spinalcord;
 			}
 			else
 			{
 				if (verbose_) cout << "Stop by bad orientation" << endl;
 				done = true;
 			}
-				
-			delete partMesh, gAdapt, deformableAdaptator;//, orientationFilter;
 		}
 		else
 		{
@@ -768,59 +973,151 @@ SpinalCord* PropagatedDeformableModel::propagationMesh(int numberOfMesh)
 			if (indexPosition[1]>=upLimit && verbose_) cout << "Stop because out of range: up" << endl;
 			if (indexPosition[1]<=downLimit && verbose_) cout << "Stop because out of range: down" << endl;
 			if (abs(newStartPoint[1]-lastPointReal[1]) > 15.0 && verbose_) cout << "Stop because bad direction" << endl;
+			if (!insideAxialBounds(newStartPoint) && verbose_) cout << "Stop because out of axial bounds" << endl;
 		}
 		
-		if (verbose_) cout << "Number of bad orientation = " << numberOfBadOrientationTotal << " / " << i << endl;
-		if (verbose_) cout << "Contrast : " << meanContrast << " / " << minContrast << endl;
-		
 		/******************************************************************************************
-		 * Computation of the new spinal cord centerline
+		 * Checkpoint of the propagation state, every checkpointInterval_ steps and at the end of the propagation
 		 *****************************************************************************************/
-		centerline = meshOutput->computeCenterline();
-		if (verbose_) {
-			double distanceSegmentation = 0.0;
-			int interval = 1;
-			for (unsigned int c=interval; c<centerline.size(); c+=interval)
-				distanceSegmentation += (centerline[c]-centerline[c-interval]).Norm();
-			cout << "Distance of segmentation [mm] = " << distanceSegmentation << endl;
+		if (checkpointInterval_ > 0 && (done || i%checkpointInterval_ == 0 || i == numberOfPropagationIteration_))
+		{
+			PropagationCheckpoint checkpoint;
+			checkpoint.direction = numberOfMesh;
+			checkpoint.step = i;
+			checkpoint.radialResolution = resolutionRadiale_;
+			checkpoint.finished = done || i == numberOfPropagationIteration_;
+			checkpoint.setMeshOutput(context.meshOutput);
+			checkpoint.setTemplateMesh(uniqueMesh);
+			checkpoint.contrast = context.contrast;
+			checkpoint.centerline = context.centerline;
+			checkpoint.meanContrast = context.meanContrast;
+			checkpoint.area[0] = context.area[0]; checkpoint.area[1] = context.area[1]; checkpoint.area[2] = context.area[2]; checkpoint.meanArea = context.meanArea;
+			checkpoint.numberOfBadOrientation = numberOfBadOrientation;
+			checkpoint.numberOfBadOrientationTotal = numberOfBadOrientationTotal;
+			checkpoint.position = position;
+			checkpoint.lastPoint = lastPoint;
+			checkpoint.initialRotationValue = initialRotationValue;
+			checkpoint.axialStep = axialStep;
+			checkpoint.lastRotationAngle = lastRotationAngle;
+			if (!checkpointFilePrefix_.empty()) {
+				stringstream filename;
+				filename << checkpointFilePrefix_ << "_" << numberOfMesh << "_" << i << ".ckpt";
+				checkpoint.save(filename.str());
+			}
+			context.checkpoints.push_back(checkpoint);
 		}
+		
+		if (verbose_) cout << "Number of bad orientation = " << numberOfBadOrientationTotal << " / " << i << endl;
+		if (verbose_) cout << "Contrast : " << context.meanContrast << " / " << minContrast << endl;
+		
+		if (verbose_) cout << "Distance of segmentation [mm] = " << context.meshOutput->getCenterlineLength() << endl;
 	}
 	
+	/******************************************************************************************
+	 * Spinal cord centerline at the end of the propagation
+	 *****************************************************************************************/
+	context.centerline = context.meshOutput->getDiskCentroids();
+	
 	/******************************************************************************************
 	 * Smoothing of the low-resolution mesh
 	 *****************************************************************************************/
-	meshOutput->smoothing(70);
+	context.meshOutput->smoothing(70);
 
-	return meshOutput;
+	return context.meshOutput;
+}
+
+
+// Angle (degrees) of the rotation part of a rigid transformation
+double PropagatedDeformableModel::rotationAngle(const CMatrix4x4& transformation)
+{
+	double cosAngle = (transformation[0]+transformation[5]+transformation[10]-1.0)/2.0;
+	if (cosAngle > 1.0) cosAngle = 1.0;
+	else if (cosAngle < -1.0) cosAngle = -1.0;
+	return acos(cosAngle)*180.0/M_PI;
+}
+
+
+/*!
+ * Length of the next propagation step. The rate of turn of the spinal cord (degrees per mm) is the largest of the curvature of the centerline over the last two steps
+ * and of the rotation applied at the last step. The step is the length for which the cord turns by maxTurnAngle_, reduced when the contrast is lower than expected.
+ * The step can grow by 50% at most between two steps and is kept between minAxialStep_ and maxAxialStep_.
+ */
+double PropagatedDeformableModel::computeAdaptiveAxialStep(const vector<CVector3>& diskCentroids, int numberOfDisks, double lastStep, double lastRotationAngle, double relativeContrast)
+{
+	double rate = lastRotationAngle/lastStep;
+	int n = diskCentroids.size(), m = numberOfDisks-1;
+	if (m > 0 && n-1-2*m >= 0)
+	{
+		CVector3 t1 = diskCentroids[n-1]-diskCentroids[n-1-m], t0 = diskCentroids[n-1-m]-diskCentroids[n-1-2*m];
+		double l0 = t0.Norm(), l1 = t1.Norm();
+		if (l0 > 0.0 && l1 > 0.0) {
+			double cosAngle = (t0*t1)/(l0*l1);
+			if (cosAngle > 1.0) cosAngle = 1.0;
+			else if (cosAngle < -1.0) cosAngle = -1.0;
+			double curvature = acos(cosAngle)*180.0/M_PI/(0.5*(l0+l1));
+			if (curvature > rate) rate = curvature;
+		}
+	}
+
+	double step = maxAxialStep_;
+	if (rate > 0.0) step = maxTurnAngle_/rate;
+	if (relativeContrast < 1.0) step *= max(0.5,relativeContrast);
+	step = min(step,1.5*lastStep);
+	return max(minAxialStep_,min(maxAxialStep_,step));
+}
+
+
+// Scale the mesh along the axis going from the center of its first disk to the center of its last disk, so that this distance becomes length. The first disk does not move.
+void PropagatedDeformableModel::setMeshAxialLength(SpinalCord* mesh, int numberOfDisks, double length)
+{
+	CVector3 first = mesh->computeGravityCenterFirstDisk(numberOfDisks), last = mesh->computeGravityCenterLastDisk(numberOfDisks);
+	double currentLength = (last-first).Norm();
+	if (currentLength == 0.0) return;
+	CVector3 axis = (last-first)/currentLength;
+	double factor = length/currentLength-1.0;
+	CMatrix4x4 scaling;
+	for (int i=0; i<3; i++)
+		for (int j=0; j<3; j++)
+			scaling[4*j+i] += factor*axis[i]*axis[j];
+	mesh->transform(scaling,first);
 }
 
 
 void PropagatedDeformableModel::rafinementGlobal()
 {
-	if (verbose_) cout << endl << "Global deformation after subdivision... ";
+	if (verbose_) cout << endl << "Global deformation after subdivision" << (coarseToFineRefinement_ ? " (coarse to fine)" : "") << "... ";
 	meshOutputFinal = new SpinalCord(*meshOutput);
 	meshOutputFinal->setRadialResolution(resolutionRadiale_);
 	//meshOutputFinal = subdivisionRadiale(meshOutput,resolutionRadiale_);
-	meshOutputFinal->subdivision();
+
+	// En mode grossier-fin, le niveau grossier est le maillage avant subdivision, deforme sur le gradient lisse et sous-echantillonne.
+	// La subdivision est alors faite par l'adaptateur entre les deux niveaux. Sinon, raffinement sur le maillage subdivise (250 iterations x 3).
+	Image3D* coarseImage = 0;
+	if (coarseToFineRefinement_) coarseImage = image3D_->createCoarseLevel(1.0,1.0);
+	if (coarseImage == 0) meshOutputFinal->subdivision();
 	meshOutputFinal->computeConnectivity();
 	if (verbose_) cout << meshOutputFinal->getNbrOfPoints() << " points and " << meshOutputFinal->getNbrOfTriangles() << " triangles" << endl;
 	
-	//DeformableModelBasicAdaptator *deformableAdaptator = new DeformableModelBasicAdaptator(image3D_,meshOutputFinal,numberOfDeformIteration_,445.00);
-	DeformableModelBasicAdaptator *deformableAdaptator = new DeformableModelBasicAdaptator(image3D_,meshOutputFinal,numberOfDeformIteration_,contrast);
-	if (tradeoff_d_bool) deformableAdaptator->setTradeOff(tradeoff_d_);
-	deformableAdaptator->setVerbose(verbose_);
-	deformableAdaptator->changedParameters();
-	deformableAdaptator->setLineSearch(15);
-	deformableAdaptator->setAlpha(25);
-	deformableAdaptator->setBeta(50);
-	deformableAdaptator->setNumberOptimizerIteration(250);
-	deformableAdaptator->setNumberOfIteration(3);
-	deformableAdaptator->addCorrectionPoints(points_mask_correction_);
-	deformableAdaptator->adaptation();
-	delete meshOutputFinal;
-	meshOutputFinal = deformableAdaptator->getSpinalCordOutput();
+	SpinalCord* refinedMesh = 0;
+	if (partitionedRefinement_) refinedMesh = refineBySegments(meshOutputFinal,coarseImage);
+	if (refinedMesh != 0)
+	{
+		delete meshOutputFinal;
+		meshOutputFinal = refinedMesh;
+	}
+	else
+	{
+		//DeformableModelBasicAdaptator *deformableAdaptator = new DeformableModelBasicAdaptator(image3D_,meshOutputFinal,numberOfDeformIteration_,445.00);
+		DeformableModelBasicAdaptator *deformableAdaptator = new DeformableModelBasicAdaptator(image3D_,meshOutputFinal,numberOfDeformIteration_,contrast);
+		setRefinementParameters(deformableAdaptator);
+		if (coarseImage != 0) deformableAdaptator->setMultiResolution(coarseImage,resolutionRadiale_);
+		deformableAdaptator->adaptation();
+		delete meshOutputFinal;
+		meshOutputFinal = deformableAdaptator->getSpinalCordOutput();
+		delete deformableAdaptator;
+	}
 	meshOutputFinal->setRadialResolution(2*resolutionRadiale_);
-	delete deformableAdaptator;
+	delete coarseImage;
 
 	meshOutputFinal->smoothing(20);
 
@@ -834,6 +1131,241 @@ void PropagatedDeformableModel::rafinementGlobal()
 	}
 }
 
+/*!
+ * Local correction of a segmentation with new correction points, without propagating again.
+ * The disks nearest to the correction points, extended by margin millimeters along the centerline on both sides, form the window to correct.
+ * The boundary rings of the window are fixed (unless they are the extremities of the segmentation) so that the corrected part stays connected to the rest of the mesh.
+ * The window is deformed, then refined with the parameters of rafinementGlobal and smoothed, and spliced back in segmentation.
+ * If mask is provided (binary image of segmentation, with the geometry of the original image), only the slab containing the window is rasterized again.
+ * The new correction points are added to the correction points used by the next propagations.
+ * Return false if the segmentation could not be corrected.
+ */
+bool PropagatedDeformableModel::correctSegmentation(SpinalCord* segmentation, const vector<CVector3>& correctionPoints, BinaryImageType::Pointer mask, double margin)
+{
+	int radialResolution = segmentation->getRadialResolution();
+	const vector<CVector3>& diskCentroids = segmentation->getDiskCentroids();
+	int numberOfDisks = diskCentroids.size();
+	if (correctionPoints.empty() || radialResolution <= 0 || numberOfDisks < 3) return false;
+
+	/******************************************************************************************
+	 * Axial window: disks nearest to the correction points, extended by margin along the centerline
+	 *****************************************************************************************/
+	vector<double> arcLength(numberOfDisks,0.0);
+	for (int k=1; k<numberOfDisks; k++)
+		arcLength[k] = arcLength[k-1] + (diskCentroids[k]-diskCentroids[k-1]).Norm();
+	int nearestMin = numberOfDisks-1, nearestMax = 0;
+	for (unsigned int i=0; i<correctionPoints.size(); i++)
+	{
+		int nearest = 0;
+		double distanceMin = (correctionPoints[i]-diskCentroids[0]).Norm();
+		for (int k=1; k<numberOfDisks; k++) {
+			double distance = (correctionPoints[i]-diskCentroids[k]).Norm();
+			if (distance < distanceMin) {
+				distanceMin = distance;
+				nearest = k;
+			}
+		}
+		nearestMin = min(nearestMin,nearest);
+		nearestMax = max(nearestMax,nearest);
+	}
+	int firstDisk = nearestMin, lastDisk = nearestMax;
+	while (firstDisk > 0 && arcLength[nearestMin]-arcLength[firstDisk-1] <= margin) firstDisk--;
+	while (lastDisk < numberOfDisks-1 && arcLength[lastDisk+1]-arcLength[nearestMax] <= margin) lastDisk++;
+	if (verbose_) cout << "Local correction of disks " << firstDisk << " to " << lastDisk << " / " << numberOfDisks << endl;
+
+	SpinalCord* window = segmentation->extractDisks(firstDisk,lastDisk);
+	window->computeConnectivity();
+	int numberOfPoints = window->getNbrOfPoints();
+	vector<char> fixedPoints(numberOfPoints,0);
+	if (firstDisk > 0)
+		for (int k=0; k<radialResolution; k++) fixedPoints[k] = 1;
+	if (lastDisk < numberOfDisks-1)
+		for (int k=0; k<radialResolution; k++) fixedPoints[numberOfPoints-radialResolution+k] = 1;
+
+	// positions avant correction, pour effacer les voxels qui ne sont plus dans le maillage
+	vector<CVector3> regionPoints;
+	vector<Vertex*>& windowPoints = window->getListPoints();
+	for (int i=0; i<numberOfPoints; i++)
+		regionPoints.push_back(windowPoints[i]->getPosition());
+
+	points_mask_correction_.insert(points_mask_correction_.end(),correctionPoints.begin(),correctionPoints.end());
+
+	/******************************************************************************************
+	 * Deformation then refinement of the window, the boundary rings being fixed
+	 *****************************************************************************************/
+	DeformableModelBasicAdaptator *deformableAdaptator = new DeformableModelBasicAdaptator(image3D_,window,numberOfDeformIteration_,contrast,false);
+	if (tradeoff_d_bool) deformableAdaptator->setTradeOff(tradeoff_d_);
+	deformableAdaptator->setVerbose(verbose_);
+	deformableAdaptator->addCorrectionPoints(points_mask_correction_);
+	deformableAdaptator->setFixedPoints(fixedPoints);
+	deformableAdaptator->adaptation();
+	SpinalCord* deformedWindow = deformableAdaptator->getSpinalCordOutput();
+	delete deformableAdaptator->getOutput();
+	delete deformableAdaptator;
+	deformedWindow->setRadialResolution(radialResolution);
+	deformedWindow->computeConnectivity();
+
+	deformableAdaptator = new DeformableModelBasicAdaptator(image3D_,deformedWindow,numberOfDeformIteration_,contrast);
+	setRefinementParameters(deformableAdaptator);
+	deformableAdaptator->setFixedPoints(fixedPoints);
+	deformableAdaptator->adaptation();
+	SpinalCord* refinedWindow = deformableAdaptator->getSpinalCordOutput();
+	delete deformableAdaptator->getOutput();
+	delete deformableAdaptator;
+	delete deformedWindow;
+	refinedWindow->setRadialResolution(radialResolution);
+
+	// le lissage deplace aussi les anneaux du bord, qui sont remis a leur position
+	refinedWindow->smoothing(20);
+	// les positions passent par setPositions pour que les centres des disques gardes par SpinalCord soient mis a jour
+	vector<Vertex*>& refinedPoints = refinedWindow->getListPoints();
+	vector<double> refinedPositions(3*numberOfPoints);
+	for (int i=0; i<numberOfPoints; i++) {
+		CVector3 p = fixedPoints[i] ? regionPoints[i] : refinedPoints[i]->getPosition();
+		refinedPositions[3*i] = p[0]; refinedPositions[3*i+1] = p[1]; refinedPositions[3*i+2] = p[2];
+	}
+	refinedWindow->setPositions(refinedPositions.data(),numberOfPoints);
+
+	/******************************************************************************************
+	 * Splicing of the corrected window and update of the binary image in the slab of the window only
+	 *****************************************************************************************/
+	segmentation->replaceDisks(refinedWindow,firstDisk);
+	segmentation->computeNormals();
+	if (mask)
+	{
+		for (int i=0; i<numberOfPoints; i++)
+			regionPoints.push_back(refinedPoints[i]->getPosition());
+		image3D_->UpdateBinaryImageFromMesh(segmentation,mask,regionPoints);
+	}
+	delete refinedWindow;
+	delete window;
+
+	if (segmentation == meshOutputFinal) centerline = meshOutputFinal->computeCenterline();
+	return true;
+}
+
+// Parametres de la deformation finale, communs au raffinement global, par segments et local
+void PropagatedDeformableModel::setRefinementParameters(DeformableModelBasicAdaptator* deformableAdaptator)
+{
+	if (tradeoff_d_bool) deformableAdaptator->setTradeOff(tradeoff_d_);
+	deformableAdaptator->setVerbose(verbose_);
+	deformableAdaptator->changedParameters();
+	deformableAdaptator->setLineSearch(15);
+	deformableAdaptator->setAlpha(25);
+	deformableAdaptator->setBeta(50);
+	deformableAdaptator->setNumberOptimizerIteration(250);
+	deformableAdaptator->setNumberOfIteration(3);
+	deformableAdaptator->addCorrectionPoints(points_mask_correction_);
+}
+
+/*!
+ * Refinement of the mesh by overlapping axial segments, deformed at the same time on different threads.
+ * Each segment is the core part of the mesh assigned to its thread, extended by refinementOverlap_ disks on both sides.
+ * The outermost ring of each overlap is held at its position in the unrefined mesh (fixed points of the adaptator), so that the segments deformed independently
+ * stay anchored to the same rings, as the window of correctSegmentation. The other overlap rings are free but have less neighbours than in the whole mesh:
+ * in the overlaps, the positions of both segments are blended with weights decreasing linearly to the ends of each segment.
+ * If coarseImage is provided, mesh is the coarse mesh and each segment is deformed coarse to fine (the subdivision of a segment gives the corresponding disks of the subdivided mesh).
+ * Return 0 if the mesh is too short to be split, the global refinement is then used.
+ */
+SpinalCord* PropagatedDeformableModel::refineBySegments(SpinalCord* mesh, Image3D* coarseImage)
+{
+	int radialResolution = mesh->getRadialResolution(), numberOfDisks = mesh->getNbrOfPoints()/radialResolution;
+	int numberOfSegments = refinementSegments_;
+	if (numberOfSegments <= 0) numberOfSegments = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+	// chaque segment doit etre nettement plus long que ses recouvrements
+	numberOfSegments = min(numberOfSegments,numberOfDisks/(4*max(1,refinementOverlap_)));
+	if (numberOfSegments < 2) return 0;
+	if (verbose_) cout << "Refinement by " << numberOfSegments << " segments" << endl;
+
+	vector<int> firstDisk(numberOfSegments), lastDisk(numberOfSegments);
+	for (int s=0; s<numberOfSegments; s++) {
+		firstDisk[s] = max(0,s*numberOfDisks/numberOfSegments-refinementOverlap_);
+		lastDisk[s] = min(numberOfDisks-1,(s+1)*numberOfDisks/numberOfSegments-1+refinementOverlap_);
+	}
+
+	/******************************************************************************************
+	 * Deformation of the segments, each one on its own thread with its own copy of the images (the image buffers are shared, the interpolators are not)
+	 *****************************************************************************************/
+	vector<SpinalCord*> refinedSegments(numberOfSegments,0);
+	vector<exception_ptr> errors(numberOfSegments);
+	vector<thread> workers;
+	for (int s=0; s<numberOfSegments; s++)
+	{
+		workers.push_back(thread([&,s]() {
+			try {
+				Image3D image(*image3D_);
+				unique_ptr<Image3D> coarse;
+				if (coarseImage != 0) coarse.reset(new Image3D(*coarseImage));
+				SpinalCord* segment = mesh->extractDisks(firstDisk[s],lastDisk[s]);
+				segment->computeConnectivity();
+				// anneaux extremes des recouvrements fixes, les extremites du maillage restent libres
+				int numberOfSegmentPoints = segment->getNbrOfPoints();
+				vector<char> fixedPoints(numberOfSegmentPoints,0);
+				if (s > 0)
+					for (int k=0; k<radialResolution; k++) fixedPoints[k] = 1;
+				if (s < numberOfSegments-1)
+					for (int k=0; k<radialResolution; k++) fixedPoints[numberOfSegmentPoints-radialResolution+k] = 1;
+				DeformableModelBasicAdaptator deformableAdaptator(&image,segment,numberOfDeformIteration_,contrast);
+				setRefinementParameters(&deformableAdaptator);
+				deformableAdaptator.setFixedPoints(fixedPoints);
+				if (coarse) deformableAdaptator.setMultiResolution(coarse.get(),radialResolution);
+				deformableAdaptator.adaptation();
+				refinedSegments[s] = deformableAdaptator.getSpinalCordOutput();
+				delete deformableAdaptator.getOutput();
+				delete segment;
+			}
+			catch (...) { errors[s] = current_exception(); }
+		}));
+	}
+	for (int s=0; s<numberOfSegments; s++) workers[s].join();
+	for (int s=0; s<numberOfSegments; s++) {
+		if (errors[s]) {
+			for (int t=0; t<numberOfSegments; t++) delete refinedSegments[t];
+			rethrow_exception(errors[s]);
+		}
+	}
+
+	/******************************************************************************************
+	 * Blending of the segments in the subdivided mesh
+	 *****************************************************************************************/
+	SpinalCord* result = new SpinalCord(*mesh);
+	result->setRadialResolution(radialResolution);
+	int scale = 1;
+	if (coarseImage != 0) {
+		result->subdivision();
+		scale = 2;
+	}
+	int fineRadialResolution = result->getRadialResolution(), rampLength = 2*scale*refinementOverlap_;
+	vector<double> positions(3*result->getNbrOfPoints(),0.0), weights(result->getNbrOfPoints()/fineRadialResolution,0.0);
+	for (int s=0; s<numberOfSegments; s++)
+	{
+		vector<Vertex*>& points = refinedSegments[s]->getListPoints();
+		int offset = scale*firstDisk[s], numberOfSegmentDisks = points.size()/fineRadialResolution;
+		for (int d=0; d<numberOfSegmentDisks; d++)
+		{
+			double weight = 1.0;
+			if (s > 0) weight = min(weight,(d+1.0)/(rampLength+1.0));
+			if (s < numberOfSegments-1) weight = min(weight,(numberOfSegmentDisks-d)/(rampLength+1.0));
+			weights[offset+d] += weight;
+			for (int k=0; k<fineRadialResolution; k++) {
+				CVector3 p = points[d*fineRadialResolution+k]->getPosition();
+				int index = (offset+d)*fineRadialResolution+k;
+				positions[3*index] += weight*p[0]; positions[3*index+1] += weight*p[1]; positions[3*index+2] += weight*p[2];
+			}
+		}
+		delete refinedSegments[s];
+	}
+	// les normales et les centres des disques sont recalcules par le lissage qui suit le raffinement
+	unsigned int numberOfResultPoints = result->getNbrOfPoints();
+	for (unsigned int i=0; i<numberOfResultPoints; i++) {
+		double weight = weights[i/fineRadialResolution];
+		positions[3*i] /= weight; positions[3*i+1] /= weight; positions[3*i+2] /= weight;
+	}
+	result->setPositions(positions.data(),numberOfResultPoints);
+	result->computeTrianglesBarycentre();
+	return result;
+}
+
 void PropagatedDeformableModel::blockBothExtremesOfMesh(SpinalCord* m, int resolutionRadiale)
 {
 	vector<Vertex*> points = m->getListPoints();
@@ -14,6 +14,9 @@
 #include "../util/Vector3.h"
 #include "SpinalCord.h"
 #include "BSplineApproximation.h"
+#include "PropagationCheckpoint.h"
+
+class DeformableModelBasicAdaptator;
 
 
 /*!
@@ -34,6 +37,8 @@ public:
 	void setInitialPointAndNormals(CVector3 initialPoint, CVector3 normal1, CVector3 normal2);
     void setStretchingFactor(double stretchingFactor) { stretchingFactor_ = stretchingFactor; };
 	void setUpAndDownLimits(int downLimit, int upLimit);
+	//! Stop the propagation when the position point*axis of the mesh end is out of [lowerBound, upperBound] (physical coordinates)
+	void setAxialBounds(CVector3 axis, double lowerBound, double upperBound);
 	void computeMeshInitial();
 	void adaptationGlobale();
 	void rafinementGlobal();
@@ -63,6 +68,32 @@ public:
     void setMinContrast(double min) { minContrast = min; };
 
 	void setTradeOffDistanceFeature(double tradeoff_d) { tradeoff_d_ = tradeoff_d; tradeoff_d_bool = true; };
+
+	//! Adaptive axial step: the length added at each propagation step varies between minStep and maxStep (mm), so that the spinal cord turns by at most maxTurnAngle (degrees) per step.
+	void setAdaptiveAxialStep(double minStep, double maxStep, double maxTurnAngle=5.0) { adaptiveAxialStep_ = true; minAxialStep_ = minStep; maxAxialStep_ = maxStep; maxTurnAngle_ = maxTurnAngle; };
+	bool getAdaptiveAxialStep() { return adaptiveAxialStep_; };
+
+	//! Keep a checkpoint of the propagation every interval steps and at the end of the propagation. If filePrefix is not empty, checkpoints are also written to filePrefix_<direction>_<step>.ckpt
+	void setCheckpointInterval(int interval, std::string filePrefix="") { checkpointInterval_ = interval; checkpointFilePrefix_ = filePrefix; };
+	const std::vector<PropagationCheckpoint>& getCheckpoints(int direction) { return checkpoints_[direction-1]; };
+	//! The next calls to adaptationGlobale() continue the propagation of checkpoint.direction from the checkpoint, instead of deforming the initial tube and propagating from the start.
+	void resumeFromCheckpoint(const PropagationCheckpoint& checkpoint);
+	bool resumeFromCheckpoint(std::string filename);
+	void clearResumeCheckpoints() { hasResumeCheckpoint_[0] = false; hasResumeCheckpoint_[1] = false; };
+
+	//! Global refinement coarse to fine: the mesh is first deformed before subdivision on a smoothed and downsampled image, then subdivided and deformed with fewer iterations on the full image (see DeformableModelBasicAdaptator::setMultiResolution). Off by default.
+	void setCoarseToFineRefinement(bool coarseToFine=true) { coarseToFineRefinement_ = coarseToFine; };
+
+	//! Refine the mesh by overlapping axial segments deformed in parallel. numberOfSegments=0 uses one segment per thread, overlap is in disks of the mesh before subdivision.
+	void setPartitionedRefinement(int numberOfSegments=0, int overlap=5) { partitionedRefinement_ = true; refinementSegments_ = numberOfSegments; refinementOverlap_ = overlap; };
+
+	//! Orientation of each propagation step by a parallel grid search over the admissible rotations, see GlobalAdaptation::setGridSearch. numberOfThreads=0 uses all the threads of ITK, shared by both directions.
+	void setRotationGridSearch(int gridResolution=7, int numberOfCandidates=3, int numberOfThreads=0) { rotationGridResolution_ = gridResolution; rotationCandidates_ = numberOfCandidates; rotationSearchThreads_ = numberOfThreads; };
+
+	static SpinalCord* mergeSpinalCordPieces(const std::vector<SpinalCord*>& pieces, const std::vector<int>& firstDisk, const std::vector<int>& lastDisk, const std::vector<bool>& reversed);
+
+	//! Correct locally segmentation (e.g. getOutputFinal()) around new correction points, without propagating again. The slab of mask around the correction is updated if mask is provided.
+	bool correctSegmentation(SpinalCord* segmentation, const std::vector<CVector3>& correctionPoints, BinaryImageType::Pointer mask=nullptr, double margin=10.0);
     
     void setVerbose(bool verbose) { verbose_ = verbose; };
     bool getVerbose() { return verbose_; };
@@ -70,11 +101,39 @@ public:
     void addCorrectionPoints(std::vector<CVector3> points_mask_correction) { points_mask_correction_ = points_mask_correction; };
 
 private:
+	/*!
+	 * \struct PropagationContext
+	 * \brief State of the propagation in one direction. Each direction has its own context so that both directions can be propagated at the same time.
+	 */
+	struct PropagationContext
+	{
+		PropagationContext(Image3D* im, const std::vector< std::pair<CVector3,double> >& c=std::vector< std::pair<CVector3,double> >(), const std::vector<CVector3>& cl=std::vector<CVector3>()):
+			image(im), meshOutput(0), centerline(cl), contrast(c), meanContrast(0.0), meanArea(0.0), resume(0) { area[0] = 0.0; area[1] = 0.0; area[2] = 0.0; };
+
+		Image3D* image; // copie propre au thread (interpolateurs non partages)
+		SpinalCord* meshOutput;
+		std::vector<CVector3> centerline;
+		std::vector< std::pair<CVector3,double> > contrast;
+		double meanContrast, area[3], meanArea;
+
+		const PropagationCheckpoint* resume; // etat a partir duquel la propagation reprend, 0 pour partir du tube initial
+		std::vector<PropagationCheckpoint> checkpoints;
+	};
+
+	void initializeContext(int direction, PropagationContext& context);
+	void storeCheckpoints(int direction, PropagationContext& context);
+	void setRefinementParameters(DeformableModelBasicAdaptator* deformableAdaptator);
+	SpinalCord* refineBySegments(SpinalCord* mesh, Image3D* coarseImage);
+	bool insideAxialBounds(const CVector3& point);
+
 	SpinalCord* mergeBidirectionalSpinalCord(SpinalCord* spinalCord1, SpinalCord* spinalCord2);
-	SpinalCord* propagationMesh(int numberOfMesh=1);
-	float computeContrast(Referential& refInitial);
+	SpinalCord* propagationMesh(int numberOfMesh, PropagationContext& context);
+	float computeContrast(Referential& refInitial, Image3D* image);
 	void computeNewBand(SpinalCord* mesh, CVector3 initialPoint, CVector3 nextPoint, int resolution);
 	void blockBothExtremesOfMesh(SpinalCord* m, int resolutionRadiale);
+	double computeAdaptiveAxialStep(const std::vector<CVector3>& diskCentroids, int numberOfDisks, double lastStep, double lastRotationAngle, double relativeContrast);
+	void setMeshAxialLength(SpinalCord* mesh, int numberOfDisks, double length);
+	static double rotationAngle(const CMatrix4x4& transformation);
 
 	std::vector<CVector3> centerline, initial_centerline;
 	CVector3 initialPoint_, initialNormal1_, initialNormal2_;
@@ -93,17 +152,34 @@ private:
 	Image3D* image3D_;
 
 	int downLimit, upLimit;
+	bool hasAxialBounds_;
+	CVector3 axialBoundsAxis_;
+	double lowerAxialBound_, upperAxialBound_;
     double init_position_;
 
 	// Deformable models adaptator parameters
 	bool changedParameters_;
-	double line_search, alpha, beta, meanContrast, area[3], meanArea;
+	double line_search, alpha, beta, meanContrast;
     std::vector< std::pair<CVector3,double> > contrast;
     
     double maxDeformation, maxArea, minContrast;
 
 	double tradeoff_d_;
 	bool tradeoff_d_bool;
+
+	bool adaptiveAxialStep_;
+	double minAxialStep_, maxAxialStep_, maxTurnAngle_;
+
+	int checkpointInterval_;
+	std::string checkpointFilePrefix_;
+	std::vector<PropagationCheckpoint> checkpoints_[2];
+	PropagationCheckpoint resumeCheckpoint_[2];
+	bool hasResumeCheckpoint_[2];
+
+	bool coarseToFineRefinement_;
+	bool partitionedRefinement_;
+	int refinementSegments_, refinementOverlap_;
+	int rotationGridResolution_, rotationCandidates_, rotationSearchThreads_;
     
     BSplineApproximation centerline_approximator;
     double range;
@@ -0,0 +1,241 @@
+#include "PropagationCheckpoint.h"
+
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+
+// Format du fichier : identifiant, version, puis les champs dans l'ordre de write()
+static const char checkpointMagic[4] = {'P','S','C','K'};
+static const int32_t checkpointVersion = 2; // 2 : positions en double
+
+template <typename T>
+static void writeValue(ostream& os, const T& value)
+{
+	os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static void readValue(istream& is, T& value)
+{
+	is.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static void writeVector(ostream& os, const vector<T>& v)
+{
+	writeValue(os, (uint32_t)v.size());
+	if (!v.empty()) os.write(reinterpret_cast<const char*>(&v[0]), v.size()*sizeof(T));
+}
+
+template <typename T>
+static bool readVector(istream& is, vector<T>& v)
+{
+	uint32_t size = 0;
+	readValue(is, size);
+	if (!is) return false;
+	v.resize(size);
+	if (size != 0) is.read(reinterpret_cast<char*>(&v[0]), size*sizeof(T));
+	return (bool)is;
+}
+
+static void writePoint(ostream& os, const CVector3& p)
+{
+	double coordinates[3] = {p[0], p[1], p[2]};
+	os.write(reinterpret_cast<const char*>(coordinates), sizeof(coordinates));
+}
+
+static void readPoint(istream& is, CVector3& p)
+{
+	double coordinates[3];
+	is.read(reinterpret_cast<char*>(coordinates), sizeof(coordinates));
+	p = CVector3(coordinates[0], coordinates[1], coordinates[2]);
+}
+
+
+PropagationCheckpoint::PropagationCheckpoint(): direction(1), step(0), radialResolution(0), finished(false), meanContrast(0.0), meanArea(0.0),
+	numberOfBadOrientation(0), numberOfBadOrientationTotal(0), initialRotationValue(0.0), axialStep(0.0), lastRotationAngle(0.0)
+{
+	area[0] = 0.0; area[1] = 0.0; area[2] = 0.0;
+}
+
+
+void PropagationCheckpoint::storeMesh(SpinalCord* mesh, vector<double>& points, vector<char>& deform, vector<int>& triangles)
+{
+	vector<Vertex*>& listPoints = mesh->getListPoints();
+	unsigned int nbPoints = listPoints.size();
+	points.resize(6*nbPoints);
+	deform.resize(nbPoints);
+	for (unsigned int i=0; i<nbPoints; i++)
+	{
+		CVector3 p = listPoints[i]->getPosition(), n = listPoints[i]->getNormal();
+		points[6*i] = p[0]; points[6*i+1] = p[1]; points[6*i+2] = p[2];
+		points[6*i+3] = n[0]; points[6*i+4] = n[1]; points[6*i+5] = n[2];
+		deform[i] = listPoints[i]->hasToBeDeform();
+	}
+	triangles = mesh->getListTriangles();
+}
+
+
+SpinalCord* PropagationCheckpoint::restoreMesh(const vector<double>& points, const vector<char>& deform, const vector<int>& triangles, int radialResolution)
+{
+	SpinalCord* mesh = new SpinalCord();
+	mesh->setRadialResolution(radialResolution);
+	for (unsigned int i=0; i<deform.size(); i++)
+	{
+		Vertex* v = new Vertex(CVector3(points[6*i],points[6*i+1],points[6*i+2]),CVector3(points[6*i+3],points[6*i+4],points[6*i+5]));
+		v->setDeform(deform[i] != 0);
+		mesh->addPoint(v);
+	}
+	for (unsigned int i=0; i+2<triangles.size(); i+=3)
+		mesh->addTriangle(triangles[i],triangles[i+1],triangles[i+2]);
+	mesh->computeConnectivity();
+	mesh->computeTrianglesBarycentre();
+	return mesh;
+}
+
+
+// Tailles des buffers coherentes et indices des triangles dans le maillage, pour que restoreMesh ne lise pas en dehors des buffers
+bool PropagationCheckpoint::isValidMesh(const vector<double>& points, const vector<char>& deform, const vector<int>& triangles, int radialResolution)
+{
+	unsigned int nbPoints = deform.size();
+	if (points.size() != 6*(size_t)nbPoints || triangles.size()%3 != 0 || nbPoints%radialResolution != 0) return false;
+	for (unsigned int i=0; i<triangles.size(); i++)
+		if (triangles[i] < 0 || (unsigned int)triangles[i] >= nbPoints) return false;
+	return true;
+}
+
+
+CVector3 PropagationCheckpoint::getLastPosition() const
+{
+	CVector3 result;
+	unsigned int nbPoints = meshDeform.size();
+	if (radialResolution <= 0 || nbPoints < (unsigned int)radialResolution) return result;
+	for (unsigned int i=nbPoints-radialResolution; i<nbPoints; i++)
+		result += CVector3(meshPoints[6*i],meshPoints[6*i+1],meshPoints[6*i+2]);
+	result /= (double)radialResolution;
+	return result;
+}
+
+
+void PropagationCheckpoint::write(ostream& os) const
+{
+	os.write(checkpointMagic, sizeof(checkpointMagic));
+	writeValue(os, checkpointVersion);
+	writeValue(os, (int32_t)direction);
+	writeValue(os, (int32_t)step);
+	writeValue(os, (int32_t)radialResolution);
+	writeValue(os, (char)finished);
+
+	writeVector(os, meshPoints);
+	writeVector(os, meshDeform);
+	writeVector(os, meshTriangles);
+	writeVector(os, templatePoints);
+	writeVector(os, templateDeform);
+	writeVector(os, templateTriangles);
+
+	writeValue(os, (uint32_t)contrast.size());
+	for (unsigned int i=0; i<contrast.size(); i++) {
+		writePoint(os, contrast[i].first);
+		writeValue(os, contrast[i].second);
+	}
+	writeValue(os, (uint32_t)centerline.size());
+	for (unsigned int i=0; i<centerline.size(); i++)
+		writePoint(os, centerline[i]);
+	writeValue(os, meanContrast);
+	writeValue(os, area);
+	writeValue(os, meanArea);
+
+	writeValue(os, (int32_t)numberOfBadOrientation);
+	writeValue(os, (int32_t)numberOfBadOrientationTotal);
+	writePoint(os, position);
+	writePoint(os, lastPoint);
+	writeValue(os, initialRotationValue);
+	writeValue(os, axialStep);
+	writeValue(os, lastRotationAngle);
+}
+
+
+bool PropagationCheckpoint::read(istream& is)
+{
+	char magic[4];
+	int32_t version = 0;
+	is.read(magic, sizeof(magic));
+	readValue(is, version);
+	if (!is || memcmp(magic, checkpointMagic, sizeof(magic)) != 0 || version != checkpointVersion) {
+		cerr << "Error: not a propagation checkpoint or unsupported version" << endl;
+		return false;
+	}
+
+	int32_t value;
+	char flag;
+	readValue(is, value); direction = value;
+	readValue(is, value); step = value;
+	readValue(is, value); radialResolution = value;
+	readValue(is, flag); finished = flag != 0;
+
+	if (!readVector(is, meshPoints) || !readVector(is, meshDeform) || !readVector(is, meshTriangles)
+		|| !readVector(is, templatePoints) || !readVector(is, templateDeform) || !readVector(is, templateTriangles)) {
+		cerr << "Error: truncated propagation checkpoint" << endl;
+		return false;
+	}
+
+	uint32_t size = 0;
+	readValue(is, size);
+	contrast.resize(size);
+	for (unsigned int i=0; i<size && is; i++) {
+		readPoint(is, contrast[i].first);
+		readValue(is, contrast[i].second);
+	}
+	readValue(is, size);
+	centerline.resize(size);
+	for (unsigned int i=0; i<size && is; i++)
+		readPoint(is, centerline[i]);
+	readValue(is, meanContrast);
+	readValue(is, area);
+	readValue(is, meanArea);
+
+	readValue(is, value); numberOfBadOrientation = value;
+	readValue(is, value); numberOfBadOrientationTotal = value;
+	readPoint(is, position);
+	readPoint(is, lastPoint);
+	readValue(is, initialRotationValue);
+	readValue(is, axialStep);
+	readValue(is, lastRotationAngle);
+
+	if (!is) {
+		cerr << "Error: truncated propagation checkpoint" << endl;
+		return false;
+	}
+	if ((direction != 1 && direction != 2) || radialResolution <= 0
+		|| !isValidMesh(meshPoints, meshDeform, meshTriangles, radialResolution) || !isValidMesh(templatePoints, templateDeform, templateTriangles, radialResolution)) {
+		cerr << "Error: corrupted propagation checkpoint" << endl;
+		return false;
+	}
+	return true;
+}
+
+
+bool PropagationCheckpoint::save(string filename) const
+{
+	ofstream file(filename.c_str(), ios::out | ios::binary);
+	if (!file.is_open()) {
+		cerr << "Error: cannot write propagation checkpoint " << filename << endl;
+		return false;
+	}
+	write(file);
+	return (bool)file;
+}
+
+
+bool PropagationCheckpoint::load(string filename)
+{
+	ifstream file(filename.c_str(), ios::in | ios::binary);
+	if (!file.is_open()) {
+		cerr << "Error: cannot open propagation checkpoint " << filename << endl;
+		return false;
+	}
+	return read(file);
+}
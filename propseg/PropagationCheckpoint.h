@@ -0,0 +1,73 @@
+#ifndef __PROPAGATION_CHECKPOINT__
+#define __PROPAGATION_CHECKPOINT__
+
+/*!
+ * \file PropagationCheckpoint.h
+ * \brief Snapshot of the state of the propagation in one direction
+ * \author Benjamin De Leener - NeuroPoly (http://www.neuropoly.info)
+ */
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <utility>
+
+#include "../util/Vector3.h"
+#include "SpinalCord.h"
+
+/*!
+ * \class PropagationCheckpoint
+ * \brief State of the propagation of PropagatedDeformableModel in one direction, after a given propagation step.
+ *
+ * It contains everything the propagation loop needs to continue: the output mesh (before smoothing), the template mesh duplicated at each step,
+ * the contrast and cross-sectional area history, the bad orientation counters and the positions used by the next step.
+ * Meshes are stored as flat buffers (position, normal and deformation flag of each vertex, triangles), so that a checkpoint can be kept in memory
+ * or written to a compact binary file. Positions are kept in double precision, so that a propagation resumed from a checkpoint continues from exactly
+ * the same state. The file is in native byte order and is only meant to be read back on the same kind of machine.
+ */
+class PropagationCheckpoint
+{
+public:
+	PropagationCheckpoint();
+	~PropagationCheckpoint() {};
+
+	//! Copy the points and triangles of a spinal cord mesh in the flat buffers of the checkpoint
+	static void storeMesh(SpinalCord* mesh, std::vector<double>& points, std::vector<char>& deform, std::vector<int>& triangles);
+	//! Create a new spinal cord mesh (connectivity and triangles barycentres computed) from flat buffers
+	static SpinalCord* restoreMesh(const std::vector<double>& points, const std::vector<char>& deform, const std::vector<int>& triangles, int radialResolution);
+
+	void setMeshOutput(SpinalCord* mesh) { storeMesh(mesh, meshPoints, meshDeform, meshTriangles); };
+	void setTemplateMesh(SpinalCord* mesh) { storeMesh(mesh, templatePoints, templateDeform, templateTriangles); };
+	SpinalCord* getMeshOutput() const { return restoreMesh(meshPoints, meshDeform, meshTriangles, radialResolution); };
+	SpinalCord* getTemplateMesh() const { return restoreMesh(templatePoints, templateDeform, templateTriangles, radialResolution); };
+
+	//! Center of the last disk of the output mesh, i.e. the position reached by the propagation
+	CVector3 getLastPosition() const;
+	unsigned int getNumberOfDisks() const { return radialResolution == 0 ? 0 : meshDeform.size()/radialResolution; };
+
+	void write(std::ostream& os) const;
+	//! Return false if the stream is not a checkpoint, is truncated or contains inconsistent meshes
+	bool read(std::istream& is);
+	bool save(std::string filename) const;
+	bool load(std::string filename);
+
+	int direction, step, radialResolution;
+	bool finished; // la propagation s'est arretee apres ce pas
+
+	std::vector<double> meshPoints, templatePoints; // x y z nx ny nz pour chaque point
+	std::vector<char> meshDeform, templateDeform;
+	std::vector<int> meshTriangles, templateTriangles;
+
+	std::vector< std::pair<CVector3,double> > contrast;
+	std::vector<CVector3> centerline;
+	double meanContrast, area[3], meanArea;
+
+	int numberOfBadOrientation, numberOfBadOrientationTotal;
+	CVector3 position, lastPoint;
+	double initialRotationValue, axialStep, lastRotationAngle;
+
+private:
+	static bool isValidMesh(const std::vector<double>& points, const std::vector<char>& deform, const std::vector<int>& triangles, int radialResolution);
+};
+
+#endif
@@ -1,5 +1,13 @@
 #include "SegmentationPropagation.h"
 
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include <itkMultiThreaderBase.h>
+
 SegmentationPropagation::SegmentationPropagation()
 {
 	vtkOutputWindow::GetInstance()->SetGlobalWarningDisplay(0);
@@ -21,6 +29,14 @@ SegmentationPropagation::SegmentationPropagation()
 
 BinaryImageType::Pointer SegmentationPropagation::run(ImageType::Pointer image)
 {
+	segmentation_ = nullptr;
+	propagtedDeformableModelPointer_.reset();
+	seedModels_.clear();
+	seedImages_.clear();
+	seedPoints_.clear();
+	stitchedSpinalCord_.reset();
+	image3D_.reset();
+
 	orientationFilterPointer_->setInputImage(image);
 	orientationFilterPointer_->orientation(itk::SpatialOrientation::ITK_COORDINATE_ORIENTATION_AIL);
 
@@ -38,35 +54,273 @@ BinaryImageType::Pointer SegmentationPropagation::run(ImageType::Pointer image)
 	rescaleFilter_->Update();
 
 	ImageType::Pointer rescaledImage = rescaleFilter_->GetOutput();
+
+	// a checkpoint continues the propagation of a single seed
+	int numberOfSeeds = resumeCheckpoints_.empty() ? computeNumberOfSeeds(rescaledImage) : 1;
+	if (numberOfSeeds > 1)
+	{
+		BinaryImageType::Pointer segmentation = runMultiSeed(image, rescaledImage, numberOfSeeds);
+		if (segmentation) return segmentation;
+	}
 	
 	performInitialization(rescaleFilter_->GetOutput());
 	initialisationPointer_->getPoints(point_, normal1_, normal2_, radius_, stretchingFactor_);
-	std::unique_ptr<Image3D> image3D = makeImage3D(image);
+	image3D_ = makeImage3D(image);
+
+	propagtedDeformableModelPointer_ = createDeformableModel(radius_, stretchingFactor_);
+	if (partitionedRefinement_) propagtedDeformableModelPointer_->setPartitionedRefinement();
+	for (const PropagationCheckpoint& checkpoint : resumeCheckpoints_)
+		propagtedDeformableModelPointer_->resumeFromCheckpoint(checkpoint);
+	resumeCheckpoints_.clear();
+
+	propagtedDeformableModelPointer_->setInitialPointAndNormals(point_, normal1_, normal2_);
+	propagtedDeformableModelPointer_->setImage3D(image3D_.get());
+	propagtedDeformableModelPointer_->computeMeshInitial();
+	propagtedDeformableModelPointer_->adaptationGlobale();
+	propagtedDeformableModelPointer_->rafinementGlobal();
+
+	SpinalCord* spinalCord = propagtedDeformableModelPointer_->getOutputFinal();
+	segmentation_ = image3D_->TransformMeshToBinaryImage(spinalCord);
+
+	return segmentation_;
+}
 
-	propagtedDeformableModelPointer_ = std::make_unique<PropagatedDeformableModel>(
+BinaryImageType::Pointer SegmentationPropagation::correct(const std::vector<CVector3>& correctionPoints)
+{
+	if (!segmentation_ || correctionPoints.empty()) return nullptr;
+
+	PropagatedDeformableModel* deformableModel = propagtedDeformableModelPointer_.get();
+	SpinalCord* spinalCord = nullptr;
+	if (deformableModel) spinalCord = deformableModel->getOutputFinal();
+	else
+	{
+		// Several seeds: the model of the seed nearest to the correction points has the image copy and the contrast of this part of the spinal cord
+		CVector3 center;
+		for (const CVector3& point : correctionPoints) center += point;
+		center /= (double)correctionPoints.size();
+		size_t nearest = 0;
+		for (size_t k = 1; k < seedPoints_.size(); k++)
+			if ((seedPoints_[k] - center).Norm() < (seedPoints_[nearest] - center).Norm()) nearest = k;
+		deformableModel = seedModels_[nearest].get();
+		spinalCord = stitchedSpinalCord_.get();
+	}
+
+	if (!deformableModel->correctSegmentation(spinalCord, correctionPoints, segmentation_))
+	{
+		std::cerr << "Error: unable to correct the segmentation." << std::endl;
+		return nullptr;
+	}
+	return segmentation_;
+}
+
+std::unique_ptr<PropagatedDeformableModel> SegmentationPropagation::createDeformableModel(double radius, double stretchingFactor)
+{
+	std::unique_ptr<PropagatedDeformableModel> deformableModel = std::make_unique<PropagatedDeformableModel>(
 		radialResolution_,
 		axialResolution_,
-		radius_,
+		radius,
 		numberOfDeformIteration_,
 		numberOfPropagationIteration_,
 		axialStep_,
 		propagationLength_
 		);
 
-	propagtedDeformableModelPointer_->setMinContrast(minContrast_);
-	propagtedDeformableModelPointer_->setStretchingFactor(stretchingFactor_);
-	propagtedDeformableModelPointer_->setUpAndDownLimits(downSlice_ - 5, upSlice_ + 5);
+	deformableModel->setMinContrast(minContrast_);
+	deformableModel->setStretchingFactor(stretchingFactor);
+	deformableModel->setUpAndDownLimits(downSlice_ - 5, upSlice_ + 5);
+	if (adaptiveAxialStep_) deformableModel->setAdaptiveAxialStep(minAxialStep_, maxAxialStep_, maxTurnAngle_);
+	if (rotationGridSearch_) deformableModel->setRotationGridSearch();
+	if (checkpointInterval_ > 0) deformableModel->setCheckpointInterval(checkpointInterval_, checkpointFilePrefix_);
+	return deformableModel;
+}
 
-	propagtedDeformableModelPointer_->setInitialPointAndNormals(point_, normal1_, normal2_);
-	propagtedDeformableModelPointer_->setImage3D(image3D.get());
-	propagtedDeformableModelPointer_->computeMeshInitial();
-	propagtedDeformableModelPointer_->adaptationGlobale();
-	propagtedDeformableModelPointer_->rafinementGlobal();
+bool SegmentationPropagation::resumeFromCheckpoint(std::string filename)
+{
+	PropagationCheckpoint checkpoint;
+	if (!checkpoint.load(filename)) return false;
+	resumeCheckpoints_.push_back(checkpoint);
+	return true;
+}
 
-	SpinalCord* spinalCord = propagtedDeformableModelPointer_->getOutputFinal();
-	BinaryImageType::Pointer segmentration = image3D->TransformMeshToBinaryImage(spinalCord);
+int SegmentationPropagation::computeNumberOfSeeds(ImageType::Pointer orientedImage)
+{
+	if (numberOfSeeds_ > 0) return numberOfSeeds_;
+	// AIL orientation: the second axis of the image is the S-I axis
+	ImageType::SizeType size = orientedImage->GetLargestPossibleRegion().GetSize();
+	double length = size[1] * orientedImage->GetSpacing()[1];
+	return std::max(1, (int)std::lround(length / seedSpacing_));
+}
+
+/*
+ * Propagation from several seeds distributed along the S-I axis of the oriented image.
+ * Each seed is propagated in both directions in its own thread, up to the middle between its neighbouring seeds (plus an overlap).
+ * The meshes are then cut at the middle planes and stitched together. Returns nullptr if less than two seeds are detected or if no piece is left to stitch.
+ */
+BinaryImageType::Pointer SegmentationPropagation::runMultiSeed(ImageType::Pointer image, ImageType::Pointer orientedImage, int numberOfSeeds)
+{
+	ImageType::DirectionType direction = orientedImage->GetDirection();
+	CVector3 axis = CVector3(direction[0][1], direction[1][1], direction[2][1]);
+
+	struct Seed
+	{
+		CVector3 point, normal1, normal2;
+		double radius, stretchingFactor, position;
+	};
+	std::vector<Seed> seeds;
+	for (int k = 0; k < numberOfSeeds; k++)
+	{
+		// Detection is kept sequential, it is fast compared to the propagation
+		Initialisation initialisation(orientedImage, typeImageFactor_);
+		initialisation.setGap(gapInterSlices_);
+		initialisation.setRadius(radius_);
+		initialisation.setNumberOfSlices(nbSlicesInitialisation_);
+		initialisation.setPyramidFactor(pyramidFactorInitialisation_);
+		if (!initialisation.computeInitialParameters((k + 0.5) / numberOfSeeds)) continue;
+
+		Seed seed;
+		seed.radius = radius_;
+		seed.stretchingFactor = stretchingFactor_;
+		initialisation.getPoints(seed.point, seed.normal1, seed.normal2, seed.radius, seed.stretchingFactor);
+		seed.position = seed.point * axis;
+		seeds.push_back(seed);
+	}
+	std::sort(seeds.begin(), seeds.end(), [](const Seed& a, const Seed& b) { return a.position < b.position; });
+	// Two seeds found on the same portion of the cord are merged
+	std::vector<Seed> distinctSeeds;
+	for (const Seed& seed : seeds)
+		if (distinctSeeds.empty() || seed.position - distinctSeeds.back().position > 2.0 * seedOverlap_)
+			distinctSeeds.push_back(seed);
+	seeds.swap(distinctSeeds);
+	if (seeds.size() < 2)
+	{
+		std::cerr << "Warning: less than two seeds detected, propagation from a single seed." << std::endl;
+		return nullptr;
+	}
+
+	const size_t n = seeds.size();
+	std::vector<double> middle(n - 1);
+	for (size_t k = 0; k + 1 < n; k++)
+		middle[k] = (seeds[k].position + seeds[k + 1].position) / 2.0;
+
+	std::unique_ptr<Image3D> image3D = makeImage3D(image);
+	unsigned int numberOfThreads = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+	std::vector<std::unique_ptr<Image3D>> images(n);
+	std::vector<std::unique_ptr<PropagatedDeformableModel>> models(n);
+	for (size_t k = 0; k < n; k++)
+	{
+		// One copy of the image per thread: images are shared, interpolators are not
+		images[k] = std::make_unique<Image3D>(*image3D);
+		models[k] = createDeformableModel(seeds[k].radius, seeds[k].stretchingFactor);
+		if (partitionedRefinement_) models[k]->setPartitionedRefinement(std::max(1, (int)(numberOfThreads / n)));
+		if (rotationGridSearch_) models[k]->setRotationGridSearch(7, 3, std::max(1, (int)(numberOfThreads / n)));
+		if (checkpointInterval_ > 0 && !checkpointFilePrefix_.empty()) models[k]->setCheckpointInterval(checkpointInterval_, checkpointFilePrefix_ + "_seed" + std::to_string(k));
+		double lowerBound = (k == 0) ? -std::numeric_limits<double>::max() : middle[k - 1] - seedOverlap_;
+		double upperBound = (k == n - 1) ? std::numeric_limits<double>::max() : middle[k] + seedOverlap_;
+		models[k]->setAxialBounds(axis, lowerBound, upperBound);
+		models[k]->setInitialPointAndNormals(seeds[k].point, seeds[k].normal1, seeds[k].normal2);
+		models[k]->setImage3D(images[k].get());
+	}
+
+	std::vector<std::thread> threads;
+	std::vector<std::exception_ptr> errors(n);
+	for (size_t k = 0; k < n; k++)
+	{
+		threads.emplace_back([&models, &errors, k]() {
+			try
+			{
+				models[k]->computeMeshInitial();
+				models[k]->adaptationGlobale();
+				models[k]->rafinementGlobal();
+			}
+			catch (...)
+			{
+				errors[k] = std::current_exception();
+			}
+		});
+	}
+	for (std::thread& thread : threads) thread.join();
+	for (std::exception_ptr& error : errors)
+		if (error) std::rethrow_exception(error);
+
+	// Position of the disks along the axis, pieces are traversed in increasing position
+	std::vector<SpinalCord*> pieces;
+	std::vector<std::vector<double>> positions;
+	std::vector<double> seedPositions;
+	std::vector<bool> reversed;
+	for (size_t k = 0; k < n; k++)
+	{
+		SpinalCord* piece = models[k]->getOutputFinal();
+		int radialResolution = piece->getRadialResolution();
+		int numberOfDisks = piece->getNbrOfPoints() / radialResolution;
+		if (numberOfDisks == 0) continue;
+		std::vector<Vertex*>& points = piece->getListPoints();
+		std::vector<double> t(numberOfDisks);
+		for (int d = 0; d < numberOfDisks; d++)
+		{
+			CVector3 center;
+			for (int j = 0; j < radialResolution; j++) center += points[d * radialResolution + j]->getPosition();
+			t[d] = (center / (double)radialResolution) * axis;
+		}
+		bool backward = t.front() > t.back();
+		if (backward) std::reverse(t.begin(), t.end());
+		// The cuts below need positions increasing along the piece: a disk going back along the axis (e.g. at a noisy end) is kept at the position of the previous one
+		for (int d = 1; d < numberOfDisks; d++) t[d] = std::max(t[d], t[d - 1]);
+		pieces.push_back(piece);
+		positions.push_back(t);
+		seedPositions.push_back(seeds[k].position);
+		reversed.push_back(backward);
+	}
+	if (pieces.empty())
+	{
+		std::cerr << "Warning: empty propagation from all the seeds, propagation from a single seed." << std::endl;
+		return nullptr;
+	}
+
+	// Cut between two pieces at the middle plane. If a front did not reach it, the other piece fills the gap with its overlap.
+	std::vector<int> firstDisk, lastDisk;
+	std::vector<SpinalCord*> keptPieces;
+	std::vector<bool> keptReversed;
+	double lowerCut = -std::numeric_limits<double>::max();
+	for (size_t k = 0; k < pieces.size(); k++)
+	{
+		const std::vector<double>& t = positions[k];
+		double upperCut = std::numeric_limits<double>::max();
+		if (k + 1 < pieces.size())
+		{
+			upperCut = (seedPositions[k] + seedPositions[k + 1]) / 2.0;
+			if (t.back() < upperCut) upperCut = t.back();
+			else if (positions[k + 1].front() > upperCut) upperCut = std::min(t.back(), positions[k + 1].front());
+		}
+		int numberOfDisks = t.size();
+		int begin = 0;
+		while (begin < numberOfDisks && t[begin] <= lowerCut) begin++;
+		int end = begin;
+		while (end < numberOfDisks && t[end] <= upperCut) end++;
+		lowerCut = upperCut;
+		if (end == begin) continue;
+		// indices dans le maillage d'origine
+		int d1 = reversed[k] ? numberOfDisks - 1 - begin : begin, d2 = reversed[k] ? numberOfDisks - 1 - (end - 1) : end - 1;
+		keptPieces.push_back(pieces[k]);
+		firstDisk.push_back(std::min(d1, d2));
+		lastDisk.push_back(std::max(d1, d2));
+		keptReversed.push_back(reversed[k]);
+	}
+	if (keptPieces.empty())
+	{
+		std::cerr << "Warning: no piece left after cutting the seed propagations, propagation from a single seed." << std::endl;
+		return nullptr;
+	}
+
+	std::unique_ptr<SpinalCord> spinalCord(PropagatedDeformableModel::mergeSpinalCordPieces(keptPieces, firstDisk, lastDisk, keptReversed));
+	segmentation_ = image3D->TransformMeshToBinaryImage(spinalCord.get());
 
-	return segmentration;
+	// kept for correct()
+	image3D_ = std::move(image3D);
+	seedModels_ = std::move(models);
+	seedImages_ = std::move(images);
+	for (const Seed& seed : seeds) seedPoints_.push_back(seed.point);
+	stitchedSpinalCord_ = std::move(spinalCord);
+	return segmentation_;
 }
 
 void SegmentationPropagation::performInitialization(ImageType::Pointer image)
@@ -75,6 +329,7 @@ void SegmentationPropagation::performInitialization(ImageType::Pointer image)
 	initialisationPointer_->setGap(gapInterSlices_);
 	initialisationPointer_->setRadius(radius_);
 	initialisationPointer_->setNumberOfSlices(nbSlicesInitialisation_);
+	initialisationPointer_->setPyramidFactor(pyramidFactorInitialisation_);
 	if (!initialisationPointer_->computeInitialParameters(initialisation_))
 	{
 		std::cerr << "Error: unable to initialize." << std::endl;
@@ -44,10 +44,31 @@ public:
 	~SegmentationPropagation() {};
 
 	BinaryImageType::Pointer run(ImageType::Pointer image);
+	// Local correction of the segmentation returned by the last call to run() around new correction points (physical coordinates), without propagating again.
+	// Only the slab around the correction is updated in the mask returned by run(), which is returned. Returns nullptr if there is nothing to correct.
+	BinaryImageType::Pointer correct(const std::vector<CVector3>& correctionPoints);
+
+	// 1: single seed (default), 0: number of seeds computed from the length of the image along the S-I axis, >1: propagation from several seeds stitched together
+	void setNumberOfSeeds(int numberOfSeeds) { numberOfSeeds_ = numberOfSeeds; };
+	// Propagation step length adapted to the curvature of the spinal cord, between minAxialStep_ and maxAxialStep_ (off by default)
+	void setAdaptiveAxialStep(bool adaptiveAxialStep) { adaptiveAxialStep_ = adaptiveAxialStep; };
+	// Global refinement by overlapping axial segments deformed in parallel, blended in the overlaps (off by default)
+	void setPartitionedRefinement(bool partitionedRefinement) { partitionedRefinement_ = partitionedRefinement; };
+	// Orientation of the propagation steps by a parallel grid search instead of the Amoeba optimizer (off by default)
+	void setRotationGridSearch(bool rotationGridSearch) { rotationGridSearch_ = rotationGridSearch; };
+	// Multiscale detection of the spinal cord for the initialisation, see Initialisation::setPyramidFactor. 1: off (default), 0: factor chosen from the in-plane resolution, 2 or 4: downsampling factor
+	void setPyramidFactorInitialisation(int pyramidFactor) { pyramidFactorInitialisation_ = pyramidFactor; };
+	// Checkpoint of the propagation every interval steps (0: off, default), also written to filePrefix_<direction>_<step>.ckpt if filePrefix is not empty (filePrefix_seed<k>_... with several seeds)
+	void setCheckpointInterval(int interval, std::string filePrefix = "") { checkpointInterval_ = interval; checkpointFilePrefix_ = filePrefix; };
+	// The next call to run() continues the propagation from the checkpoint file (one per direction) instead of propagating from the start, from a single seed. Return false if the file cannot be read.
+	bool resumeFromCheckpoint(std::string filename);
 
 private:
 	void performInitialization(ImageType::Pointer image);
 	std::unique_ptr<Image3D> makeImage3D(ImageType::Pointer image);
+	std::unique_ptr<PropagatedDeformableModel> createDeformableModel(double radius, double stretchingFactor);
+	int computeNumberOfSeeds(ImageType::Pointer orientedImage);
+	BinaryImageType::Pointer runMultiSeed(ImageType::Pointer image, ImageType::Pointer orientedImage, int numberOfSeeds);
 
 	MedianFilterType::Pointer medianFilter_;
 	MinMaxCalculatorType::Pointer minMaxCalculator_;
@@ -60,6 +81,14 @@ private:
 
 	std::unique_ptr<Initialisation> initialisationPointer_;
 	std::unique_ptr<PropagatedDeformableModel> propagtedDeformableModelPointer_;
+
+	// State of the last call to run() kept for correct(): image of the propagation and mask, and with several seeds the model and image of each seed and the stitched mesh
+	std::unique_ptr<Image3D> image3D_;
+	BinaryImageType::Pointer segmentation_;
+	std::vector<std::unique_ptr<PropagatedDeformableModel>> seedModels_;
+	std::vector<std::unique_ptr<Image3D>> seedImages_;
+	std::vector<CVector3> seedPoints_;
+	std::unique_ptr<SpinalCord> stitchedSpinalCord_;
 	
 	bool isSpinalCordDetected_;
 	CVector3 point_, normal1_, normal2_;
@@ -67,6 +96,7 @@ private:
 	double radius_ = 4.0;
 	const int gapInterSlices_ = 4;
 	const int nbSlicesInitialisation_ = 5;
+	int pyramidFactorInitialisation_ = 1;
 	const double initialisation_ = 0.5;
 	const double typeImageFactor_ = 1.0; // T2 image for T1 it is -1.0
 	double stretchingFactor_ = 1.0;
@@ -80,7 +110,21 @@ private:
 	const int numberOfDeformIteration_ = 3;
 	const int numberOfPropagationIteration_ = 200;
 	const double axialStep_ = 6.0; 
+	const double minAxialStep_ = 3.0; // adaptive axial step, the step stays below the 15 mm jump stop condition
+	const double maxAxialStep_ = 12.0;
+	const double maxTurnAngle_ = 5.0; // degrees per step
 	const double propagationLength_ = 800.0;
+	bool adaptiveAxialStep_ = false;
+	bool partitionedRefinement_ = false;
+	bool rotationGridSearch_ = false;
+
+	int checkpointInterval_ = 0;
+	std::string checkpointFilePrefix_;
+	std::vector<PropagationCheckpoint> resumeCheckpoints_;
+
+	int numberOfSeeds_ = 1;
+	const double seedSpacing_ = 150.0; // millimeters between seeds along the S-I axis when the number of seeds is automatic
+	const double seedOverlap_ = 10.0; // millimeters of propagation beyond the middle between two seeds
 };
 
 #endif 
\ No newline at end of file
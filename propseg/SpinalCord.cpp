@@ -5,13 +5,11 @@
 #include <fstream>
 #include <string>
 #include <map>
+#include <cmath>
 #include <vtkPlane.h>
-#include <vtkCutter.h>
 #include <vtkSmartPointer.h>
 #include <vtkDoubleArray.h>
 #include <vtkPolyData.h>
-#include <vtkContourTriangulator.h>
-#include <vtkMassProperties.h>
 #include <vtkPointData.h>
 #include <vtkClipPolyData.h>
 #include <vtkPolyDataWriter.h>
@@ -26,6 +24,7 @@
 #include <itkPointSet.h>
 #include <itkBSplineScatteredDataPointSetToImageFilter.h>
 #include <itkBSplineControlPointImageFunction.h>
+#include <itkMultiThreaderBase.h>
 using namespace std;
 
 typedef itk::Image< unsigned char, 3 >	BinaryImageType;
@@ -58,7 +57,9 @@ SpinalCord::SpinalCord()
 
 SpinalCord::~SpinalCord()
 {
-	delete centerline_, crossSectionalArea_, centerline_derivative_;
+	delete centerline_;
+	delete crossSectionalArea_;
+	delete centerline_derivative_;
 }
 
 SpinalCord::SpinalCord(const SpinalCord& sp): Mesh(sp)
@@ -68,6 +69,8 @@ SpinalCord::SpinalCord(const SpinalCord& sp): Mesh(sp)
     centerline_derivative_ = new vector<CVector3>(0);
 	crossSectionalArea_ = new vector<double>(*sp.crossSectionalArea_);
 	length_ = sp.length_;
+	diskCentroids_ = sp.diskCentroids_;
+	arcLength_ = sp.arcLength_;
 }
 
 SpinalCord::SpinalCord(const Mesh& m): Mesh(m)
@@ -82,24 +85,46 @@ SpinalCord::SpinalCord(const Mesh& m): Mesh(m)
 void SpinalCord::Initialize(int radialResolution)
 {
 	radialResolution_ = radialResolution;
-	centerline_ = new vector<CVector3>(0);
-    centerline_derivative_ = new vector<CVector3>(0);
-	crossSectionalArea_ = new vector<double>(0);
+	centerline_->clear();
+    centerline_derivative_->clear();
+	crossSectionalArea_->clear();
 	length_ = 0.0;
+	diskCentroids_.clear();
+	arcLength_.clear();
 }
 
-vector<CVector3> SpinalCord::computeCenterline(bool saveFile, string filename, bool spline)
+void SpinalCord::pointsModified(unsigned int firstPoint)
+{
+	// les disques avant firstPoint sont inchanges
+	unsigned int numberDisks = 0;
+	if (radialResolution_ > 0) numberDisks = firstPoint/radialResolution_;
+	if (diskCentroids_.size() > numberDisks) {
+		diskCentroids_.resize(numberDisks);
+		arcLength_.resize(numberDisks);
+	}
+}
+
+// Calcul des centres de gravite et de la longueur cumulee pour les disques ajoutes depuis le dernier appel seulement
+void SpinalCord::updateDiskCentroids()
 {
+	if (radialResolution_ <= 0) return;
 	unsigned int numberDisks = points_.size()/radialResolution_;
-	centerline_ = new vector<CVector3>(numberDisks);
-	for (unsigned int i=0; i<numberDisks; i++)
+	for (unsigned int i=diskCentroids_.size(); i<numberDisks; i++)
 	{
 		CVector3 result;
 		for (int k=0; k<radialResolution_; k++)
 			result += points_[i*radialResolution_+k]->getPosition();
 		result /= (double)radialResolution_;
-		(*centerline_)[i] = result;
+		if (i == 0) arcLength_.push_back(0.0);
+		else arcLength_.push_back(arcLength_[i-1]+(result-diskCentroids_[i-1]).Norm());
+		diskCentroids_.push_back(result);
 	}
+}
+
+vector<CVector3> SpinalCord::computeCenterline(bool saveFile, string filename, bool spline)
+{
+	updateDiskCentroids();
+	*centerline_ = diskCentroids_;
     
     vector<CVector3> newCenterline, centerline_derivative;
     if (saveFile)
@@ -121,10 +146,7 @@ vector<CVector3> SpinalCord::computeCenterline(bool saveFile, string filename, b
     }
     
     // compute length of spinal cord
-	double length = 0.0;
-	for (unsigned int i=0; i<centerline_->size()-1; i++)
-		length += ((*centerline_)[i+1]-(*centerline_)[i]).Norm();
-	length_ = length;
+	length_ = arcLength_.empty()?0.0:arcLength_.back();
 
 	if (saveFile && !spline) {
         ofstream myfile;
@@ -332,53 +354,46 @@ void SpinalCord::saveCenterline(string filename)
 vector<double> SpinalCord::computeCrossSectionalArea(bool saveFile, string filename, bool spline, Image3D* im)
 {
 	computeCenterline(saveFile, filename, spline);
-	crossSectionalArea_ = new vector<double>(centerline_->size());
+	crossSectionalArea_->assign(centerline_->size(),0.0);
 
-	// create polyData from points and triangles from mesh
-	vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-	vtkSmartPointer<vtkDoubleArray> pointNormalsArray = vtkSmartPointer<vtkDoubleArray>::New();
-	pointNormalsArray->SetNumberOfComponents(3); //3d normals (ie x,y,z)
-	pointNormalsArray->SetNumberOfTuples(points_.size());
-	CVector3 p, n;
-	for (unsigned int i=0; i<points_.size(); i++) {
+	unsigned int numberOfDisks = diskCentroids_.size();
+	if (numberOfDisks < 2) {
+		if (saveFile) saveCrossSectionalArea(filename, im);
+		return *crossSectionalArea_;
+	}
+	vector<double> positions(3*numberOfDisks*radialResolution_);
+	CVector3 p;
+	for (unsigned int i=0; i<numberOfDisks*radialResolution_; i++) {
 		p = points_[i]->getPosition();
-		n = points_[i]->getNormal();
-		points->InsertNextPoint(p[0],p[1],p[2]);
-		pointNormalsArray->SetTuple3(i, n[0], n[1], n[2]) ;
+		positions[3*i] = p[0]; positions[3*i+1] = p[1]; positions[3*i+2] = p[2];
 	}
-	vtkSmartPointer<vtkPolyData> source = vtkSmartPointer<vtkPolyData>::New();
-	source->SetPoints(points);
-	source->GetPointData()->SetNormals(pointNormalsArray);
-	source->Allocate(triangles_.size());
-	for (unsigned int i=0; i<triangles_.size(); i+=3) {
-		vtkIdType pts[3] = {triangles_[i],triangles_[i+1],triangles_[i+2]};
-		source->InsertNextCell(VTK_TRIANGLE,3,pts);
+
+	// Disque le plus proche de chaque point de la ligne centrale (la ligne centrale et les disques sont dans le meme ordre)
+	int step = 3;
+	if (spline) step = 6;
+	unsigned int numberOfPlanes = centerline_->size();
+	vector<unsigned int> nearestDisk(numberOfPlanes,0);
+	unsigned int disk = 0;
+	for (unsigned int i=0; i<numberOfPlanes; i++) {
+		if (!spline) disk = min(i,numberOfDisks-1);
+		else {
+			double distance = ((*centerline_)[i]-diskCentroids_[disk]).Norm();
+			while (disk+1 < numberOfDisks && ((*centerline_)[i]-diskCentroids_[disk+1]).Norm() <= distance)
+				distance = ((*centerline_)[i]-diskCentroids_[++disk]).Norm();
+		}
+		nearestDisk[i] = disk;
 	}
 
 	// Computing area of cross-section. First and last values ar certainly wrong. Firstly because of the orientatation of points at the end of the mesh and for the last one, because of approximation of normal
-	CVector3 point, normal;
-	vtkSmartPointer<vtkPlane> plane = vtkSmartPointer<vtkPlane>::New();
-	vtkSmartPointer<vtkCutter> cutter = vtkSmartPointer<vtkCutter>::New();
-	vtkSmartPointer<vtkContourTriangulator> triangleFilter = vtkSmartPointer<vtkContourTriangulator>::New();
-	vtkSmartPointer<vtkMassProperties> areaEvaluator = vtkSmartPointer<vtkMassProperties>::New();
-	cutter->SetInputData(source);
-    int step = 3;
-    if (spline) step = 6;
-	for (unsigned int i=1; i<centerline_->size()-step; i++)
+	// Les plans sont independants : calcul en parallele
+	itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+	threader->ParallelizeArray(1, max(1,(int)numberOfPlanes-step), [&](itk::SizeValueType i)
 	{
-		point = (*centerline_)[i];
-		normal = (*centerline_derivative_)[i].Normalize();
-		plane->SetOrigin(point[0],point[1],point[2]);
-		plane->SetNormal(normal[0],normal[1],normal[2]);
-		cutter->SetCutFunction(plane);
-		cutter->Update();
-		triangleFilter->SetInputConnection(cutter->GetOutputPort());
-		triangleFilter->Update();
-		vtkSmartPointer<vtkPolyData> res = triangleFilter->GetOutput();
-		areaEvaluator->SetInputConnection(triangleFilter->GetOutputPort());
-		areaEvaluator->Update();
-		(*crossSectionalArea_)[i] = areaEvaluator->GetSurfaceArea();
-	}
+		CVector3 point = (*centerline_)[i], normal;
+		if (spline) normal = (*centerline_derivative_)[i].Normalize();
+		else normal = ((*centerline_)[i+1]-(*centerline_)[i-1]).Normalize();
+		(*crossSectionalArea_)[i] = computePlaneCrossSectionalArea(&positions[0],numberOfDisks,radialResolution_,point,normal,nearestDisk[i]);
+	}, nullptr);
 
 	if (saveFile) saveCrossSectionalArea(filename, im);
 
@@ -387,51 +402,84 @@ vector<double> SpinalCord::computeCrossSectionalArea(bool saveFile, string filen
 
 double SpinalCord::computeLastCrossSectionalArea()
 {
-	computeCenterline();
-
-	// create polyData from points and triangles from mesh
-	vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-	vtkSmartPointer<vtkDoubleArray> pointNormalsArray = vtkSmartPointer<vtkDoubleArray>::New();
-	pointNormalsArray->SetNumberOfComponents(3); //3d normals (ie x,y,z)
-	pointNormalsArray->SetNumberOfTuples(points_.size());
-	CVector3 p, n;
-	for (unsigned int i=0; i<points_.size(); i++) {
+	updateDiskCentroids();
+	unsigned int numberOfDisks = diskCentroids_.size();
+	if (numberOfDisks < 2) return 0.0;
+	vector<double> positions(3*numberOfDisks*radialResolution_);
+	CVector3 p;
+	for (unsigned int i=0; i<numberOfDisks*radialResolution_; i++) {
 		p = points_[i]->getPosition();
-		n = points_[i]->getNormal();
-		points->InsertNextPoint(p[0],p[1],p[2]);
-		pointNormalsArray->SetTuple3(i, n[0], n[1], n[2]) ;
-	}
-	vtkSmartPointer<vtkPolyData> source = vtkSmartPointer<vtkPolyData>::New();
-	source->SetPoints(points);
-	source->GetPointData()->SetNormals(pointNormalsArray);
-	source->Allocate(triangles_.size());
-	for (unsigned int i=0; i<triangles_.size(); i+=3) {
-		vtkIdType pts[3] = {triangles_[i],triangles_[i+1],triangles_[i+2]};
-		source->InsertNextCell(VTK_TRIANGLE,3,pts);
+		positions[3*i] = p[0]; positions[3*i+1] = p[1]; positions[3*i+2] = p[2];
 	}
 
-	// Computing area of cross-section. First and last values ar certainly wrong. Firstly because of the orientatation of points at the end of the mesh and for the last one, because of approximation of normal
-	CVector3 point, normal;
-	vtkSmartPointer<vtkPlane> plane = vtkSmartPointer<vtkPlane>::New();
-	vtkSmartPointer<vtkCutter> cutter = vtkSmartPointer<vtkCutter>::New();
-	vtkSmartPointer<vtkContourTriangulator> triangleFilter = vtkSmartPointer<vtkContourTriangulator>::New();
-	vtkSmartPointer<vtkMassProperties> areaEvaluator = vtkSmartPointer<vtkMassProperties>::New();
-	cutter->SetInputData(source);
-
-	unsigned int position = centerline_->size()/2;
-	point = (*centerline_)[position];
-	normal = ((*centerline_)[centerline_->size()-1]-point).Normalize();
-	plane->SetOrigin(point[0],point[1],point[2]);
-	plane->SetNormal(normal[0],normal[1],normal[2]);
-	cutter->SetCutFunction(plane);
-	cutter->Update();
-	triangleFilter->SetInputConnection(cutter->GetOutputPort());
-	triangleFilter->Update();
-	vtkSmartPointer<vtkPolyData> res = triangleFilter->GetOutput();
-	areaEvaluator->SetInputConnection(triangleFilter->GetOutputPort());
-	areaEvaluator->Update();
-	
-	return areaEvaluator->GetSurfaceArea();
+	unsigned int position = numberOfDisks/2;
+	CVector3 point = diskCentroids_[position], normal = (diskCentroids_[numberOfDisks-1]-point).Normalize();
+	return computePlaneCrossSectionalArea(&positions[0],numberOfDisks,radialResolution_,point,normal,position);
+}
+
+/*!
+ * Area of the section of the tube by the plane (point, normal), without building the contour.
+ * Each triangle cut by the plane gives a segment of the contour, oriented with the normal of the triangle so that all the segments turn in the same direction around the tube.
+ * The area is then half the sum of the cross products of the segments ends (relative to point), projected on the normal, and does not need the order of the segments.
+ * The triangles are those of the tube structure (two triangles between points k and k+1 of two consecutive disks). Only the bands around the disk are visited: from disk,
+ * the bands are visited in both directions while the plane cuts them, so that the cost does not depend on the length of the mesh.
+ */
+double SpinalCord::computePlaneCrossSectionalArea(const double* positions, unsigned int numberOfDisks, int radialResolution, const CVector3& point, const CVector3& normal, unsigned int disk)
+{
+	if (numberOfDisks < 2 || radialResolution < 3) return 0.0;
+	const double o[3] = {point[0],point[1],point[2]}, n[3] = {normal[0],normal[1],normal[2]};
+
+	// contribution des deux triangles de chaque quadrilatere d'une bande
+	auto bandArea = [&](unsigned int band, bool& cut) -> double
+	{
+		double area = 0.0, d[4];
+		const double *v[4];
+		cut = false;
+		for (int k=0; k<radialResolution; k++)
+		{
+			int k1 = (k+1)%radialResolution;
+			v[0] = positions+3*(band*radialResolution+k); v[1] = positions+3*(band*radialResolution+k1);
+			v[2] = positions+3*((band+1)*radialResolution+k); v[3] = positions+3*((band+1)*radialResolution+k1);
+			for (int j=0; j<4; j++) d[j] = (v[j][0]-o[0])*n[0]+(v[j][1]-o[1])*n[1]+(v[j][2]-o[2])*n[2];
+			const int triangles[2][3] = {{0,1,2},{1,3,2}};
+			for (int t=0; t<2; t++)
+			{
+				int a = triangles[t][0], b = triangles[t][1], c = triangles[t][2];
+				bool sa = d[a] >= 0.0, sb = d[b] >= 0.0, sc = d[c] >= 0.0;
+				if (sa == sb && sb == sc) continue;
+				cut = true;
+				// sommet isole (seul de son cote du plan) et les deux autres
+				int lone = a, u = b, w = c;
+				if (sa == sb) { lone = c; u = a; w = b; }
+				else if (sa == sc) { lone = b; u = c; w = a; }
+				double p[3], q[3], tu = d[lone]/(d[lone]-d[u]), tw = d[lone]/(d[lone]-d[w]);
+				for (int m=0; m<3; m++) {
+					p[m] = v[lone][m]+tu*(v[u][m]-v[lone][m])-o[m];
+					q[m] = v[lone][m]+tw*(v[w][m]-v[lone][m])-o[m];
+				}
+				// orientation du segment : (normale du plan x normale du triangle).(q-p) > 0
+				double e1[3] = {v[b][0]-v[a][0],v[b][1]-v[a][1],v[b][2]-v[a][2]}, e2[3] = {v[c][0]-v[a][0],v[c][1]-v[a][1],v[c][2]-v[a][2]};
+				double nt[3] = {e1[1]*e2[2]-e1[2]*e2[1],e1[2]*e2[0]-e1[0]*e2[2],e1[0]*e2[1]-e1[1]*e2[0]};
+				double tangent[3] = {n[1]*nt[2]-n[2]*nt[1],n[2]*nt[0]-n[0]*nt[2],n[0]*nt[1]-n[1]*nt[0]};
+				double orientation = tangent[0]*(q[0]-p[0])+tangent[1]*(q[1]-p[1])+tangent[2]*(q[2]-p[2]);
+				double cross = n[0]*(p[1]*q[2]-p[2]*q[1])+n[1]*(p[2]*q[0]-p[0]*q[2])+n[2]*(p[0]*q[1]-p[1]*q[0]);
+				if (orientation >= 0.0) area += cross;
+				else area -= cross;
+			}
+		}
+		return area;
+	};
+
+	if (disk > numberOfDisks-1) disk = numberOfDisks-1;
+	double area = 0.0;
+	bool cut = true;
+	for (unsigned int band=disk; band+1<numberOfDisks && cut; band++)
+		area += bandArea(band,cut);
+	cut = true;
+	for (int band=(int)disk-1; band>=0 && cut; band--)
+		area += bandArea(band,cut);
+
+	return 0.5*fabs(area);
 }
 
 void SpinalCord::saveCrossSectionalArea(string filename, Image3D* im)
@@ -546,27 +594,25 @@ vector< vector<CVector3> > SpinalCord::extractLastDisks(int numberOfDisks)
     return lastDisks;
 }
 
-CVector3 SpinalCord::computeGravityCenterLastDisk(int numberOfDisks)
+// Centre de gravite du disque situe numberOfDisk disques avant la fin du maillage (1 : dernier disque), sans copier les disques
+CVector3 SpinalCord::computeGravityCenterDiskFromEnd(int numberOfDisk)
 {
-    vector< vector<CVector3> > disks = extractLastDisks(numberOfDisks);
-    
 	CVector3 result;
+	unsigned long first = points_.size()-numberOfDisk*radialResolution_;
 	for (int k=0; k<radialResolution_; k++)
-		result += disks[0][k];
+		result += points_[first+k]->getPosition();
 	result /= (double)radialResolution_;
 	return result;
 }
 
+CVector3 SpinalCord::computeGravityCenterLastDisk(int numberOfDisks)
+{
+	return computeGravityCenterDiskFromEnd(1);
+}
+
 CVector3 SpinalCord::computeGravityCenterFirstDisk(int numberOfDisks)
 {
-    vector< vector<CVector3> > disks = extractLastDisks(numberOfDisks);
-    
-	CVector3 result;
-	unsigned int first = disks.size()-1;
-	for (int k=0; k<radialResolution_; k++)
-		result += disks[first][k];
-	result /= (double)radialResolution_;
-	return result;
+	return computeGravityCenterDiskFromEnd(numberOfDisks);
 }
 
 CVector3 SpinalCord::computeGravityCenterSecondDisk()
@@ -580,23 +626,9 @@ CVector3 SpinalCord::computeGravityCenterSecondDisk()
 
 CVector3 SpinalCord::computeLastDiskNormal(int numberOfDisks)
 {
-    vector< vector<CVector3> > lastDisks = extractLastDisks(numberOfDisks);
-    
-	CVector3 result;
-    
 	// Calcul des centres gravites des disques et on prend la normale passant par ces points
-	CVector3 centreGravite1, centreGravite2;
-	for (int k=0; k<radialResolution_; k++)
-	{
-		centreGravite1 += lastDisks[0][k];
-		centreGravite2 += lastDisks[numberOfDisks-1][k];
-	}
-	centreGravite1 /= (double)radialResolution_;
-	centreGravite2 /= (double)radialResolution_;
-    
-	result = (centreGravite1-centreGravite2).Normalize();
-    
-	return result;
+	CVector3 centreGravite1 = computeGravityCenterDiskFromEnd(1), centreGravite2 = computeGravityCenterDiskFromEnd(numberOfDisks);
+	return (centreGravite1-centreGravite2).Normalize();
 }
 
 
@@ -612,6 +644,39 @@ SpinalCord* SpinalCord::extractLastDiskOfMesh(bool moving)
 }
 
 
+/*!
+ * Version of extractPartOfMesh() filling result, used at each propagation step. When result already has the structure of the part of mesh
+ * (built by a previous call), only the positions, normals and deformation flags of its points are updated and its connectivity is kept.
+ * Otherwise it is rebuilt and its connectivity is computed. The triangles barycentres are computed in both cases.
+ */
+void SpinalCord::extractPartOfMesh(SpinalCord* result, int numberOfDisk, bool moving1, bool moving2)
+{
+	unsigned long size = points_.size(), first = size-numberOfDisk*radialResolution_;
+	if (result->radialResolution_ != radialResolution_ || result->getNbrOfPoints() != numberOfDisk*radialResolution_ || !result->getTopology())
+	{
+		SpinalCord* part = extractPartOfMesh(numberOfDisk,moving1,moving2);
+		result->clear();
+		result->radialResolution_ = radialResolution_;
+		result->points_.swap(part->points_);
+		result->triangles_.swap(part->triangles_);
+		delete part;
+		result->computeConnectivity();
+	}
+	else
+	{
+		for (int i=0; i<numberOfDisk*radialResolution_; i++)
+		{
+			Vertex* point = result->points_[i];
+			point->setPosition(points_[first+i]->getPosition());
+			point->setNormal(0.0,0.0,0.0);
+			point->setDeform(i<radialResolution_ ? moving1 : moving2);
+		}
+		result->pointsModified(0);
+	}
+	result->computeTrianglesBarycentre();
+}
+
+
 SpinalCord* SpinalCord::extractPartOfMesh(int numberOfDisk, bool moving1, bool moving2)
 {
 	SpinalCord* result = new SpinalCord;
@@ -645,8 +710,8 @@ SpinalCord* SpinalCord::extractPartOfMesh(int numberOfDisk, bool moving1, bool m
 
 void SpinalCord::assembleMeshes(SpinalCord* partOfMesh, int numberOfDisk, int radial_resolution_part)
 {
-	vector<Vertex*> pointsPart = partOfMesh->getListPoints();
-	vector<int> trianglesPart = partOfMesh->getListTriangles();
+	const vector<Vertex*>& pointsPart = partOfMesh->getListPoints();
+	const vector<int>& trianglesPart = partOfMesh->getListTriangles();
 	int nbrPoints = points_.size();
 	int nbrPointsPart = pointsPart.size();
 	int offsetTriangles = nbrPoints-radial_resolution_part, offsetTrianglesPart = nbrPointsPart-(numberOfDisk)*radial_resolution_part;
@@ -661,3 +726,69 @@ void SpinalCord::assembleMeshes(SpinalCord* partOfMesh, int numberOfDisk, int ra
 	}
 }
 
+/*!
+ * Mesh deformed at each propagation step: last disk of this mesh (fixed) followed by the disks 1 to numberOfDisk-1 of partOfMesh,
+ * i.e. extractLastDiskOfMesh(false) then assembleMeshes(partOfMesh,...). The structure of this mesh does not change between steps:
+ * result is built (with its connectivity) at the first call, and only the points are updated in place afterwards.
+ */
+void SpinalCord::assemblePropagationMesh(SpinalCord* result, SpinalCord* partOfMesh, int numberOfDisk)
+{
+	const vector<Vertex*>& pointsPart = partOfMesh->getListPoints();
+	unsigned long size = points_.size();
+	if (result->radialResolution_ != radialResolution_ || result->getNbrOfPoints() != numberOfDisk*radialResolution_ || !result->getTopology())
+	{
+		result->clear();
+		result->radialResolution_ = radialResolution_;
+		for (int j=0; j<radialResolution_; j++)
+			result->addPoint(new Vertex(points_[size-radialResolution_+j]->getPosition(),false));
+		result->assembleMeshes(partOfMesh,numberOfDisk,radialResolution_);
+		result->computeConnectivity();
+	}
+	else
+	{
+		for (int j=0; j<radialResolution_; j++)
+			result->points_[j]->setPosition(points_[size-radialResolution_+j]->getPosition());
+		for (int i=radialResolution_; i<numberOfDisk*radialResolution_; i++)
+			*result->points_[i] = *pointsPart[i];
+		result->pointsModified(0);
+	}
+	result->computeTrianglesBarycentre();
+}
+
+/*!
+ * Append-only version of assembleMeshes() used by the propagation: the connectivity and the barycentres are updated for the new band only.
+ * The cost of a propagation step does not depend on the length of the mesh already segmented.
+ */
+void SpinalCord::appendDisks(SpinalCord* partOfMesh, int numberOfDisk, int radial_resolution_part)
+{
+	assembleMeshes(partOfMesh,numberOfDisk,radial_resolution_part);
+	updateConnectivity();
+	updateTrianglesBarycentre();
+}
+
+// Copie des disques firstDisk a lastDisk (inclus) avec les triangles qui ne relient que ces disques, quelle que soit la triangulation du tube
+SpinalCord* SpinalCord::extractDisks(unsigned int firstDisk, unsigned int lastDisk)
+{
+	SpinalCord* result = new SpinalCord;
+	result->radialResolution_ = radialResolution_;
+	int firstPoint = firstDisk*radialResolution_, endPoint = (lastDisk+1)*radialResolution_;
+	for (int i=firstPoint; i<endPoint; i++)
+		result->addPoint(new Vertex(*points_[i]));
+	for (unsigned int i=0; i<triangles_.size(); i+=3)
+	{
+		if (triangles_[i] >= firstPoint && triangles_[i] < endPoint && triangles_[i+1] >= firstPoint && triangles_[i+1] < endPoint && triangles_[i+2] >= firstPoint && triangles_[i+2] < endPoint)
+			result->addTriangle(triangles_[i]-firstPoint,triangles_[i+1]-firstPoint,triangles_[i+2]-firstPoint);
+	}
+	return result;
+}
+
+// Remplace les positions des disques a partir de firstDisk par celles de partOfMesh (meme resolution radiale, extrait par extractDisks)
+void SpinalCord::replaceDisks(SpinalCord* partOfMesh, unsigned int firstDisk)
+{
+	vector<Vertex*>& pointsPart = partOfMesh->getListPoints();
+	unsigned int firstPoint = firstDisk*radialResolution_;
+	for (unsigned int i=0; i<pointsPart.size() && firstPoint+i<points_.size(); i++)
+		points_[firstPoint+i]->setPosition(pointsPart[i]->getPosition());
+	pointsModified(firstPoint);
+	computeTrianglesBarycentre();
+}
@@ -44,6 +44,8 @@ public:
 	std::vector<CVector3> getCenterline() { return *centerline_; };
 	double getLength() { return length_; };
 	std::vector<CVector3> computeCenterline(bool saveFile=false, std::string filename="", bool spline=false);
+	const std::vector<CVector3>& getDiskCentroids() { updateDiskCentroids(); return diskCentroids_; };
+	double getCenterlineLength() { updateDiskCentroids(); return arcLength_.empty()?0.0:arcLength_.back(); };
 	void saveCenterlineAsBinaryImage(ImageType::Pointer im, std::string filename, OrientationType orient);
 	std::vector<double> computeApproximateCircleRadius();
 
@@ -52,10 +54,11 @@ public:
 	void subdivisionRadiale();
 
 	int getRadialResolution() { return radialResolution_; };
-	void setRadialResolution(int radialResolution) { radialResolution_ = radialResolution; };
+	void setRadialResolution(int radialResolution) { radialResolution_ = radialResolution; diskCentroids_.clear(); arcLength_.clear(); };
 
 	std::vector<double> computeCrossSectionalArea(bool saveFile=false, std::string filename="", bool spline=false, Image3D* im=0);
 	double computeLastCrossSectionalArea();
+	static double computePlaneCrossSectionalArea(const double* positions, unsigned int numberOfDisks, int radialResolution, const CVector3& point, const CVector3& normal, unsigned int disk);
 
 	virtual vtkSmartPointer<vtkPolyData> reduceMeshUpAndDown(CVector3 upperSlicePoint, CVector3 upperSliceNormal, CVector3 downSlicePoint, CVector3 downSliceNormal, std::string filename="");
     
@@ -66,18 +69,30 @@ public:
     CVector3 computeGravityCenterLastDisk(int numberOfDisks);
     CVector3 computeGravityCenterFirstDisk(int numberOfDisks);
     CVector3 computeGravityCenterSecondDisk();
+    CVector3 computeGravityCenterDiskFromEnd(int numberOfDisk);
     CVector3 computeLastDiskNormal(int numberOfDisks);
     SpinalCord* extractLastDiskOfMesh(bool moving);
     SpinalCord* extractPartOfMesh(int numberOfDisk, bool moving1, bool moving2);
+    void extractPartOfMesh(SpinalCord* result, int numberOfDisk, bool moving1, bool moving2);
     void assembleMeshes(SpinalCord* partOfMesh, int numberOfDisk, int radial_resolution_part);
+    void assemblePropagationMesh(SpinalCord* result, SpinalCord* partOfMesh, int numberOfDisk);
+    void appendDisks(SpinalCord* partOfMesh, int numberOfDisk, int radial_resolution_part);
+    SpinalCord* extractDisks(unsigned int firstDisk, unsigned int lastDisk);
+    void replaceDisks(SpinalCord* partOfMesh, unsigned int firstDisk);
     
+protected:
+	virtual void pointsModified(unsigned int firstPoint);
+
 private:
 	void saveCenterline(std::string filename="");
 	void saveCrossSectionalArea(std::string filename="", Image3D* im=0);
+	void updateDiskCentroids();
 
 	int radialResolution_;
 	std::vector<CVector3>* centerline_, *centerline_derivative_;
 	double length_;
+	std::vector<CVector3> diskCentroids_; // centre de gravite de chaque disque, mis a jour seulement pour les disques ajoutes
+	std::vector<double> arcLength_; // longueur de la ligne centrale du premier disque jusqu'a chaque disque
 	std::vector<double>* crossSectionalArea_;
     
     bool completeCenterline_;
@@ -21,6 +21,7 @@
 
 #include "itkImageToImageFilter.h"
 #include "itkEllipseSpatialObject.h"
+#include <vector>
 
 namespace itk
 {
@@ -40,6 +41,10 @@ namespace itk
  * point and draws a regular narrow-banded circle using the minimum and maximum
  * radius given by the user, and fills in the array of radii.
  * The SweepAngle value can be adjusted to improve the segmentation.
+ *
+ * The gradient is evaluated once per pixel above the threshold, in parallel,
+ * and the rows of the image vote in parallel, each work unit in its own
+ * accumulators which are merged at the end.
  * 
  * !!! This class has been modified by NeuroPoly to allow inverse gradient for the Hough transform (GradientFactor parameter).
  *
@@ -129,6 +134,30 @@ public:
   /** Get the radius image */
   itkGetObjectMacro(RadiusImage, OutputImageType);
 
+  /** Vote also, in the same pass over the image, for radii between
+   *  minimumRadius and maximumRadius with another gradient factor (NeuroPoly
+   *  modification, used to detect nested circles). The votes go to the
+   *  secondary accumulator and radius images. */
+  void SetSecondaryRadii(double minimumRadius, double maximumRadius, double gradientFactor);
+  void RemoveSecondaryRadii();
+  itkGetConstMacro(SecondaryMinimumRadius, double);
+  itkGetConstMacro(SecondaryMaximumRadius, double);
+  itkGetConstMacro(SecondaryGradientFactor, double);
+
+  /** Get the accumulator and the radius image of the secondary radii */
+  itkGetObjectMacro(SecondaryAccumulator, OutputImageType);
+  itkGetObjectMacro(SecondaryRadiusImage, OutputImageType);
+
+  /** Elliptical transform (NeuroPoly modification): for each stretching
+   *  factor s, the filter also votes as in the image resampled with s times
+   *  more pixels along x, without resampling it. The accumulator and radius
+   *  image of factor k (main or secondary radii) have the grid of that
+   *  resampled image; for a factor of 1, they are the plain outputs. */
+  void SetStretchingFactors(const std::vector< double > & factors);
+  const std::vector< double > & GetStretchingFactors() const { return m_StretchingFactors; }
+  OutputImageType * GetStretchedAccumulator(unsigned int stretch, bool secondary = false) const;
+  OutputImageType * GetStretchedRadiusImage(unsigned int stretch, bool secondary = false) const;
+
   /** Set the scale of the derivative function (using DoG) */
   itkSetMacro(SigmaGradient, double);
 
@@ -191,6 +220,9 @@ private:
   HoughTransform2DCirclesImageFilter(const Self &);
   void operator=(const Self &);
 
+  /** Image of the output region (stretched along x by stretchingFactor), filled with 0 */
+  OutputImagePointer CreateVoteImage(double stretchingFactor = 1.0) const;
+
   float  m_SweepAngle;
   double m_MinimumRadius;
   double m_MaximumRadius;
@@ -198,9 +230,18 @@ private:
   double m_SigmaGradient;
   double m_GradientFactor; // modif
 
-  OutputImagePointer    m_InternalImage;
-    
   OutputImagePointer    m_RadiusImage;
+
+  bool                  m_UseSecondaryRadii;
+  double                m_SecondaryMinimumRadius;
+  double                m_SecondaryMaximumRadius;
+  double                m_SecondaryGradientFactor;
+  OutputImagePointer    m_SecondaryAccumulator;
+  OutputImagePointer    m_SecondaryRadiusImage;
+
+  std::vector< double >             m_StretchingFactors;
+  std::vector< OutputImagePointer > m_StretchedAccumulators;
+  std::vector< OutputImagePointer > m_StretchedRadiusImages;
   CirclesListType       m_CirclesList;
   CirclesListSizeType   m_NumberOfCircles;
   float                 m_DiscRadiusRatio;
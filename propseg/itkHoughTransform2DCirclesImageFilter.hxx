@@ -25,6 +25,9 @@
 #include "itkMinimumMaximumImageCalculator.h"
 #include "itkImageDuplicator.h"
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
 
 namespace itk
 {
@@ -43,6 +46,10 @@ HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
   m_SweepAngle = 0.0;
   m_NumberOfCircles = 1;
   m_GradientFactor = 1.0; // modif - use to invert gradient
+  m_UseSecondaryRadii = false;
+  m_SecondaryMinimumRadius = 0;
+  m_SecondaryMaximumRadius = 10;
+  m_SecondaryGradientFactor = 1.0;
 }
 
 template< typename TInputPixelType, typename TOutputPixelType >
@@ -77,6 +84,102 @@ HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
     }
 }
 
+template< typename TInputPixelType, typename TOutputPixelType >
+void
+HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
+::SetSecondaryRadii(double minimumRadius, double maximumRadius, double gradientFactor)
+{
+  m_UseSecondaryRadii = true;
+  m_SecondaryMinimumRadius = minimumRadius;
+  m_SecondaryMaximumRadius = maximumRadius;
+  m_SecondaryGradientFactor = gradientFactor;
+  this->Modified();
+}
+
+template< typename TInputPixelType, typename TOutputPixelType >
+void
+HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
+::RemoveSecondaryRadii()
+{
+  if ( m_UseSecondaryRadii )
+    {
+    m_UseSecondaryRadii = false;
+    m_SecondaryAccumulator = nullptr;
+    m_SecondaryRadiusImage = nullptr;
+    m_StretchedAccumulators.clear();
+    m_StretchedRadiusImages.clear();
+    this->Modified();
+    }
+}
+
+template< typename TInputPixelType, typename TOutputPixelType >
+void
+HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
+::SetStretchingFactors(const std::vector< double > & factors)
+{
+  if ( factors != m_StretchingFactors )
+    {
+    m_StretchingFactors = factors;
+    m_StretchedAccumulators.clear();
+    m_StretchedRadiusImages.clear();
+    this->Modified();
+    }
+}
+
+template< typename TInputPixelType, typename TOutputPixelType >
+typename HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >::OutputImageType *
+HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
+::GetStretchedAccumulator(unsigned int stretch, bool secondary) const
+{
+  if ( 2 * stretch + 1 >= m_StretchedAccumulators.size() )
+    {
+    itkExceptionMacro(<< "No accumulator for the stretching factor " << stretch << ", the filter has not been updated");
+    }
+  return m_StretchedAccumulators[2 * stretch + ( secondary ? 1 : 0 )];
+}
+
+template< typename TInputPixelType, typename TOutputPixelType >
+typename HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >::OutputImageType *
+HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
+::GetStretchedRadiusImage(unsigned int stretch, bool secondary) const
+{
+  if ( 2 * stretch + 1 >= m_StretchedRadiusImages.size() )
+    {
+    itkExceptionMacro(<< "No radius image for the stretching factor " << stretch << ", the filter has not been updated");
+    }
+  return m_StretchedRadiusImages[2 * stretch + ( secondary ? 1 : 0 )];
+}
+
+template< typename TInputPixelType, typename TOutputPixelType >
+typename HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >::OutputImagePointer
+HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
+::CreateVoteImage(double stretchingFactor) const
+{
+  const InputImageType *inputImage = this->GetInput(0);
+  OutputImagePointer image = OutputImageType::New();
+
+  OutputImageRegionType region = this->GetOutput(0)->GetLargestPossibleRegion();
+  typename OutputImageType::SpacingType spacing = inputImage->GetSpacing();
+  if ( stretchingFactor != 1.0 )
+    {
+    // Same grid as an image resampled with stretchingFactor times more pixels along x, on the same physical extent
+    const SizeValueType size = region.GetSize()[0];
+    const SizeValueType stretchedSize = (SizeValueType)( size * stretchingFactor );
+    region.SetIndex( 0, 0 );
+    region.SetIndex( 1, 0 );
+    region.SetSize( 0, stretchedSize );
+    spacing[0] = spacing[0] * size / stretchedSize;
+    }
+
+  image->SetRegions( region );
+  image->SetOrigin( inputImage->GetOrigin() );
+  image->SetSpacing( spacing );
+  image->SetDirection( inputImage->GetDirection() );
+  image->Allocate();
+  image->FillBuffer(0);
+  return image;
+}
+
 template< typename TInputPixelType, typename TOutputPixelType >
 void
 HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
@@ -85,105 +188,246 @@ HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
   // Get the input and output pointers
   InputImageConstPointer inputImage = this->GetInput(0);
   OutputImagePointer     outputImage = this->GetOutput(0);
-    
-    m_InternalImage = OutputImageType::New();
-    m_InternalImage->SetRegions( outputImage->GetLargestPossibleRegion() );
-    m_InternalImage->SetOrigin( inputImage->GetOrigin() );
-    m_InternalImage->SetSpacing( inputImage->GetSpacing() );
-    m_InternalImage->SetDirection( inputImage->GetDirection() );
-    m_InternalImage->Allocate();
-    m_InternalImage->FillBuffer(0);
 
   // Allocate the output
   this->AllocateOutputs();
   outputImage->FillBuffer(0);
 
-  typedef GaussianDerivativeImageFunction< InputImageType > DoGFunctionType;
-  typename DoGFunctionType::Pointer DoGFunction = DoGFunctionType::New();
-  DoGFunction->SetInputImage(inputImage);
-  DoGFunction->SetSigma(m_SigmaGradient);
+  m_RadiusImage = this->CreateVoteImage();
+  if ( m_UseSecondaryRadii )
+    {
+    m_SecondaryAccumulator = this->CreateVoteImage();
+    m_SecondaryRadiusImage = this->CreateVoteImage();
+    }
+
+  const typename InputImageType::RegionType inputRegion = inputImage->GetBufferedRegion();
+  const IndexValueType inputStartX = inputRegion.GetIndex()[0], inputStartY = inputRegion.GetIndex()[1];
+  const SizeValueType  inputSizeX = inputRegion.GetSize()[0], inputSizeY = inputRegion.GetSize()[1];
+  const TInputPixelType *input = inputImage->GetBufferPointer();
+
+  // Vote targets: each pair (stretching factor, band of radii) votes in its own accumulator and radius image.
+  // In the image stretched by s along x, the input pixel x is at x * scale (scale = stretched size / size, i.e. about s)
+  // and stands for scale pixels of the stretched image: its votes are weighted by scale. The direction of the votes is
+  // the gradient (in physical units) at that pixel, as in the resampled image, so one gradient serves every factor.
+  struct VoteTarget
+    {
+    double           minimumRadius, maximumRadius, gradientFactor, scale;
+    IndexValueType   startX, startY, sizeX, sizeY;
+    TOutputPixelType *accumulator, *radius;
+    };
+  std::vector< VoteTarget > targets;
+  const unsigned int numberOfBands = m_UseSecondaryRadii ? 2 : 1;
+  auto addTargets = [&](double scale, OutputImageType *accumulators[2], OutputImageType *radiusImages[2])
+    {
+    for ( unsigned int b = 0; b < numberOfBands; b++ )
+      {
+      const OutputImageRegionType region = accumulators[b]->GetLargestPossibleRegion();
+      VoteTarget target;
+      target.minimumRadius = b == 0 ? m_MinimumRadius : m_SecondaryMinimumRadius;
+      target.maximumRadius = b == 0 ? m_MaximumRadius : m_SecondaryMaximumRadius;
+      target.gradientFactor = b == 0 ? m_GradientFactor : m_SecondaryGradientFactor;
+      target.scale = scale;
+      target.startX = region.GetIndex()[0];
+      target.startY = region.GetIndex()[1];
+      target.sizeX = region.GetSize()[0];
+      target.sizeY = region.GetSize()[1];
+      target.accumulator = accumulators[b]->GetBufferPointer();
+      target.radius = radiusImages[b]->GetBufferPointer();
+      targets.push_back(target);
+      }
+    };
 
-  m_RadiusImage = OutputImageType::New();
+  OutputImageType *accumulators[2] = { outputImage, m_SecondaryAccumulator };
+  OutputImageType *radiusImages[2] = { m_RadiusImage, m_SecondaryRadiusImage };
+  addTargets(1.0, accumulators, radiusImages);
 
-  m_RadiusImage->SetRegions( outputImage->GetLargestPossibleRegion() );
-  m_RadiusImage->SetOrigin( inputImage->GetOrigin() );
-  m_RadiusImage->SetSpacing( inputImage->GetSpacing() );
-  m_RadiusImage->SetDirection( inputImage->GetDirection() );
-  m_RadiusImage->Allocate();
-  m_RadiusImage->FillBuffer(0);
+  m_StretchedAccumulators.assign(2 * m_StretchingFactors.size(), nullptr);
+  m_StretchedRadiusImages.assign(2 * m_StretchingFactors.size(), nullptr);
+  for ( unsigned int k = 0; k < m_StretchingFactors.size(); k++ )
+    {
+    if ( m_StretchingFactors[k] == 1.0 )
+      {
+      // the unstretched images are the ones of the plain transform
+      for ( unsigned int b = 0; b < numberOfBands; b++ )
+        {
+        m_StretchedAccumulators[2 * k + b] = accumulators[b];
+        m_StretchedRadiusImages[2 * k + b] = radiusImages[b];
+        }
+      continue;
+      }
+    OutputImageType *stretchedAccumulators[2] = { nullptr, nullptr }, *stretchedRadiusImages[2] = { nullptr, nullptr };
+    for ( unsigned int b = 0; b < numberOfBands; b++ )
+      {
+      m_StretchedAccumulators[2 * k + b] = this->CreateVoteImage(m_StretchingFactors[k]);
+      m_StretchedRadiusImages[2 * k + b] = this->CreateVoteImage(m_StretchingFactors[k]);
+      stretchedAccumulators[b] = m_StretchedAccumulators[2 * k + b];
+      stretchedRadiusImages[b] = m_StretchedRadiusImages[2 * k + b];
+      }
+    addTargets( (double)stretchedAccumulators[0]->GetLargestPossibleRegion().GetSize()[0] / inputSizeX, stretchedAccumulators, stretchedRadiusImages );
+    }
+  const unsigned int numberOfTargets = targets.size();
 
-  ImageRegionConstIteratorWithIndex< InputImageType > image_it( inputImage,  inputImage->GetRequestedRegion() );
-  image_it.GoToBegin();
+  // The DoG gradient is evaluated once for each pixel above the threshold, with the same GaussianDerivativeImageFunction as
+  // the original filter (the flat gradient test below is tuned for its magnitude). The rows are split between the work units,
+  // each one with its own function, and the gradient is then shared by every target.
+  typedef GaussianDerivativeImageFunction< InputImageType > DoGFunctionType;
+  std::vector< double > gradient( 2 * inputSizeX * inputSizeY, 0.0 );
+  const SizeValueType numberOfGradientChunks = std::max< SizeValueType >( 1, std::min< SizeValueType >( this->GetNumberOfWorkUnits(), inputSizeY ) );
+  this->GetMultiThreader()->ParallelizeArray( 0, numberOfGradientChunks, [&](SizeValueType chunk)
+    {
+    typename DoGFunctionType::Pointer DoGFunction = DoGFunctionType::New();
+    DoGFunction->SetInputImage(inputImage);
+    DoGFunction->SetSigma(m_SigmaGradient);
+    typename InputImageType::IndexType index;
+    for ( SizeValueType y = chunk * inputSizeY / numberOfGradientChunks; y < ( chunk + 1 ) * inputSizeY / numberOfGradientChunks; y++ )
+      {
+      for ( SizeValueType x = 0; x < inputSizeX; x++ )
+        {
+        const SizeValueType offset = y * inputSizeX + x;
+        if ( !( input[offset] > m_Threshold ) )
+          {
+          continue;
+          }
+        index[0] = inputStartX + x;
+        index[1] = inputStartY + y;
+        const typename DoGFunctionType::VectorType grad = DoGFunction->EvaluateAtIndex(index);
+        gradient[2 * offset] = grad[0];
+        gradient[2 * offset + 1] = grad[1];
+        }
+      }
+    }, nullptr );
 
-  Index< 2 >        index;
-  Point< float, 2 > point;
+  // Trigonometry of the sweep angles, tabulated once (same angles as the loop angle = -SweepAngle ... SweepAngle by steps of 0.05)
+  std::vector< double > cosAngle, sinAngle;
+  double minimumStep = 1.0; // smallest length of a vote direction, min(|cos - sin|, |cos + sin|)
+  for ( double angle = -m_SweepAngle; angle <= m_SweepAngle; angle += 0.05 )
+    {
+    cosAngle.push_back( std::cos(angle) );
+    sinAngle.push_back( std::sin(angle) );
+    minimumStep = std::min( minimumStep, std::min( std::fabs( std::cos(angle) - std::sin(angle) ), std::fabs( std::cos(angle) + std::sin(angle) ) ) );
+    }
+  const unsigned int numberOfAngles = cosAngle.size();
 
-  while ( !image_it.IsAtEnd() )
+  // Rows of the accumulators that the votes of one row of the input can reach: at step i, the vote is at most i+1 rows away,
+  // and the last step is reached when the distance exceeds the maximum radius.
+  IndexValueType margin = inputSizeY;
+  if ( minimumStep > 1e-3 )
     {
-    if ( image_it.Get() > m_Threshold )
+    double maximumStep = 0.0;
+    for ( unsigned int t = 0; t < numberOfTargets; t++ )
       {
-      point[0] = image_it.GetIndex()[0];
-      point[1] = image_it.GetIndex()[1];
-      typename DoGFunctionType::VectorType grad = m_GradientFactor*DoGFunction->EvaluateAtIndex( image_it.GetIndex() );
+      maximumStep = std::max( maximumStep, std::max( targets[t].minimumRadius, ( targets[t].maximumRadius + std::sqrt(2.0) ) / minimumStep + 1.0 ) );
+      }
+    margin = std::min( (IndexValueType)inputSizeY, (IndexValueType)std::ceil(maximumStep) + 2 );
+    }
 
-      double Vx = grad[0];
-      double Vy = grad[1];
+  // Each chunk of rows of the input votes in its own raw accumulators (number of votes and sum of the radii, for each target),
+  // which only cover the rows of the chunk and margin rows around them.
+  // The accumulators are merged in the order of the chunks, so the result does not depend on the scheduling of the threads.
+  const SizeValueType numberOfChunks = std::max< SizeValueType >( 1, std::min< SizeValueType >( this->GetNumberOfWorkUnits(), inputSizeY / ( 2 * std::max< IndexValueType >( 1, margin ) ) ) );
+  std::vector< std::vector< double > > votes(numberOfChunks * numberOfTargets), radii(numberOfChunks * numberOfTargets);
+  std::vector< IndexValueType > bandStart(numberOfChunks), bandEnd(numberOfChunks);
+  for ( SizeValueType chunk = 0; chunk < numberOfChunks; chunk++ )
+    {
+    bandStart[chunk] = std::max< IndexValueType >( 0, (IndexValueType)( chunk * inputSizeY / numberOfChunks ) - margin );
+    bandEnd[chunk] = std::min< IndexValueType >( inputSizeY, (IndexValueType)( ( chunk + 1 ) * inputSizeY / numberOfChunks ) + margin );
+    }
 
-      // if the gradient is not flat
-      if ( ( std::fabs(Vx) > 1 ) || ( std::fabs(Vy) > 1 ) )
+  this->GetMultiThreader()->ParallelizeArray( 0, numberOfChunks, [&](SizeValueType chunk)
+    {
+    for ( unsigned int t = 0; t < numberOfTargets; t++ )
+      {
+      votes[chunk * numberOfTargets + t].assign( ( bandEnd[chunk] - bandStart[chunk] ) * targets[t].sizeX, 0.0 );
+      radii[chunk * numberOfTargets + t].assign( ( bandEnd[chunk] - bandStart[chunk] ) * targets[t].sizeX, 0.0 );
+      }
+
+    for ( SizeValueType y = chunk * inputSizeY / numberOfChunks; y < ( chunk + 1 ) * inputSizeY / numberOfChunks; y++ )
+      {
+      for ( SizeValueType x = 0; x < inputSizeX; x++ )
         {
-        double norm = std::sqrt(Vx * Vx + Vy * Vy);
-        Vx /= norm;
-        Vy /= norm;
+        const SizeValueType offset = y * inputSizeX + x;
+        if ( !( input[offset] > m_Threshold ) )
+          {
+          continue;
+          }
 
-        for ( double angle = -m_SweepAngle; angle <= m_SweepAngle; angle += 0.05 )
+        for ( unsigned int t = 0; t < numberOfTargets; t++ )
           {
-          double i = m_MinimumRadius;
-          double distance;
+          const VoteTarget & target = targets[t];
+          // GradientFactor (NeuroPoly modification) inverts the gradient to detect dark or bright circles
+          double Vx = target.gradientFactor * gradient[2 * offset];
+          double Vy = target.gradientFactor * gradient[2 * offset + 1];
 
-          do
+          // if the gradient is not flat
+          if ( !( ( std::fabs(Vx) > 1 ) || ( std::fabs(Vy) > 1 ) ) )
+            {
+            continue;
+            }
+          double norm = std::sqrt(Vx * Vx + Vy * Vy);
+          Vx /= norm;
+          Vy /= norm;
+
+          const float pointX = target.startX + x * target.scale, pointY = target.startY + y;
+          const IndexValueType rowStart = target.startY + bandStart[chunk];
+          std::vector< double > & vote = votes[chunk * numberOfTargets + t];
+          std::vector< double > & radius = radii[chunk * numberOfTargets + t];
+          for ( unsigned int a = 0; a < numberOfAngles; a++ )
             {
-            index[0] = (IndexValueType)( point[0] - i * ( Vx * std::cos(angle) + Vy * std::sin(angle) ) );
-            index[1] = (IndexValueType)( point[1] - i * ( Vx * std::sin(angle) + Vy * std::cos(angle) ) );
+            const double directionX = Vx * cosAngle[a] + Vy * sinAngle[a];
+            const double directionY = Vx * sinAngle[a] + Vy * cosAngle[a];
+            double i = target.minimumRadius;
+            double distance;
+            bool   inside;
 
-            distance = std::sqrt( ( index[1] - point[1] ) * ( index[1] - point[1] )
-                                 + ( index[0] - point[0] ) * ( index[0] - point[0] ) );
+            do
+              {
+              const IndexValueType indexX = (IndexValueType)( pointX - i * directionX );
+              const IndexValueType indexY = (IndexValueType)( pointY - i * directionY );
 
-            if ( outputImage->GetRequestedRegion().IsInside(index) )
-            {
+              distance = std::sqrt( ( indexY - pointY ) * ( indexY - pointY ) + ( indexX - pointX ) * ( indexX - pointX ) );
+
+              inside = indexX >= target.startX && indexX < target.startX + target.sizeX && indexY >= target.startY && indexY < target.startY + target.sizeY;
+              if ( inside )
+                {
                 // In the basic implementation of the Hough transform, the accumulator map add the value 1 every time the voxel is encounter. To improve the robustness towards noise, we can add the norm of the gradient instead of 1. However, we need image with accumulation of 1 for averaging the radii
-                //std::cout << norm << std::endl;
-                if (norm > 0.1) {
-                m_InternalImage->SetPixel(index, m_InternalImage->GetPixel(index) + 1);
-                outputImage->SetPixel(index, outputImage->GetPixel(index) + 1);
-                m_RadiusImage->SetPixel( index, ( m_RadiusImage->GetPixel(index) + distance ) );
+                const SizeValueType bin = ( indexY - rowStart ) * target.sizeX + ( indexX - target.startX );
+                vote[bin] += target.scale;
+                radius[bin] += target.scale * distance;
                 }
-            }
 
-            i = i + 1;
+              i = i + 1;
+              }
+            while ( inside && ( distance < target.maximumRadius ) );
             }
-          while ( outputImage->GetRequestedRegion().IsInside(index)
-                  && ( distance < m_MaximumRadius ) );
           }
         }
       }
-    ++image_it;
-    }
+    }, nullptr );
 
-  // Compute the average radius
-  //ImageRegionConstIterator< OutputImageType > output_it( outputImage, outputImage->GetLargestPossibleRegion() );
-    ImageRegionConstIterator< OutputImageType > internal_it( m_InternalImage, m_InternalImage->GetLargestPossibleRegion() );
-  ImageRegionIterator< OutputImageType >      radius_it( m_RadiusImage, m_RadiusImage->GetLargestPossibleRegion() );
-  radius_it.GoToBegin();
-    internal_it.GoToBegin();
-  while ( !internal_it.IsAtEnd() )
+  // Merge the accumulators and compute the average radius
+  for ( unsigned int t = 0; t < numberOfTargets; t++ )
     {
-    if ( internal_it.Get() > 0 )
+    TOutputPixelType *accumulator = targets[t].accumulator;
+    TOutputPixelType *radiusImage = targets[t].radius;
+    for ( SizeValueType chunk = 0; chunk < numberOfChunks; chunk++ )
+      {
+      const std::vector< double > & vote = votes[chunk * numberOfTargets + t];
+      const std::vector< double > & radius = radii[chunk * numberOfTargets + t];
+      const SizeValueType first = bandStart[chunk] * targets[t].sizeX;
+      for ( SizeValueType k = 0; k < vote.size(); k++ )
+        {
+        accumulator[first + k] += vote[k];
+        radiusImage[first + k] += radius[k];
+        }
+      }
+    const SizeValueType numberOfPixels = targets[t].sizeX * targets[t].sizeY;
+    for ( SizeValueType k = 0; k < numberOfPixels; k++ )
       {
-      radius_it.Set( radius_it.Get() / internal_it.Get() );
+      if ( accumulator[k] > 0 )
+        {
+        radiusImage[k] = radiusImage[k] / accumulator[k];
+        }
       }
-    ++radius_it;
-    ++internal_it;
     }
 }
 
@@ -319,6 +563,12 @@ HoughTransform2DCirclesImageFilter< TInputPixelType, TOutputPixelType >
   os << "Disc Radius: " << m_DiscRadiusRatio << std::endl;
   os << "Accumulator blur variance: " << m_Variance << std::endl;
   os << "Sweep angle : " << m_SweepAngle << std::endl;
+  if ( m_UseSecondaryRadii )
+    {
+    os << "Secondary Minimum Radius: " << m_SecondaryMinimumRadius << std::endl;
+    os << "Secondary Maximum Radius: " << m_SecondaryMaximumRadius << std::endl;
+    os << "Secondary Gradient Factor: " << m_SecondaryGradientFactor << std::endl;
+    }
 }
 } // end namespace
 
@@ -25,9 +25,46 @@ public:
         return run(numpyArray, origin, spacing, direction); 
     }
 
+    // Local correction of the last segmentation around points given as (i, j, k) indices of the input array
+    py::array_t<unsigned char> correct(py::list points)
+    {
+        if (!image_) {
+            throw std::runtime_error("No segmentation to correct, the segmentation must be run first.");
+        }
+        std::vector<CVector3> correctionPoints;
+        for (size_t i = 0; i < points.size(); ++i) {
+            py::list point = py::cast<py::list>(points[i]);
+            ImageType::PointType physicalPoint;
+            itk::ContinuousIndex<double, 3> index;
+            for (size_t j = 0; j < 3; ++j) {
+                index[j] = py::cast<double>(point[j]);
+            }
+            image_->TransformContinuousIndexToPhysicalPoint(index, physicalPoint);
+            correctionPoints.push_back(CVector3(physicalPoint[0], physicalPoint[1], physicalPoint[2]));
+        }
+
+        BinaryImageType::Pointer spinalCord = worker_->correct(correctionPoints);
+        if (!spinalCord) {
+            throw std::runtime_error("Unable to correct the segmentation.");
+        }
+        return exportITKImageToNumpyArray(spinalCord);
+    }
+
+    void setNumberOfSeeds(int numberOfSeeds) { worker_->setNumberOfSeeds(numberOfSeeds); }
+    void setAdaptiveAxialStep(bool adaptiveAxialStep) { worker_->setAdaptiveAxialStep(adaptiveAxialStep); }
+    void setPartitionedRefinement(bool partitionedRefinement) { worker_->setPartitionedRefinement(partitionedRefinement); }
+    void setRotationGridSearch(bool rotationGridSearch) { worker_->setRotationGridSearch(rotationGridSearch); }
+    void setPyramidFactorInitialisation(int pyramidFactor) { worker_->setPyramidFactorInitialisation(pyramidFactor); }
+    void setCheckpointInterval(int interval, std::string filePrefix) { worker_->setCheckpointInterval(interval, filePrefix); }
+    bool resumeFromCheckpoint(std::string filename) { return worker_->resumeFromCheckpoint(filename); }
+
 private:
     std::unique_ptr<SegmentationPropagation> worker_;
 
+    // The imported image shares the buffer of the input array: both are kept for correct()
+    py::array_t<double> inputNumpyArray_;
+    ImageType::Pointer image_;
+
     ImageType::Pointer importITKImageFromNumpyArray(
         py::array_t<double> numpyArray,
         py::list origin,
@@ -102,6 +139,8 @@ private:
     )
     {
         ImageType::Pointer image = importITKImageFromNumpyArray(inputNumpyArray, origin, spacing, direction);
+        inputNumpyArray_ = inputNumpyArray;
+        image_ = image;
 
         BinaryImageType::Pointer spinalCord = worker_->run(image);
         py::array_t<unsigned char> outputNumpyArray = exportITKImageToNumpyArray(spinalCord);
@@ -116,5 +155,21 @@ PYBIND11_MODULE(pysct, m)
     py::class_<SpinalCordSegmentation>(m, "SpinalCordSegmentation")
         .def(py::init<>())
         .def("__call__", &SpinalCordSegmentation::operator(), "Convert NumPy array to ITK image")
+        .def("correct", &SpinalCordSegmentation::correct, py::arg("points"),
+            "Correct the last segmentation around points given as [i, j, k] indices of the input array, without propagating again")
+        .def("set_number_of_seeds", &SpinalCordSegmentation::setNumberOfSeeds, py::arg("number_of_seeds"),
+            "1: single seed (default), 0: number of seeds computed from the length of the image along the S-I axis, >1: propagation from several seeds stitched together")
+        .def("set_adaptive_axial_step", &SpinalCordSegmentation::setAdaptiveAxialStep, py::arg("enabled") = true,
+            "Propagation step length adapted to the curvature of the spinal cord (off by default)")
+        .def("set_partitioned_refinement", &SpinalCordSegmentation::setPartitionedRefinement, py::arg("enabled") = true,
+            "Global refinement by overlapping axial segments deformed in parallel (off by default)")
+        .def("set_rotation_grid_search", &SpinalCordSegmentation::setRotationGridSearch, py::arg("enabled") = true,
+            "Orientation of the propagation steps by a parallel grid search instead of the Amoeba optimizer (off by default)")
+        .def("set_pyramid_factor_initialisation", &SpinalCordSegmentation::setPyramidFactorInitialisation, py::arg("pyramid_factor"),
+            "Multiscale detection for the initialisation. 1: off (default), 0: factor chosen from the in-plane resolution, 2 or 4: downsampling factor")
+        .def("set_checkpoint_interval", &SpinalCordSegmentation::setCheckpointInterval, py::arg("interval"), py::arg("file_prefix") = "",
+            "Keep a checkpoint of the propagation every interval steps (0: off), written to <file_prefix>_<direction>_<step>.ckpt if file_prefix is not empty")
+        .def("resume_from_checkpoint", &SpinalCordSegmentation::resumeFromCheckpoint, py::arg("filename"),
+            "The next call continues the propagation from this checkpoint file (one per direction). Return False if the file cannot be read")
         .def("__repr__", [](const SpinalCordSegmentation& scs) {return "<pysct.SpinalCordSegmentation>";});
 }
\ No newline at end of file